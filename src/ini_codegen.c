@@ -0,0 +1,561 @@
+/**
+ * ini_codegen -- typed config structs and loaders from a schema
+ *
+ * usage: ini_codegen schema.ini prefix [outdir]
+ *
+ * The schema is an ini file whose keys declare the fields of a section as
+ * "type [default]", type one of int, bool, double, size, duration or
+ * string, converted as ini_convert_*() do: int is int64_t, bool an int,
+ * size bytes and duration milliseconds in uint64_t, string a char *.
+ *
+ * prefix.h gets a prefix_t struct with a member struct per section and
+ *     int prefix_init(prefix_t *config);
+ *     int prefix_load(const char *filename, prefix_t *config);
+ *     void prefix_free(prefix_t *config);
+ * prefix_init() sets the defaults, prefix_load() overwrites the fields
+ * found in a file and prefix_free() frees the strings. prefix.c tokenizes
+ * the file in place with ini_parse_mmap() and resolves names with a switch
+ * on their length and a memcmp(), so no tree is built: each value is
+ * converted straight into its field. Fields take the first occurrence of
+ * their key and strings the first line of a multi-line value, unknown
+ * sections and keys are skipped.
+ */
+
+#include "utils_ini.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+
+enum field_type
+{
+    FIELD_INT = 0,
+    FIELD_BOOL,
+    FIELD_DOUBLE,
+    FIELD_SIZE,
+    FIELD_DURATION,
+    FIELD_STRING,
+};
+
+static const struct
+{
+    const char *name;
+    const char *c_type;
+    const char *convert;
+} field_types[] = {
+    { "int", "int64_t", "ini_convert_int" },
+    { "bool", "int", "ini_convert_bool" },
+    { "double", "double", "ini_convert_double" },
+    { "size", "uint64_t", "ini_convert_size" },
+    { "duration", "uint64_t", "ini_convert_duration" },
+    { "string", "char *", NULL },
+};
+
+#define FIELD_TYPES_NUMBER (sizeof(field_types) / sizeof(field_types[0]))
+
+typedef struct field_s
+{
+    char name[INI_MAX_NAME];
+    char ident[INI_MAX_NAME + 2];
+    int type;
+    char *def;                  /* NULL for none */
+    size_t id;                  /* over all sections */
+} field_t;
+
+typedef struct schema_section_s
+{
+    char name[INI_MAX_SECTION];
+    char ident[INI_MAX_SECTION + 2];
+    field_t *fields;
+    size_t fields_number;
+} schema_section_t;
+
+typedef struct schema_s
+{
+    schema_section_t *sections;
+    size_t sections_number;
+    schema_section_t *section;  /* current */
+    size_t fields_number;
+    const char *filename;
+} schema_t;
+
+static const char *keywords[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do",
+    "double", "else", "enum", "extern", "float", "for", "goto", "if", "inline",
+    "int", "long", "register", "restrict", "return", "short", "signed",
+    "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned",
+    "void", "volatile", "while",
+};
+
+/* C identifier from a name: lower case, other characters as '_', '_'
+   before a leading digit and after a keyword. */
+static void make_ident(char *ident, size_t size, ini_str_t name)
+{
+    size_t len = 0;
+    if (name.len > 0 && isdigit((unsigned char)name.ptr[0]))
+        ident[len++] = '_';
+    for (size_t i = 0; i < name.len && len < size - 2; i++) {
+        unsigned char c = (unsigned char)name.ptr[i];
+        ident[len++] = isalnum(c) ? (char)tolower(c) : '_';
+    }
+    ident[len] = '\0';
+
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+        if (strcmp(ident, keywords[i]) == 0) {
+            ident[len++] = '_';
+            ident[len] = '\0';
+            break;
+        }
+    }
+}
+
+static schema_section_t* schema_section(schema_t *schema, ini_str_t name)
+{
+    for (size_t i = 0; i < schema->sections_number; i++) {
+        schema_section_t *section = &schema->sections[i];
+        if (strlen(section->name) == name.len && memcmp(section->name, name.ptr, name.len) == 0)
+            return section;
+    }
+
+    if (name.len == 0 || name.len >= INI_MAX_SECTION) {
+        fprintf(stderr, "%s: invalid section name '%.*s'\n", schema->filename,
+                (int)name.len, name.ptr);
+        return NULL;
+    }
+
+    schema_section_t *sections = (schema_section_t*)realloc(
+        schema->sections, (schema->sections_number + 1) * sizeof(schema_section_t));
+    if (sections == NULL)
+        return NULL;
+    schema->sections = sections;
+
+    schema_section_t *section = &sections[schema->sections_number];
+    memset(section, 0, sizeof(*section));
+    memcpy(section->name, name.ptr, name.len);
+    make_ident(section->ident, sizeof(section->ident), name);
+    for (size_t i = 0; i < schema->sections_number; i++) {
+        if (strcmp(sections[i].ident, section->ident) == 0) {
+            fprintf(stderr, "%s: sections '%s' and '%s' have the same identifier\n",
+                    schema->filename, sections[i].name, section->name);
+            return NULL;
+        }
+    }
+    schema->sections_number++;
+    return section;
+}
+
+/* Check that def converts to type, as the generated code converts it. */
+static int check_default(const field_t *field)
+{
+    ini_str_t s = { field->def, strlen(field->def) };
+    int64_t i;
+    int b;
+    double d;
+    uint64_t u;
+
+    switch (field->type) {
+    case FIELD_INT: return ini_convert_int(s, &i);
+    case FIELD_BOOL: return ini_convert_bool(s, &b);
+    case FIELD_DOUBLE:
+        /* inf and nan would be printed as nothing C can compile. */
+        return ini_convert_double(s, &d) != 0 || !isfinite(d) ? EINVAL : 0;
+    case FIELD_SIZE: return ini_convert_size(s, &u);
+    case FIELD_DURATION: return ini_convert_duration(s, &u);
+    default: return 0;
+    }
+}
+
+static int schema_field(schema_t *schema, ini_str_t name, ini_str_t value)
+{
+    schema_section_t *section = schema->section;
+    if (name.len >= INI_MAX_NAME) {
+        fprintf(stderr, "%s: name too long '%.*s'\n", schema->filename,
+                (int)name.len, name.ptr);
+        return -1;
+    }
+
+    size_t type_len = 0;
+    while (type_len < value.len && !isspace((unsigned char)value.ptr[type_len]))
+        type_len++;
+    int type = -1;
+    for (size_t i = 0; i < FIELD_TYPES_NUMBER; i++) {
+        if (strlen(field_types[i].name) == type_len
+            && memcmp(field_types[i].name, value.ptr, type_len) == 0)
+            type = (int)i;
+    }
+    if (type < 0) {
+        fprintf(stderr, "%s: [%s] %.*s: unknown type '%.*s'\n", schema->filename,
+                section->name, (int)name.len, name.ptr, (int)type_len, value.ptr);
+        return -1;
+    }
+
+    field_t *fields = (field_t*)realloc(section->fields,
+                                        (section->fields_number + 1) * sizeof(field_t));
+    if (fields == NULL)
+        return -1;
+    section->fields = fields;
+
+    field_t *field = &fields[section->fields_number];
+    memset(field, 0, sizeof(*field));
+    memcpy(field->name, name.ptr, name.len);
+    make_ident(field->ident, sizeof(field->ident), name);
+    field->type = type;
+    field->id = schema->fields_number;
+
+    for (size_t i = 0; i < section->fields_number; i++) {
+        if (strcmp(fields[i].ident, field->ident) == 0) {
+            fprintf(stderr, "%s: [%s] keys '%s' and '%s' have the same identifier\n",
+                    schema->filename, section->name, fields[i].name, field->name);
+            return -1;
+        }
+    }
+
+    size_t def = type_len;
+    while (def < value.len && isspace((unsigned char)value.ptr[def]))
+        def++;
+    if (def < value.len) {
+        field->def = strndup(value.ptr + def, value.len - def);
+        if (field->def == NULL)
+            return -1;
+        if (check_default(field) != 0) {
+            fprintf(stderr, "%s: [%s] %s: invalid default '%s'\n", schema->filename,
+                    section->name, field->name, field->def);
+            free(field->def);
+            return -1;
+        }
+    }
+
+    section->fields_number++;
+    schema->fields_number++;
+    return 0;
+}
+
+static int schema_visitor(void *user, const ini_event_t *event)
+{
+    schema_t *schema = (schema_t*)user;
+
+    switch (event->type) {
+    case INI_EVENT_SECTION:
+        schema->section = schema_section(schema, event->section);
+        return schema->section != NULL ? 0 : -1;
+    case INI_EVENT_KEY:
+        if (schema->section == NULL) {
+            fprintf(stderr, "%s:%d: key outside of a section\n", schema->filename,
+                    event->lineno);
+            return -1;
+        }
+        return schema_field(schema, event->name, event->value);
+    default:
+        fprintf(stderr, "%s:%d: invalid line '%.*s'\n", schema->filename, event->lineno,
+                (int)event->value.len, event->value.ptr);
+        return -1;
+    }
+}
+
+static void schema_free(schema_t *schema)
+{
+    for (size_t i = 0; i < schema->sections_number; i++) {
+        for (size_t j = 0; j < schema->sections[i].fields_number; j++)
+            free(schema->sections[i].fields[j].def);
+        free(schema->sections[i].fields);
+    }
+    free(schema->sections);
+}
+
+static void write_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if (isprint((unsigned char)*s))
+            fputc(*s, out);
+        else
+            fprintf(out, "\\%03o", (unsigned char)*s);
+    }
+    fputc('"', out);
+}
+
+static int write_header(FILE *out, const schema_t *schema, const char *prefix)
+{
+    char guard[256];
+    size_t len = 0;
+    for (; prefix[len] != '\0' && len < sizeof(guard) - 3; len++)
+        guard[len] = (char)toupper((unsigned char)prefix[len]);
+    strcpy(guard + len, "_H");
+
+    fprintf(out, "/* Generated by ini_codegen from %s, do not edit. */\n\n", schema->filename);
+    fprintf(out, "#ifndef %s\n#define %s\n\n#include <stdint.h>\n\n", guard, guard);
+    fprintf(out, "typedef struct %s_s\n{\n", prefix);
+    for (size_t i = 0; i < schema->sections_number; i++) {
+        const schema_section_t *section = &schema->sections[i];
+        fprintf(out, "    struct\n    {\n");
+        for (size_t j = 0; j < section->fields_number; j++) {
+            const field_t *field = &section->fields[j];
+            const char *c_type = field_types[field->type].c_type;
+            fprintf(out, "        %s%s%s; /* %s, %s */\n", c_type,
+                    c_type[strlen(c_type) - 1] == '*' ? "" : " ", field->ident,
+                    field->name, field_types[field->type].name);
+        }
+        fprintf(out, "    } %s; /* [%s] */\n", section->ident, section->name);
+    }
+    fprintf(out, "} %s_t;\n\n", prefix);
+
+    fprintf(out, "/* Set the defaults of the schema. Return 0 or ENOMEM. */\n");
+    fprintf(out, "int %s_init(%s_t *config);\n", prefix, prefix);
+    fprintf(out, "/* Overwrite the fields found in filename. Return 0 or -1. */\n");
+    fprintf(out, "int %s_load(const char *filename, %s_t *config);\n", prefix, prefix);
+    fprintf(out, "void %s_free(%s_t *config);\n\n", prefix, prefix);
+    fprintf(out, "#endif /* %s */\n", guard);
+    return 0;
+}
+
+typedef struct lookup_s
+{
+    const char *name;
+    size_t ret;
+} lookup_t;
+
+/* Code returning the ret of the entry named name: a switch on the length
+   of name, then a memcmp() against every entry of that length. */
+static void write_lookup(FILE *out, const char *indent, const lookup_t *entries,
+                         size_t number)
+{
+    fprintf(out, "%sswitch (name.len) {\n", indent);
+    for (size_t i = 0; i < number; i++) {
+        size_t len = strlen(entries[i].name);
+        int first = 1;
+        for (size_t j = 0; j < i && first; j++)
+            first = strlen(entries[j].name) != len;
+        if (!first)
+            continue;
+
+        fprintf(out, "%scase %zu:\n", indent, len);
+        for (size_t j = i; j < number; j++) {
+            if (strlen(entries[j].name) != len)
+                continue;
+            fprintf(out, "%s    if (memcmp(name.ptr, ", indent);
+            write_string(out, entries[j].name);
+            fprintf(out, ", %zu) == 0)\n%s        return %zu;\n", len, indent,
+                    entries[j].ret);
+        }
+        fprintf(out, "%s    break;\n", indent);
+    }
+    fprintf(out, "%s}\n", indent);
+}
+
+static int write_source(FILE *out, const schema_t *schema, const char *prefix)
+{
+    fprintf(out, "/* Generated by ini_codegen from %s, do not edit. */\n\n", schema->filename);
+    fprintf(out, "#include \"%s.h\"\n#include \"utils_ini.h\"\n\n", prefix);
+    fprintf(out, "#include <stdlib.h>\n#include <stdio.h>\n#include <string.h>\n"
+            "#include <errno.h>\n\n");
+
+    fprintf(out, "typedef struct %s_load_s\n{\n", prefix);
+    fprintf(out, "    %s_t *config;\n    long section;\n", prefix);
+    fprintf(out, "    unsigned char seen[%zu];\n} %s_load_t;\n\n",
+            schema->fields_number > 0 ? schema->fields_number : 1, prefix);
+
+    lookup_t *entries = (lookup_t*)calloc(schema->sections_number + schema->fields_number + 1,
+                                          sizeof(lookup_t));
+    if (entries == NULL)
+        return -1;
+
+    fprintf(out, "static long %s_section(ini_str_t name)\n{\n", prefix);
+    for (size_t i = 0; i < schema->sections_number; i++) {
+        entries[i].name = schema->sections[i].name;
+        entries[i].ret = i;
+    }
+    write_lookup(out, "    ", entries, schema->sections_number);
+    fprintf(out, "    return -1;\n}\n\n");
+
+    fprintf(out, "static long %s_field(long section, ini_str_t name)\n{\n", prefix);
+    fprintf(out, "    switch (section) {\n");
+    for (size_t i = 0; i < schema->sections_number; i++) {
+        const schema_section_t *section = &schema->sections[i];
+        for (size_t j = 0; j < section->fields_number; j++) {
+            entries[j].name = section->fields[j].name;
+            entries[j].ret = section->fields[j].id;
+        }
+        fprintf(out, "    case %zu:\n", i);
+        write_lookup(out, "        ", entries, section->fields_number);
+        fprintf(out, "        break;\n");
+    }
+    fprintf(out, "    }\n    return -1;\n}\n\n");
+    free(entries);
+
+    fprintf(out, "static int %s_string(char **field, ini_str_t value)\n{\n", prefix);
+    fprintf(out, "    char *copy = strndup(value.ptr, value.len);\n");
+    fprintf(out, "    if (copy == NULL)\n        return ENOMEM;\n");
+    fprintf(out, "    free(*field);\n    *field = copy;\n    return 0;\n}\n\n");
+
+    fprintf(out, "static int %s_handler(void *user, ini_str_t section, ini_str_t name,\n"
+            "%*sini_str_t value, long pos)\n{\n", prefix, (int)strlen(prefix) + 20, "");
+    fprintf(out, "    %s_load_t *load = (%s_load_t*)user;\n", prefix, prefix);
+    fprintf(out, "    if (name.ptr == NULL) {\n");
+    fprintf(out, "        load->section = %s_section(section);\n", prefix);
+    fprintf(out, "        return 0;\n    }\n\n");
+    fprintf(out, "    long field = %s_field(load->section, name);\n", prefix);
+    fprintf(out, "    if (field < 0 || load->seen[field])\n        return 0;\n");
+    fprintf(out, "    load->seen[field] = 1;\n\n");
+    fprintf(out, "    %s_t *config = load->config;\n    int ret = 0;\n", prefix);
+    fprintf(out, "    switch (field) {\n");
+    for (size_t i = 0; i < schema->sections_number; i++) {
+        const schema_section_t *section = &schema->sections[i];
+        for (size_t j = 0; j < section->fields_number; j++) {
+            const field_t *field = &section->fields[j];
+            fprintf(out, "    case %zu:\n", field->id);
+            if (field->type == FIELD_STRING)
+                fprintf(out, "        ret = %s_string(&config->%s.%s, value);\n", prefix,
+                        section->ident, field->ident);
+            else
+                fprintf(out, "        ret = %s(value, &config->%s.%s);\n",
+                        field_types[field->type].convert, section->ident, field->ident);
+            fprintf(out, "        break;\n");
+        }
+    }
+    fprintf(out, "    }\n\n");
+    fprintf(out, "    if (ret != 0) {\n");
+    fprintf(out, "        fprintf(stderr, \"Invalid value for arg:%%.*s in section:%%.*s at:%%ld\\n\",\n"
+            "                (int)name.len, name.ptr, (int)section.len, section.ptr, pos);\n");
+    fprintf(out, "        return -1;\n    }\n    return 0;\n}\n\n");
+
+    fprintf(out, "int %s_init(%s_t *config)\n{\n", prefix, prefix);
+    fprintf(out, "    memset(config, 0, sizeof(*config));\n");
+    for (size_t i = 0; i < schema->sections_number; i++) {
+        const schema_section_t *section = &schema->sections[i];
+        for (size_t j = 0; j < section->fields_number; j++) {
+            const field_t *field = &section->fields[j];
+            if (field->def == NULL)
+                continue;
+
+            ini_str_t s = { field->def, strlen(field->def) };
+            fprintf(out, "    config->%s.%s = ", section->ident, field->ident);
+            int64_t i64;
+            int b;
+            double d;
+            uint64_t u;
+            switch (field->type) {
+            case FIELD_INT:
+                ini_convert_int(s, &i64);
+                if (i64 == INT64_MIN)
+                    fprintf(out, "INT64_MIN;\n");
+                else
+                    fprintf(out, "%" PRId64 "LL;\n", i64);
+                break;
+            case FIELD_BOOL:
+                ini_convert_bool(s, &b);
+                fprintf(out, "%d;\n", b);
+                break;
+            case FIELD_DOUBLE:
+                ini_convert_double(s, &d);
+                fprintf(out, "%.17g;\n", d);
+                break;
+            case FIELD_SIZE:
+                ini_convert_size(s, &u);
+                fprintf(out, "%" PRIu64 "ULL;\n", u);
+                break;
+            case FIELD_DURATION:
+                ini_convert_duration(s, &u);
+                fprintf(out, "%" PRIu64 "ULL;\n", u);
+                break;
+            default:
+                fprintf(out, "strdup(");
+                write_string(out, field->def);
+                fprintf(out, ");\n    if (config->%s.%s == NULL) {\n", section->ident,
+                        field->ident);
+                fprintf(out, "        %s_free(config);\n        return ENOMEM;\n    }\n",
+                        prefix);
+                break;
+            }
+        }
+    }
+    fprintf(out, "    return 0;\n}\n\n");
+
+    fprintf(out, "int %s_load(const char *filename, %s_t *config)\n{\n", prefix, prefix);
+    fprintf(out, "    %s_load_t load;\n", prefix);
+    fprintf(out, "    memset(&load, 0, sizeof(load));\n");
+    fprintf(out, "    load.config = config;\n    load.section = -1;\n");
+    fprintf(out, "    return ini_parse_mmap(filename, %s_handler, &load) == 0 ? 0 : -1;\n}\n\n",
+            prefix);
+
+    fprintf(out, "void %s_free(%s_t *config)\n{\n", prefix, prefix);
+    size_t strings = 0;
+    for (size_t i = 0; i < schema->sections_number; i++) {
+        const schema_section_t *section = &schema->sections[i];
+        for (size_t j = 0; j < section->fields_number; j++) {
+            const field_t *field = &section->fields[j];
+            if (field->type != FIELD_STRING)
+                continue;
+            fprintf(out, "    free(config->%s.%s);\n", section->ident, field->ident);
+            fprintf(out, "    config->%s.%s = NULL;\n", section->ident, field->ident);
+            strings++;
+        }
+    }
+    if (strings == 0)
+        fprintf(out, "    (void)config;\n");
+    fprintf(out, "}\n");
+    return 0;
+}
+
+static int write_file(const char *dir, const char *prefix, const char *ext,
+                      const schema_t *schema,
+                      int (*write)(FILE*, const schema_t*, const char*))
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s%s", dir, prefix, ext);
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Can't write '%s'. errno:%d\n", path, errno);
+        return -1;
+    }
+
+    int ret = write(out, schema, prefix) != 0 || ferror(out) ? -1 : 0;
+    if (fclose(out) != 0)
+        ret = -1;
+    return ret;
+}
+
+static int valid_prefix(const char *prefix)
+{
+    if (!isalpha((unsigned char)prefix[0]) && prefix[0] != '_')
+        return 0;
+    for (; *prefix != '\0'; prefix++) {
+        if (!isalnum((unsigned char)*prefix) && *prefix != '_')
+            return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3 || !valid_prefix(argv[2])) {
+        fprintf(stderr, "usage: %s schema.ini prefix [outdir]\n", argv[0]);
+        return 2;
+    }
+
+    schema_t schema;
+    memset(&schema, 0, sizeof(schema));
+    schema.filename = argv[1];
+
+    FILE *file = fopen(argv[1], "r");
+    if (file == NULL) {
+        fprintf(stderr, "Can't open '%s'. errno:%d\n", argv[1], errno);
+        return 1;
+    }
+    int ret = ini_visit_file(file, schema_visitor, &schema);
+    fclose(file);
+
+    const char *dir = argc > 3 ? argv[3] : ".";
+    if (ret == 0)
+        ret = write_file(dir, argv[2], ".h", &schema, write_header);
+    if (ret == 0)
+        ret = write_file(dir, argv[2], ".c", &schema, write_source);
+
+    schema_free(&schema);
+    return ret == 0 ? 0 : 1;
+}
@@ -3,6 +3,7 @@
  */
 
 #include "utils_ini.h"
+#include "utils_ini_priv.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -13,35 +14,20 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <sys/types.h>
-
-#ifndef INI_INLINE_COMMENT_PREFIXES
-#define INI_INLINE_COMMENT_PREFIXES ";"
-#endif
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
 
 /* Maximum line length for any line in INI file. */
 #ifndef INI_MAX_LINE
 #define INI_MAX_LINE 512
 #endif
 
-#define sfree(ptr)                                                             \
-  do {                                                                         \
-    free(ptr);                                                                 \
-    (ptr) = NULL;                                                              \
-  } while (0)
-
-#define APPED_ITEM(head, item)  \
-    do {                        \
-        item->next = head;  \
-        head = item;        \
-    } while(0)
-
-#define LOG_DBG 0
-#define LOG_ERR 1
-#define DEBUG(...) print_log(LOG_DBG, __VA_ARGS__)
-#define ERROR(...) print_log(LOG_ERR, __VA_ARGS__)
-
-typedef int (*HANDLER)(void *user, const char *section,
-                       const char *name, const char *value, long pos);
+/* Read buffer of ini_visit_fd()/ini_visit_file(), the longest line. */
+#ifndef INI_VISIT_BUFFER
+#define INI_VISIT_BUFFER (8 * 1024)
+#endif
 
 typedef struct get_section_user_s
 {
@@ -56,6 +42,27 @@ typedef struct get_arg_user_s
     char arg_name[INI_MAX_NAME];
 } get_arg_user_t;
 
+typedef struct get_args_key_s
+{
+    char section_name[INI_MAX_SECTION];
+    char arg_name[INI_MAX_NAME];
+    size_t same;                /* next query for the same pair, or 0 */
+    int repeated;               /* not the first query for its pair */
+    int done;
+} get_args_key_t;
+
+typedef struct get_args_user_s
+{
+    ini_query_t *queries;
+    get_args_key_t *keys;
+    ini_index_t sections_index;   /* section name -> 1 */
+    ini_index_t args_index;       /* (section, name) -> query index + 1 */
+    uint64_t section_hash;        /* of the current section and the NUL */
+    int section_wanted;
+    size_t active;                /* query index + 1 whose run is being read */
+    size_t remaining;             /* distinct pairs not done */
+} get_args_user_t;
+
 typedef struct add_args_user_s
 {
     long section_pos;
@@ -65,19 +72,6 @@ typedef struct add_args_user_s
     char section_name[INI_MAX_SECTION];
 } add_arg_user_t;
 
-void print_log(int level, const char *format, ...)
-{
-  char msg[1024];
-  va_list ap;
-
-  va_start(ap, format);
-  vsnprintf(msg, sizeof(msg), format, ap);
-  msg[sizeof(msg) - 1] = '\0';
-  va_end(ap);
-
-  printf("%s\n", msg);
-} /* void plugin_log */
-
 int strarray_add(char ***ret_array, size_t *ret_array_len,
                  char const *str) /* {{{ */
 {
@@ -91,16 +85,45 @@ int strarray_add(char ***ret_array, size_t *ret_array_len,
   if (array == NULL)
     return (ENOMEM);
   *ret_array = array;
+  INI_STATS_ALLOC((array_len + 1) * sizeof(*array));
 
   array[array_len] = strdup(str);
   if (array[array_len] == NULL)
     return (ENOMEM);
+  INI_STATS_ALLOC(strlen(str) + 1);
+  INI_STATS_ADD(INI_STAT_VALUES, 1);
 
   array_len++;
   *ret_array_len = array_len;
   return (0);
 } /* }}} int strarray_add */
 
+int strarray_addn(char ***ret_array, size_t *ret_array_len,
+                  char const *str, size_t len) /* {{{ */
+{
+  char **array;
+  size_t array_len = *ret_array_len;
+
+  if (str == NULL)
+    return (EINVAL);
+
+  array = (char**)realloc(*ret_array, (array_len + 1) * sizeof(*array));
+  if (array == NULL)
+    return (ENOMEM);
+  *ret_array = array;
+  INI_STATS_ALLOC((array_len + 1) * sizeof(*array));
+
+  array[array_len] = strndup(str, len);
+  if (array[array_len] == NULL)
+    return (ENOMEM);
+  INI_STATS_ALLOC(strnlen(str, len) + 1);
+  INI_STATS_ADD(INI_STAT_VALUES, 1);
+
+  array_len++;
+  *ret_array_len = array_len;
+  return (0);
+} /* }}} int strarray_addn */
+
 void strarray_free(char **array, size_t array_len) /* {{{ */
 {
   for (size_t i = 0; i < array_len; i++)
@@ -119,7 +142,7 @@ static char* sstrncpy(char *dest, const char *src, size_t n)
 static char* rstrip(char* s)
 {
     char* p = s + strlen(s);
-    while (p > s && isspace((unsigned char)(*--p)))
+    while (p > s && ini_isspace(*--p))
         *p = '\0';
     return s;
 }
@@ -127,7 +150,7 @@ static char* rstrip(char* s)
 /* Return pointer to first non-whitespace char in given string. */
 static char* lskip(const char* s)
 {
-    while (*s && isspace((unsigned char)(*s)))
+    while (*s && ini_isspace(*s))
         s++;
     return (char*)s;
 }
@@ -137,19 +160,43 @@ static char* lskip(const char* s)
    be prefixed by a whitespace character to register as a comment. */
 static char* find_chars_or_comment(const char* s, const char* chars)
 {
-    int was_space = 0;
-    while (*s && (!chars || !strchr(chars, *s)) &&
-           !(was_space && strchr(INI_INLINE_COMMENT_PREFIXES, *s))) {
-        was_space = isspace((unsigned char)(*s));
+    return (char*)ini_scan_ops->find_chars_or_comment(s, s + strlen(s), chars);
+}
+
+/* Same as rstrip() for the [s, end) range, without writing to it.
+   Return the new end. */
+static const char* buf_rstrip(const char *s, const char *end)
+{
+    while (end > s && ini_isspace(end[-1]))
+        end--;
+    return end;
+}
+
+/* Same as lskip() for the [s, end) range. */
+static const char* buf_lskip(const char *s, const char *end)
+{
+    while (s < end && ini_isspace(*s))
         s++;
-    }
+    return s;
+}
 
-    return (char*)s;
+/* Same as find_chars_or_comment() for the [s, end) range. Return end if
+   neither found. */
+static inline const char* buf_find_chars_or_comment(const char *s, const char *end,
+                                                    const char *chars)
+{
+    return ini_scan_ops->find_chars_or_comment(s, end, chars);
+}
+
+static inline ini_str_t make_str(const char *begin, const char *end)
+{
+    ini_str_t str = { begin, (size_t)(end - begin) };
+    return str;
 }
 
-static int ini_parse_handler(void *user, const char *section,
-                             const char *name, const char *value,
-                             long __attribute__((unused)) pos )
+int ini_parse_handler(void *user, const char *section,
+                      const char *name, const char *value,
+                      long __attribute__((unused)) pos )
 {
     DEBUG("section:%s; name:%s; value:%s", section, name, value);
 
@@ -159,6 +206,8 @@ static int ini_parse_handler(void *user, const char *section,
         ini_section_t *section_item = (ini_section_t*)calloc(1, sizeof(ini_section_t));
         sstrncpy(section_item->data.name, section, INI_MAX_SECTION);
         APPED_ITEM((*section_head), section_item);
+        INI_STATS_ADD(INI_STAT_SECTIONS, 1);
+        INI_STATS_ALLOC(sizeof(ini_section_t));
     }
 
     if (name == NULL)
@@ -171,6 +220,8 @@ static int ini_parse_handler(void *user, const char *section,
         ini_arg_t *item = (ini_arg_t*)calloc(1, sizeof(ini_arg_t));
         sstrncpy(item->data.name, name, INI_MAX_NAME);
         APPED_ITEM((*ini_arg), item);
+        INI_STATS_ADD(INI_STAT_KEYS, 1);
+        INI_STATS_ALLOC(sizeof(ini_arg_t));
     }
 
     if (0 != strarray_add(&(*ini_arg)->data.values,
@@ -202,6 +253,8 @@ static int get_section_handler(void *user, const char *section,
     if (section_user->section_data == NULL) {
         section_user->section_data = (ini_section_data_t*)calloc(1, sizeof(ini_section_data_t));
         sstrncpy(section_user->section_data->name, section, INI_MAX_SECTION);
+        INI_STATS_ADD(INI_STAT_SECTIONS, 1);
+        INI_STATS_ALLOC(sizeof(ini_section_data_t));
     }
 
     if (name == NULL)
@@ -213,6 +266,8 @@ static int get_section_handler(void *user, const char *section,
         ini_arg_t *arg_item = (ini_arg_t*)calloc(1, sizeof(ini_arg_t));
         sstrncpy(arg_item->data.name, name, INI_MAX_NAME);
         APPED_ITEM((*ini_arg), arg_item);
+        INI_STATS_ADD(INI_STAT_KEYS, 1);
+        INI_STATS_ALLOC(sizeof(ini_arg_t));
     }
 
     if (0 != strarray_add(&(*ini_arg)->data.values,
@@ -248,6 +303,8 @@ static int get_arg_handler(void *user, const char *section,
     if (arg_user->arg_data == NULL) {
         arg_user->arg_data = (ini_arg_data_t*)calloc(1, sizeof(ini_arg_data_t));
         sstrncpy(arg_user->arg_data->name, name, sizeof(arg_user->arg_data->name));
+        INI_STATS_ADD(INI_STAT_KEYS, 1);
+        INI_STATS_ALLOC(sizeof(ini_arg_data_t));
     }
 
     if (0 != strarray_add(&arg_user->arg_data->values,
@@ -262,6 +319,73 @@ static int get_arg_handler(void *user, const char *section,
     return 0;
 }
 
+static void get_args_enter(get_args_user_t *args_user, const char *section)
+{
+    size_t len = strlen(section);
+    args_user->section_wanted = ini_index_find(&args_user->sections_index,
+                                               ini_hash_key(section, len, NULL, 0),
+                                               section, len, NULL, 0) != NULL;
+    args_user->section_hash = ini_fnv1a(ini_fnv1a(INI_FNV_OFFSET, section, len), "", 1);
+}
+
+/* get_arg_handler() for many pairs at once: each query takes the first
+   run of its pair, the parse stops once every run has ended. */
+static int get_args_handler(void *user, const char *section,
+                            const char *name, const char *value,
+                            long __attribute__((unused)) pos)
+{
+    DEBUG("section:%s; name:%s; value:%s", section, name, value);
+
+    get_args_user_t *args_user = (get_args_user_t*)(user);
+    if (name == NULL) {
+        get_args_enter(args_user, section);
+        return 0;
+    }
+
+    if (args_user->active) {
+        get_args_key_t *key = &args_user->keys[args_user->active - 1];
+        if (strcmp(section, key->section_name) != 0 || strcmp(name, key->arg_name) != 0) {
+            key->done = 1;
+            args_user->active = 0;
+            if (--args_user->remaining == 0)
+                return 1;
+        }
+    }
+
+    if (!args_user->active) {
+        if (!args_user->section_wanted)
+            return 0;
+
+        size_t section_len = strlen(section);
+        size_t name_len = strlen(name);
+        uintptr_t index = (uintptr_t)ini_index_find(
+            &args_user->args_index,
+            ini_fnv1a(args_user->section_hash, name, name_len),
+            section, section_len, name, name_len);
+        if (index == 0 || args_user->keys[index - 1].done)
+            return 0;
+
+        ini_query_t *query = &args_user->queries[index - 1];
+        query->arg_data = (ini_arg_data_t*)calloc(1, sizeof(ini_arg_data_t));
+        if (query->arg_data == NULL)
+            return -1;
+        sstrncpy(query->arg_data->name, name, sizeof(query->arg_data->name));
+        args_user->active = index;
+        INI_STATS_ADD(INI_STAT_KEYS, 1);
+        INI_STATS_ALLOC(sizeof(ini_arg_data_t));
+    }
+
+    ini_arg_data_t *arg_data = args_user->queries[args_user->active - 1].arg_data;
+    if (0 != strarray_add(&arg_data->values, &arg_data->values_number, value))
+    {
+        ERROR("Failed to add value to args. section:%s, name:%s, value:%s\n",
+              section, name, value);
+        return -1;
+    }
+
+    return 0;
+}
+
 static int add_arg_handler(void *user, const char *section,
                            const char *name, const char *value, long pos)
 {
@@ -305,7 +429,7 @@ static int add_arg_handler(void *user, const char *section,
     return 0;
 }
 
-static int parse_stream(void *stream, HANDLER handler, void *user)
+int parse_stream(void *stream, HANDLER handler, void *user)
 {
     char line[INI_MAX_LINE];
     char section[INI_MAX_SECTION] = "";
@@ -318,6 +442,7 @@ static int parse_stream(void *stream, HANDLER handler, void *user)
     int lineno = 0;
     int ret = 0;
     long pos = ftell(stream);
+    long start_pos = pos;
 
     /* Scan through stream line by line */
     while (fgets(line, INI_MAX_LINE, stream) != NULL) {
@@ -373,10 +498,428 @@ static int parse_stream(void *stream, HANDLER handler, void *user)
     if (ret < 0) {
         ERROR("Failed to parse ini. line=%d\n", lineno);
     }
+    INI_STATS_ADD(INI_STAT_LINES_SCANNED, lineno);
+    INI_STATS_ADD(INI_STAT_BYTES_SCANNED, ftell(stream) - start_pos);
 
     return ret;
 }
 
+/* Tokenizer state carried from one buffer to the next. */
+typedef struct ini_tokenizer_s
+{
+    ini_str_t section;
+    ini_str_t prev_name;
+    int in_section;             /* a header has been seen */
+    int malformed;              /* stopped at a malformed line */
+    int lineno;
+    long offset;                /* of the buffer in the input */
+} ini_tokenizer_t;
+
+static const char empty_str[] = "";
+
+static void tokenizer_init(ini_tokenizer_t *tok)
+{
+    memset(tok, 0, sizeof(ini_tokenizer_t));
+    tok->section = make_str(empty_str, empty_str);
+    tok->prev_name = make_str(empty_str, empty_str);
+}
+
+/* Tokenize buf line by line in place, reporting lines as events. Inlined
+   into each caller, so a visitor known there is a direct call. A malformed
+   line is reported as an INI_EVENT_ERROR event and stops the scan.
+   end_pos is set past the last line accepted. */
+static inline __attribute__((always_inline))
+int tokenize(const char *buf, size_t len, ini_tokenizer_t *tok, int flags,
+             size_t *end_pos, ini_visitor visitor, void *user)
+{
+    ini_str_t no_str = { NULL, 0 };
+    ini_event_t event;
+
+    const char *p = buf;
+    const char *buf_end = buf + len;
+    const char *line;
+    const char *line_end = NULL;
+    const char *start = NULL;
+    const char *end;
+    int ret = 0;
+    int start_lineno = tok->lineno;
+
+    *end_pos = 0;
+
+    /* Scan through buffer line by line */
+    while (p < buf_end) {
+        tok->lineno++;
+
+        line = p;
+        line_end = ini_scan_ops->find_eol(p, buf_end);
+        p = line_end < buf_end ? line_end + 1 : buf_end;
+
+        line_end = buf_rstrip(line, line_end);
+        start = buf_lskip(line, line_end);
+        event.offset = tok->offset + (long)(line - buf);
+        event.lineno = tok->lineno;
+        event.section = tok->section;
+
+        if (start == line_end) {
+            /* Blank line */
+        } else if (*start == ';' || *start == '#') {
+            /* Per Python configparser, allow both ; and # comments at the
+               start of a line */
+        } else if (tok->prev_name.len && start > line) {
+            /* Non-blank line with leading whitespace, treat as continuation
+               of previous name's value (as per Python configparser). */
+            event.type = INI_EVENT_CONTINUATION;
+            event.name = tok->prev_name;
+            event.value = make_str(start, line_end);
+            if (!(flags & INI_PARSE_HEADERS)
+                && (ret = visitor(user, &event)) != 0)
+                break;
+        }
+        else if (*start == '[') {
+            /* A "[section]" line */
+            end = buf_find_chars_or_comment(start + 1, line_end, "]");
+            if (end == line_end || *end != ']') { // No ']' found on section line
+                tok->malformed = 1;
+                break;
+            }
+
+            tok->section = make_str(start + 1, end);
+            tok->prev_name = make_str(empty_str, empty_str);
+            tok->in_section = 1;
+            event.type = INI_EVENT_SECTION;
+            event.section = tok->section;
+            event.name = no_str;
+            event.value = no_str;
+            if ((ret = visitor(user, &event)) != 0)
+                break;
+        } else {
+            /* Not a comment, must be a name[=:]value pair */
+            end = buf_find_chars_or_comment(start, line_end, "=:");
+            if (end == line_end || (*end != '=' && *end != ':')) { // No '=' or ':' found on name[=:]value line
+                tok->malformed = 1;
+                break;
+            }
+
+            event.type = INI_EVENT_KEY;
+            event.name = make_str(start, buf_rstrip(start, end));
+            tok->prev_name = event.name;
+            if (flags & INI_PARSE_HEADERS) {
+                event.value = no_str;
+                if (!tok->in_section && (ret = visitor(user, &event)) != 0)
+                    break;
+            } else {
+                const char *value = end + 1;
+                end = buf_find_chars_or_comment(value, line_end, NULL);
+                value = buf_lskip(value, end);
+
+                /* Valid name[=:]value pair found, call handler */
+                event.value = make_str(value, buf_rstrip(value, end));
+                if ((ret = visitor(user, &event)) != 0)
+                    break;
+            }
+        }
+
+        /* Past the line only once it has been accepted. */
+        *end_pos = (size_t)(p - buf);
+    }
+
+    if (tok->malformed) {
+        event.type = INI_EVENT_ERROR;
+        event.name = no_str;
+        event.value = make_str(start, line_end);
+        ret = visitor(user, &event);
+    }
+    INI_STATS_ADD(INI_STAT_LINES_SCANNED, tok->lineno - start_lineno);
+    INI_STATS_ADD(INI_STAT_BYTES_SCANNED, p - buf);
+
+    return ret;
+}
+
+typedef struct str_handler_user_s
+{
+    ini_str_handler handler;
+    void *user;
+} str_handler_user_t;
+
+/* Malformed lines end the parse quietly, as in parse_stream(). */
+static inline int str_handler_visitor(void *user, const ini_event_t *event)
+{
+    str_handler_user_t *handler_user = (str_handler_user_t*)user;
+    if (event->type == INI_EVENT_ERROR)
+        return 0;
+    return handler_user->handler(handler_user->user, event->section, event->name,
+                                 event->value, event->offset);
+}
+
+/* parse_stream() over an in-memory buffer. Lines are tokenized in place
+   and passed to the handler as slices of buf, pos is the offset of the
+   line in buf. Unlike fgets(), lines are not limited to INI_MAX_LINE and
+   names are not truncated. */
+int parse_buffer(const char *buf, size_t len, ini_str_handler handler, void *user)
+{
+    return parse_buffer_ex(buf, len, handler, user, 0, NULL);
+}
+
+/* With INI_PARSE_HEADERS only section lines reach the handler, plus the
+   names (with a NULL value) of args before the first header; other lines
+   are only checked for well-formedness. end_pos, if not NULL, is set to
+   the offset of the line the parse stopped at, or len. */
+int parse_buffer_ex(const char *buf, size_t len, ini_str_handler handler,
+                    void *user, int flags, size_t *end_pos)
+{
+    str_handler_user_t handler_user = { handler, user };
+    ini_tokenizer_t tok;
+    tokenizer_init(&tok);
+
+    size_t pos;
+    int ret = tokenize(buf, len, &tok, flags, &pos, str_handler_visitor, &handler_user);
+    if (end_pos != NULL)
+        *end_pos = pos;
+
+    if (ret < 0) {
+        ERROR("Failed to parse ini. line=%d\n", tok.lineno);
+    }
+
+    return ret;
+}
+
+int ini_visit(const char *buf, size_t len, ini_visitor visitor, void *user)
+{
+    ini_tokenizer_t tok;
+    tokenizer_init(&tok);
+
+    size_t pos;
+    int ret = tokenize(buf, len, &tok, 0, &pos, visitor, user);
+    return tok.malformed ? -1 : ret;
+}
+
+/* Point a slice of the tokenizer state that is about to be overwritten at
+   a copy. */
+static void visit_keep(ini_str_t *str, char *copy, const char *buf, size_t len)
+{
+    if (str->ptr >= buf && str->ptr < buf + len) {
+        memcpy(copy, str->ptr, str->len);
+        str->ptr = copy;
+    }
+}
+
+typedef ssize_t (*visit_read_fn)(void *source, char *buf, size_t len);
+
+/* Read into a buffer on the stack and tokenize the whole lines in it, the
+   rest of the buffer is kept for the next read. */
+static int visit_stream(visit_read_fn read_fn, void *source, ini_visitor visitor,
+                        void *user)
+{
+    char buf[INI_VISIT_BUFFER];
+    char section[INI_VISIT_BUFFER];
+    char prev_name[INI_VISIT_BUFFER];
+    size_t fill = 0;
+    int eof = 0;
+    int ret = 0;
+
+    ini_tokenizer_t tok;
+    tokenizer_init(&tok);
+
+    while (!eof || fill) {
+        if (!eof) {
+            ssize_t n = read_fn(source, buf + fill, sizeof(buf) - fill);
+            if (n < 0) {
+                ERROR("Failed to read ini. errno:%d", errno);
+                return -1;
+            }
+            eof = n == 0;
+            fill += (size_t)n;
+        }
+
+        size_t len = fill;
+        if (!eof) {
+            while (len > 0 && buf[len - 1] != '\n')
+                len--;
+            if (len == 0) {
+                if (fill < sizeof(buf))
+                    continue;
+                ERROR("Line too long. line=%d", tok.lineno + 1);
+                return -1;
+            }
+        }
+
+        size_t pos;
+        ret = tokenize(buf, len, &tok, 0, &pos, visitor, user);
+        if (ret != 0 || tok.malformed)
+            break;
+
+        visit_keep(&tok.section, section, buf, len);
+        visit_keep(&tok.prev_name, prev_name, buf, len);
+        memmove(buf, buf + len, fill - len);
+        fill -= len;
+        tok.offset += (long)len;
+    }
+
+    return tok.malformed ? -1 : ret;
+}
+
+static ssize_t visit_read_fd(void *source, char *buf, size_t len)
+{
+    ssize_t n;
+    do {
+        n = read(*(int*)source, buf, len);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+static ssize_t visit_read_file(void *source, char *buf, size_t len)
+{
+    size_t n = fread(buf, 1, len, (FILE*)source);
+    return n == 0 && ferror((FILE*)source) ? -1 : (ssize_t)n;
+}
+
+int ini_visit_fd(int fd, ini_visitor visitor, void *user)
+{
+    return visit_stream(visit_read_fd, &fd, visitor, user);
+}
+
+int ini_visit_file(FILE *file, ini_visitor visitor, void *user)
+{
+    return visit_stream(visit_read_file, file, visitor, user);
+}
+
+struct ini_push_s
+{
+    ini_visitor visitor;
+    void *user;
+    ini_tokenizer_t tok;
+    int ret;                    /* sticky once the parse stopped */
+    char *carry;                /* start of a line split across feeds */
+    size_t carry_len;
+    size_t carry_capacity;
+    char *section;              /* copies of the tokenizer slices */
+    size_t section_capacity;
+    char *prev_name;
+    size_t prev_name_capacity;
+};
+
+static int push_reserve(char **buf, size_t *capacity, size_t size)
+{
+    if (size <= *capacity)
+        return 0;
+
+    size_t bigger = *capacity ? *capacity : 64;
+    while (bigger < size)
+        bigger *= 2;
+    char *tmp = (char*)realloc(*buf, bigger);
+    if (tmp == NULL)
+        return ENOMEM;
+    *buf = tmp;
+    *capacity = bigger;
+    return 0;
+}
+
+/* visit_keep() into a buffer that grows with the slice. */
+static int push_keep(ini_str_t *str, char **copy, size_t *capacity,
+                     const char *buf, size_t len)
+{
+    if (str->ptr < buf || str->ptr >= buf + len)
+        return 0;
+    if (push_reserve(copy, capacity, str->len + 1) != 0)
+        return ENOMEM;
+    memcpy(*copy, str->ptr, str->len);
+    str->ptr = *copy;
+    return 0;
+}
+
+/* Tokenize whole lines of a buffer that goes away afterwards. */
+static int push_run(ini_push_t *push, const char *buf, size_t len)
+{
+    size_t pos;
+    push->ret = tokenize(buf, len, &push->tok, 0, &pos, push->visitor, push->user);
+    if (push->tok.malformed)
+        push->ret = -1;
+    if (push->ret == 0
+        && (push_keep(&push->tok.section, &push->section, &push->section_capacity,
+                      buf, len) != 0
+            || push_keep(&push->tok.prev_name, &push->prev_name,
+                         &push->prev_name_capacity, buf, len) != 0))
+        push->ret = -1;
+    push->tok.offset += (long)len;
+    return push->ret;
+}
+
+static int push_carry(ini_push_t *push, const char *data, size_t len)
+{
+    if (push_reserve(&push->carry, &push->carry_capacity, push->carry_len + len) != 0) {
+        ERROR("Failed to buffer line. line=%d", push->tok.lineno + 1);
+        push->ret = -1;
+        return -1;
+    }
+    memcpy(push->carry + push->carry_len, data, len);
+    push->carry_len += len;
+    return 0;
+}
+
+ini_push_t* ini_push_new(ini_visitor visitor, void *user)
+{
+    ini_push_t *push = (ini_push_t*)calloc(1, sizeof(ini_push_t));
+    if (push == NULL)
+        return NULL;
+
+    push->visitor = visitor;
+    push->user = user;
+    tokenizer_init(&push->tok);
+    return push;
+}
+
+/* Whole lines are tokenized straight from data; only the line a chunk
+   ends in the middle of is copied, until its end arrives. */
+int ini_push_feed(ini_push_t *push, const char *data, size_t len)
+{
+    if (push->ret != 0)
+        return push->ret;
+
+    if (push->carry_len) {
+        const char *eol = (const char*)memchr(data, '\n', len);
+        size_t take = eol != NULL ? (size_t)(eol + 1 - data) : len;
+        if (push_carry(push, data, take) != 0 || eol == NULL)
+            return push->ret;
+
+        data += take;
+        len -= take;
+        size_t line_len = push->carry_len;
+        push->carry_len = 0;
+        if (push_run(push, push->carry, line_len) != 0)
+            return push->ret;
+    }
+
+    size_t whole = len;
+    while (whole > 0 && data[whole - 1] != '\n')
+        whole--;
+    if (whole && push_run(push, data, whole) != 0)
+        return push->ret;
+
+    push_carry(push, data + whole, len - whole);
+    return push->ret;
+}
+
+int ini_push_finish(ini_push_t *push)
+{
+    if (push->ret == 0 && push->carry_len) {
+        size_t len = push->carry_len;
+        push->carry_len = 0;
+        push_run(push, push->carry, len);
+    }
+    return push->ret;
+}
+
+void ini_push_free(ini_push_t *push)
+{
+    if (push == NULL)
+        return;
+
+    sfree(push->carry);
+    sfree(push->section);
+    sfree(push->prev_name);
+    free(push);
+}
+
 void free_arg_data(ini_arg_data_t *arg)
 {
     if (arg == NULL)
@@ -460,6 +1003,7 @@ ini_section_t* ini_parse(const char* filename)
         return NULL;
     }
 
+    uint64_t start = ini_stats_start();
     ini_section_t* section_head = NULL;
     if (parse_stream(file, ini_parse_handler, &section_head) != 0
         && section_head != NULL) {
@@ -468,6 +1012,7 @@ ini_section_t* ini_parse(const char* filename)
     }
 
     fclose(file);
+    ini_stats_stop(INI_TIMER_PARSE, start);
 
     return section_head;
 }
@@ -481,16 +1026,20 @@ ini_section_data_t* get_section(const char *filename, const char *section_name)
         return NULL;
     }
 
+    uint64_t start = ini_stats_start();
     get_section_user_t section_user;
     memset(&section_user, 0, sizeof(get_section_user_t));
     sstrncpy(section_user.name, section_name, sizeof(section_user.name));
-    if (parse_stream(file, get_section_handler, &section_user) < 0
-        && section_user.section_data != NULL) {
+    int ret = parse_stream(file, get_section_handler, &section_user);
+    if (ret < 0 && section_user.section_data != NULL) {
             free_section_data(section_user.section_data);
             section_user.section_data = NULL;
     }
+    if (ret > 0)
+        INI_STATS_ADD(INI_STAT_EARLY_STOPS, 1);
 
     fclose(file);
+    ini_stats_stop(INI_TIMER_LOOKUP, start);
 
     return section_user.section_data;
 }
@@ -505,21 +1054,294 @@ ini_arg_data_t* get_arg(const char *filename, const char *section_name,
         return NULL;
     }
 
+    uint64_t start = ini_stats_start();
     get_arg_user_t arg_user;
     memset(&arg_user, 0, sizeof(get_arg_user_t));
     sstrncpy(arg_user.section_name, section_name, sizeof(arg_user.section_name));
     sstrncpy(arg_user.arg_name, arg_name, sizeof(arg_user.arg_name));
-    if (parse_stream(file, get_arg_handler, &arg_user) < 0
-        && arg_user.arg_data != NULL) {
+    int ret = parse_stream(file, get_arg_handler, &arg_user);
+    if (ret < 0 && arg_user.arg_data != NULL) {
             free_arg_data(arg_user.arg_data);
             arg_user.arg_data = NULL;
     }
+    if (ret > 0)
+        INI_STATS_ADD(INI_STAT_EARLY_STOPS, 1);
 
     fclose(file);
+    ini_stats_stop(INI_TIMER_LOOKUP, start);
 
     return arg_user.arg_data;
 }
 
+static int get_args_prepare(get_args_user_t *args_user, ini_query_t *queries,
+                            size_t queries_number)
+{
+    args_user->queries = queries;
+    args_user->keys = (get_args_key_t*)calloc(queries_number, sizeof(get_args_key_t));
+    if (args_user->keys == NULL
+        || ini_index_init(&args_user->sections_index, queries_number) != 0
+        || ini_index_init(&args_user->args_index, queries_number) != 0)
+        return ENOMEM;
+
+    for (size_t i = 0; i < queries_number; i++) {
+        get_args_key_t *key = &args_user->keys[i];
+        queries[i].arg_data = NULL;
+        sstrncpy(key->section_name, queries[i].section_name, sizeof(key->section_name));
+        sstrncpy(key->arg_name, queries[i].arg_name, sizeof(key->arg_name));
+
+        size_t section_len = strlen(key->section_name);
+        size_t name_len = strlen(key->arg_name);
+        ini_index_slot_t *slot = ini_index_insert(
+            &args_user->sections_index, ini_hash_key(key->section_name, section_len, NULL, 0),
+            key->section_name, section_len, NULL, 0);
+        if (slot == NULL)
+            return ENOMEM;
+        slot->value = (void*)1;
+
+        slot = ini_index_insert(&args_user->args_index,
+                                ini_hash_key(key->section_name, section_len,
+                                             key->arg_name, name_len),
+                                key->section_name, section_len, key->arg_name, name_len);
+        if (slot == NULL)
+            return ENOMEM;
+        if (slot->value == NULL) {
+            slot->value = (void*)(uintptr_t)(i + 1);
+            args_user->remaining++;
+        } else {
+            /* Repeated pair, filled from the first query at the end. */
+            get_args_key_t *first = &args_user->keys[(uintptr_t)slot->value - 1];
+            key->same = first->same;
+            first->same = i + 1;
+            key->repeated = 1;
+            key->done = 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Give repeated queries a copy of the first one's result. */
+static int get_args_copy_same(get_args_user_t *args_user, size_t queries_number)
+{
+    for (size_t i = 0; i < queries_number; i++) {
+        const ini_arg_data_t *arg_data = args_user->queries[i].arg_data;
+        if (arg_data == NULL || args_user->keys[i].repeated)
+            continue;
+
+        for (size_t j = args_user->keys[i].same; j != 0; j = args_user->keys[j - 1].same) {
+            ini_arg_data_t *copy = (ini_arg_data_t*)calloc(1, sizeof(ini_arg_data_t));
+            if (copy == NULL)
+                return ENOMEM;
+            args_user->queries[j - 1].arg_data = copy;
+            memcpy(copy->name, arg_data->name, sizeof(copy->name));
+            for (size_t k = 0; k < arg_data->values_number; k++) {
+                if (strarray_add(&copy->values, &copy->values_number,
+                                 arg_data->values[k]) != 0)
+                    return ENOMEM;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int get_args(const char *filename, ini_query_t *queries, size_t queries_number)
+{
+    uint64_t start = ini_stats_start();
+    get_args_user_t args_user;
+    memset(&args_user, 0, sizeof(get_args_user_t));
+
+    int ret = get_args_prepare(&args_user, queries, queries_number);
+    FILE *file = NULL;
+    if (ret == 0 && queries_number != 0) {
+        file = fopen(filename, "r");
+        if (!file) {
+            ERROR("Failed to open file:%s. errno:%d", filename, errno);
+            ret = -1;
+        }
+    }
+
+    if (file != NULL) {
+        get_args_enter(&args_user, "");
+        ret = parse_stream(file, get_args_handler, &args_user);
+        if (ret > 0)
+            INI_STATS_ADD(INI_STAT_EARLY_STOPS, 1);
+        ret = ret < 0 ? -1 : 0;
+        fclose(file);
+
+        /* A run still open at the end of the file is complete. */
+        if (args_user.active)
+            args_user.keys[args_user.active - 1].done = 1;
+        if (ret == 0)
+            ret = get_args_copy_same(&args_user, queries_number);
+    }
+
+    size_t found = 0;
+    for (size_t i = 0; i < queries_number; i++) {
+        if (ret != 0 && queries[i].arg_data != NULL) {
+            free_arg_data(queries[i].arg_data);
+            queries[i].arg_data = NULL;
+        }
+        found += queries[i].arg_data != NULL;
+    }
+
+    sfree(args_user.keys);
+    ini_index_free(&args_user.sections_index);
+    ini_index_free(&args_user.args_index);
+    ini_stats_stop(INI_TIMER_LOOKUP, start);
+    return ret == 0 ? (int)found : -1;
+}
+
+/* Locked on the inode the name refers to once the lock is held: a file
+   replaced by a rename while waiting is reopened. */
+FILE* ini_open_locked(const char *filename)
+{
+    for (;;) {
+        int fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        if (fd == -1) {
+            ERROR("Failed to open file:%s. errno:%d", filename, errno);
+            return NULL;
+        }
+
+        int ret;
+        while ((ret = flock(fd, LOCK_EX)) != 0 && errno == EINTR)
+            ;
+        if (ret != 0) {
+            ERROR("Failed to lock file:%s. errno:%d", filename, errno);
+            close(fd);
+            return NULL;
+        }
+
+        struct stat fd_st, name_st;
+        if (fstat(fd, &fd_st) == 0 && stat(filename, &name_st) == 0
+            && fd_st.st_ino == name_st.st_ino && fd_st.st_dev == name_st.st_dev) {
+            FILE *file = fdopen(fd, "rb+");
+            if (file == NULL) {
+                ERROR("Failed to open file:%s. errno:%d", filename, errno);
+                close(fd);
+            }
+            return file;
+        }
+        close(fd);
+    }
+}
+
+/* umask() can only be read by setting it, which races with other threads
+   creating files. */
+static mode_t current_umask(void)
+{
+    unsigned int mask = 022;
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status != NULL) {
+        char line[128];
+        while (fgets(line, sizeof(line), status) != NULL) {
+            if (sscanf(line, "Umask: %o", &mask) == 1)
+                break;
+        }
+        fclose(status);
+    }
+    return (mode_t)mask;
+}
+
+FILE* ini_temp_create(const char *name, char **tmp_name)
+{
+    size_t len = strlen(name);
+    *tmp_name = (char*)malloc(len + sizeof(".XXXXXX"));
+    if (*tmp_name == NULL)
+        return NULL;
+    memcpy(*tmp_name, name, len);
+    memcpy(*tmp_name + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+    int fd = mkstemp(*tmp_name);
+    if (fd == -1) {
+        ERROR("Failed to create temp file:%s. errno:%d", *tmp_name, errno);
+        sfree(*tmp_name);
+        return NULL;
+    }
+
+    /* mkstemp() creates it 0600. */
+    struct stat st;
+    mode_t mode = stat(name, &st) == 0 ? st.st_mode & 07777 : 0666 & ~current_umask();
+    FILE *file = fchmod(fd, mode) == 0 ? fdopen(fd, "w") : NULL;
+    if (file == NULL) {
+        ERROR("Failed to open temp file:%s. errno:%d", *tmp_name, errno);
+        close(fd);
+        unlink(*tmp_name);
+        sfree(*tmp_name);
+    }
+    return file;
+}
+
+int ini_temp_commit(FILE *file, char *tmp_name, const char *name)
+{
+    int ret = fflush(file) == 0 && fsync(fileno(file)) == 0 ? 0 : -1;
+    if (fclose(file) != 0 || ret != 0 || rename(tmp_name, name) != 0) {
+        ERROR("Failed to replace file:%s. errno:%d", name, errno);
+        unlink(tmp_name);
+        ret = -1;
+    }
+    free(tmp_name);
+    return ret;
+}
+
+void ini_temp_discard(FILE *file, char *tmp_name)
+{
+    fclose(file);
+    unlink(tmp_name);
+    free(tmp_name);
+}
+
+int ini_map_file(const char *filename, void **map, size_t *len)
+{
+    *map = NULL;
+    *len = 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        ERROR("Failed to open file:%s. errno:%d", filename, errno);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ERROR("Failed to stat file:%s. errno:%d", filename, errno);
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        ERROR("Failed to mmap file:%s. errno:%d", filename, errno);
+        return -1;
+    }
+    madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    *map = addr;
+    *len = (size_t)st.st_size;
+    return 0;
+}
+
+int ini_parse_mmap(const char *filename, ini_str_handler handler, void *user)
+{
+    void *map;
+    size_t len;
+    if (ini_map_file(filename, &map, &len) != 0)
+        return -1;
+    if (len == 0)
+        return 0;
+
+    int ret = parse_buffer((const char*)map, len, handler, user);
+
+    munmap(map, len);
+    return ret;
+}
+
 static int write_arg(FILE *file, add_arg_user_t *user,
                      ini_arg_data_t *arg_data)
 {
@@ -529,6 +1351,7 @@ static int write_arg(FILE *file, add_arg_user_t *user,
         return -1;
     }
 
+    uint64_t start = ini_stats_start();
     char line[INI_MAX_LINE] = {0};
     if (user->section_pos == -1) {
         fseek(file, 0, SEEK_END);
@@ -552,6 +1375,7 @@ static int write_arg(FILE *file, add_arg_user_t *user,
             ERROR("Failed to malloc buf, len(%ld)", len);
             return -1;
         }
+        INI_STATS_ALLOC(len);
 
         fseek(file, user->arg_epos, SEEK_SET);
         if (len != fread(buf, sizeof(char), (size_t)len, file)) {
@@ -563,6 +1387,8 @@ static int write_arg(FILE *file, add_arg_user_t *user,
     char name[INI_MAX_NAME];
     char **values;
     size_t values_number;
+    ini_stats_stop(INI_TIMER_ADD_ARG_BUILD, start);
+    start = ini_stats_start();
     fseek(file, user->arg_bpos, SEEK_SET);
     //fprintf(file, "%s = ", arg_data->name);
     memset(line, 0 , sizeof(line));
@@ -590,23 +1416,16 @@ static int write_arg(FILE *file, add_arg_user_t *user,
         ERROR("Failed to ftruncate.");
         return -1;
     }
+    ini_stats_stop(INI_TIMER_ADD_ARG_WRITE, start);
 
     return 0;
 }
 
 int add_arg(const char *filename, const char *section_name, ini_arg_data_t *arg_data)
 {
-    FILE *file;
-    file = fopen(filename, "rb+");
-    if (!file) {
-        if (access(filename, F_OK) != 0)
-            file = fopen(filename, "wb+");
-
-        if (!file) {
-            ERROR("Failed to open file:%s. errno:%d", filename, errno);
-            return -1;
-        }
-    }
+    FILE *file = ini_open_locked(filename);
+    if (!file)
+        return -1;
 
     add_arg_user_t user;
     user.section_pos = -1;
@@ -614,11 +1433,13 @@ int add_arg(const char *filename, const char *section_name, ini_arg_data_t *arg_
     user.arg_epos = -1;
     sstrncpy(user.section_name, section_name, sizeof(user.section_name));
     sstrncpy(user.arg_name, arg_data->name, sizeof(user.arg_name));
+    uint64_t start = ini_stats_start();
     if (parse_stream(file, add_arg_handler, &user) < 0) {
         fclose(file);
         ERROR("Failed to parse stream to get position, %s.", filename);
         return -1;
     }
+    ini_stats_stop(INI_TIMER_ADD_ARG_TOKENIZE, start);
 
     if (write_arg(file, &user, arg_data) != 0) {
         ERROR("Failed to write arg. file:%s", filename);
@@ -7,6 +7,11 @@
 #define INI_H
 
 #include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /* Maximum length of section name. */
 #ifndef INI_MAX_SECTION
@@ -47,6 +52,68 @@ struct ini_section_s
     ini_section_t *next;
 };
 
+/* Slice of a parsed buffer, not NUL terminated. */
+typedef struct ini_str_s
+{
+    const char *ptr;
+    size_t len;
+} ini_str_t;
+
+/* Called for every "[section]" line (name.ptr and value.ptr are NULL) and
+   every name[=:]value or continuation line. pos is the byte offset of the
+   line. Return 0 to continue, >0 to stop, <0 to stop with an error. */
+typedef int (*ini_str_handler)(void *user, ini_str_t section,
+                               ini_str_t name, ini_str_t value, long pos);
+
+/* Streaming visitor. Every line of the input that carries data is one
+   event with views of its section, name and value, the byte offset of the
+   line in the input and its line number (from 1). A malformed line is an
+   INI_EVENT_ERROR event with the line as value, after which the visit
+   returns -1. Views are only valid during the call. Nothing is allocated:
+   ini_visit() tokenizes buf in place, ini_visit_fd() and ini_visit_file()
+   read through a buffer on the stack, which bounds a line to
+   INI_VISIT_BUFFER bytes (8KB). The visitor returns 0 to continue, >0 to
+   stop and <0 to stop with an error, which the visit returns. */
+enum ini_event_type
+{
+    INI_EVENT_SECTION = 0,      /* name and value are NULL */
+    INI_EVENT_KEY,
+    INI_EVENT_CONTINUATION,     /* name is the key continued */
+    INI_EVENT_ERROR,
+};
+
+typedef struct ini_event_s
+{
+    int type;
+    ini_str_t section;
+    ini_str_t name;
+    ini_str_t value;
+    long offset;
+    int lineno;
+} ini_event_t;
+
+typedef int (*ini_visitor)(void *user, const ini_event_t *event);
+
+int ini_visit(const char *buf, size_t len, ini_visitor visitor, void *user);
+int ini_visit_fd(int fd, ini_visitor visitor, void *user);
+int ini_visit_file(FILE *file, ini_visitor visitor, void *user);
+
+/* Push parser for input that arrives in pieces, from a pipe or a socket.
+   ini_push_feed() takes chunks of any size, cut anywhere, and reports the
+   lines they complete to the visitor as ini_visit() does; events carry
+   offsets and line numbers in the whole input. Lines have no length
+   limit: a line split across chunks is buffered until its end arrives,
+   whole lines are tokenized from the chunk in place. ini_push_finish()
+   reports a last line without a newline. Both return what ini_visit()
+   would; after a stop or an error every call returns the same. */
+struct ini_push_s;
+typedef struct ini_push_s ini_push_t;
+
+ini_push_t* ini_push_new(ini_visitor visitor, void *user);
+int ini_push_feed(ini_push_t *push, const char *data, size_t len);
+int ini_push_finish(ini_push_t *push);
+void ini_push_free(ini_push_t *push);
+
 void free_arg_data(ini_arg_data_t *arg);
 void free_section_data(ini_section_data_t *section_data);
 void free_section(ini_section_t *section);
@@ -60,9 +127,474 @@ ini_arg_data_t* get_arg(const char *filename,
                          const char *section_name,
                          const char *arg_name);
 
+/* get_arg() for many pairs in one pass over the file. Every query gets
+   what get_arg() would return for it in arg_data, NULL if not found, to
+   free with free_arg_data(). The parse stops as soon as every pair found
+   has been read completely; only matched args are allocated. Return the
+   number of queries found, or -1 on error with every arg_data NULL. */
+typedef struct ini_query_s
+{
+    const char *section_name;
+    const char *arg_name;
+    ini_arg_data_t *arg_data;
+} ini_query_t;
+
+int get_args(const char *filename, ini_query_t *queries, size_t queries_number);
+
+/* Writers hold an exclusive flock() on the file from finding the place of
+   the arg to the end of the rewrite, so concurrent add_arg() and
+   ini_txn_commit() calls, in any process, don't lose each other's updates.
+   With INI_ADD_COALESCE, add_arg_ex() calls for the same filename that
+   arrive while one of them is rewriting it are queued and written by the
+   next rewrite as one ini_txn_commit(), so N concurrent callers in a
+   process cost about one rewrite instead of N. Each call returns once its
+   arg is written, with the result of the rewrite that wrote it. */
+#define INI_ADD_COALESCE 0x1
+
 int add_arg(const char *filename, const char *section_name, ini_arg_data_t *data);
+int add_arg_ex(const char *filename, const char *section_name, ini_arg_data_t *data,
+               int flags);
+
+/* Batched add_arg(). Queue any number of args across sections, then
+   commit: the file is parsed once and rewritten from the first change in a
+   single pass with one fsync(). Args end up where calling add_arg() for
+   each of them in order would put them, except that args for a section
+   that doesn't exist yet are written as one block under a single new
+   header. Commit and abort free the transaction. */
+struct ini_txn_s;
+typedef struct ini_txn_s ini_txn_t;
+
+ini_txn_t* ini_txn_begin(const char *filename);
+int ini_txn_add_arg(ini_txn_t *txn, const char *section_name,
+                    const ini_arg_data_t *arg_data);
+size_t ini_txn_size(const ini_txn_t *txn);
+int ini_txn_commit(ini_txn_t *txn);
+void ini_txn_abort(ini_txn_t *txn);
+
+/* Lossless document: every line of the file is kept, comments, blank
+   lines, spacing and continuation lines included, so writing a document
+   back reproduces the input except for the edited lines. Names match
+   exactly, without truncation; section "" is the part before the first
+   header.
+   ini_doc_set() replaces the value of the first matching arg in the first
+   matching section, keeping its inline comment, or adds the arg at the end
+   of that section, or appends a new section. The remove and rename
+   functions apply to every occurrence. Edit functions return 0, ENOENT if
+   nothing matched, or ENOMEM.
+   ini_doc_save() writes to a temporary file and renames it over filename. */
+struct ini_doc_s;
+typedef struct ini_doc_s ini_doc_t;
+
+ini_doc_t* ini_doc_load(const char *filename);
+ini_doc_t* ini_doc_parse(const char *buf, size_t len);
+void ini_doc_free(ini_doc_t *doc);
+int ini_doc_set(ini_doc_t *doc, const char *section_name,
+                const ini_arg_data_t *arg_data);
+int ini_doc_remove_arg(ini_doc_t *doc, const char *section_name,
+                       const char *arg_name);
+int ini_doc_remove_section(ini_doc_t *doc, const char *section_name);
+int ini_doc_rename_arg(ini_doc_t *doc, const char *section_name,
+                       const char *old_name, const char *new_name);
+int ini_doc_rename_section(ini_doc_t *doc, const char *old_name,
+                           const char *new_name);
+int ini_doc_write(const ini_doc_t *doc, FILE *file);
+int ini_doc_save(const ini_doc_t *doc, const char *filename);
+
+/* Zero-copy parse: the file is mmap()ed and tokenized in place, slices
+   passed to the handler point into the mapping and are only valid during
+   the call. */
+int ini_parse_mmap(const char *filename, ini_str_handler handler, void *user);
+
+/* Select the line scanning kernel: "avx2", "sse2", "scalar", or NULL for
+   the fastest one the CPU supports (the default). Return -1 if the kernel
+   is unknown or unsupported. Not thread safe against running parses. */
+int ini_scan_select(const char *name);
+const char* ini_scan_impl(void);
+
+/* Bump allocator owning a parse result: section and arg nodes, value arrays
+   and strings. A tree from ini_parse_arena() is released all at once by
+   ini_arena_destroy() and must not be passed to free_section().
+   block_size 0 selects the default. */
+struct ini_arena_s;
+typedef struct ini_arena_s ini_arena_t;
+
+ini_arena_t* ini_arena_create(size_t block_size);
+void ini_arena_destroy(ini_arena_t *arena);
+ini_section_t* ini_parse_arena(const char *filename, ini_arena_t *arena);
+
+/* ini_parse_arena() on threads threads (0 for one per CPU). The file is
+   cut at section headers and the pieces are parsed concurrently; the tree
+   is the same as the one ini_parse_arena() builds. Files under a few
+   hundred KB are parsed by the calling thread alone. */
+ini_section_t* ini_parse_parallel(const char *filename, ini_arena_t *arena, int threads);
+
+/* Parse with every section and every key of a section resolved to a
+   single node, in file order (ini_parse() lists them last first and only
+   merges repeats that follow each other). Repeats are looked up in hash
+   tables while parsing. Each key line is one occurrence of its key,
+   continuation lines add values to it; a repeated occurrence is resolved
+   by policy:
+   INI_MERGE_LAST_WINS  the values of the last occurrence replace the others
+   INI_MERGE_APPEND     values of all occurrences, in file order
+   INI_MERGE_ERROR      the parse fails on a repeated key or section header
+   Repeated sections are merged and their keys follow the policy. Returns
+   NULL on error or for an empty file. */
+enum ini_merge_policy
+{
+    INI_MERGE_LAST_WINS = 0,
+    INI_MERGE_APPEND,
+    INI_MERGE_ERROR,
+};
+
+ini_section_t* ini_parse_merged(const char *filename, ini_arena_t *arena, int policy);
+
+/* Compact parse result. Sections and args are small fixed size records in
+   file order, names are length-prefixed strings interned in a pool (one
+   copy per distinct name, shared between snapshots created with the same
+   pool) and the values of a snapshot are stored back to back in a single
+   buffer. Names are not truncated; ini_name_str() returns one, NUL
+   terminated. */
+struct ini_name_s;
+typedef struct ini_name_s ini_name_t;
+
+ini_str_t ini_name_str(const ini_name_t *name);
+
+typedef struct ini_compact_arg_s
+{
+    const ini_name_t *name;
+    uint64_t hash;              /* of name, compared first by lookups */
+    uint32_t first_value;
+    uint32_t values_number;
+} ini_compact_arg_t;
+
+typedef struct ini_compact_section_s
+{
+    const ini_name_t *name;
+    uint64_t hash;
+    uint32_t first_arg;
+    uint32_t args_number;
+} ini_compact_section_t;
+
+struct ini_intern_s;
+typedef struct ini_intern_s ini_intern_t;
+struct ini_compact_s;
+typedef struct ini_compact_s ini_compact_t;
+
+/* The pool is reference counted, every snapshot keeps it alive. */
+ini_intern_t* ini_intern_create(void);
+void ini_intern_release(ini_intern_t *pool);
+
+/* pool may be NULL for a private pool. */
+ini_compact_t* ini_compact_parse(const char *filename, ini_intern_t *pool);
+void ini_compact_free(ini_compact_t *compact);
+size_t ini_compact_sections_number(const ini_compact_t *compact);
+const ini_compact_section_t* ini_compact_section_at(const ini_compact_t *compact,
+                                                    size_t index);
+const ini_compact_arg_t* ini_compact_arg_at(const ini_compact_t *compact,
+                                            const ini_compact_section_t *section,
+                                            size_t index);
+ini_str_t ini_compact_value(const ini_compact_t *compact,
+                            const ini_compact_arg_t *arg, size_t index);
+const ini_compact_section_t* ini_compact_get_section(const ini_compact_t *compact,
+                                                     const char *section_name);
+const ini_compact_arg_t* ini_compact_get_arg(const ini_compact_t *compact,
+                                             const char *section_name,
+                                             const char *arg_name);
+void print_compact(const ini_compact_t *compact);
+
+/* Parsed config handle. The file is parsed once by ini_open() and indexed,
+   lookups are hashed and return views owned by the handle: they stay valid
+   until ini_close() and must not be freed by the caller. Lookups resolve to
+   the first occurrence in the file, as get_section()/get_arg() do.
+   A handle is never modified after ini_open() and is reference counted:
+   ini_retain() takes a reference, ini_close() drops one and frees the
+   handle with the last.
+   ini_open_ex() with INI_OPEN_LAZY only scans the file for section headers
+   and parses a section body the first time it is looked up, so opening
+   costs a scan and lookups pay for the sections they touch. The file stays
+   mapped until the handle is freed: replace it with a rename rather than
+   rewriting it in place. Lookups on a lazy handle take a lock until all
+   sections are parsed; ini_sections() parses all of them. */
+struct ini_s;
+typedef struct ini_s ini_t;
 
+#define INI_OPEN_LAZY 0x1
 
+ini_t* ini_open(const char *filename);
+ini_t* ini_open_ex(const char *filename, int flags);
+ini_t* ini_retain(ini_t *ini);
+void ini_close(ini_t *ini);
+const ini_section_t* ini_sections(const ini_t *ini);
+const ini_section_data_t* ini_get_section(const ini_t *ini, const char *section_name);
+const ini_arg_data_t* ini_get_arg(const ini_t *ini,
+                                  const char *section_name,
+                                  const char *arg_name);
 
+/* Lookups with the key hashed by the caller, so constant names can be
+   hashed once. The hash is 64-bit FNV-1a over the section name, then for
+   an arg a NUL byte and the arg name, with names cut to INI_MAX_SECTION - 1
+   and INI_MAX_NAME - 1 bytes: ini_key_hash() computes it, arg_name NULL
+   for a section. A wrong hash finds nothing. */
+uint64_t ini_key_hash(const char *section_name, const char *arg_name);
+const ini_section_data_t* ini_get_section_hashed(const ini_t *ini, uint64_t hash,
+                                                 const char *section_name);
+const ini_arg_data_t* ini_get_arg_hashed(const ini_t *ini, uint64_t hash,
+                                         const char *section_name,
+                                         const char *arg_name);
+
+/* Typed lookups of the first value of an arg. Return 0 with *value set,
+   or ENOENT if there is no such arg, EINVAL if the value doesn't convert,
+   ERANGE if it is outside [min, max], with *value set to def. The value is
+   converted once per handle and cached on the arg.
+   Booleans are 1/0, true/false, yes/no or on/off, ignoring case. Sizes are
+   in bytes with an optional k, m, g or t suffix, as is or followed by b or
+   ib, all powers of 1024: "64MB" is 67108864. Durations are milliseconds
+   from a number with a ms, s, m(in), h or d suffix, or in seconds without
+   one: "10s" and "10" are 10000. Sizes and durations may be fractional. */
+int ini_get_int(const ini_t *ini, const char *section_name, const char *arg_name,
+                int64_t def, int64_t min, int64_t max, int64_t *value);
+int ini_get_bool(const ini_t *ini, const char *section_name, const char *arg_name,
+                 int def, int *value);
+int ini_get_double(const ini_t *ini, const char *section_name, const char *arg_name,
+                   double def, double min, double max, double *value);
+int ini_get_size(const ini_t *ini, const char *section_name, const char *arg_name,
+                 uint64_t def, uint64_t min, uint64_t max, uint64_t *value);
+int ini_get_duration(const ini_t *ini, const char *section_name, const char *arg_name,
+                     uint64_t def, uint64_t min, uint64_t max, uint64_t *value);
+
+/* The conversions of the typed lookups on a slice, as a visitor or
+   ini_str_handler gets them. Return 0, EINVAL or ERANGE and leave *value
+   alone on failure. */
+int ini_convert_int(ini_str_t s, int64_t *value);
+int ini_convert_bool(ini_str_t s, int *value);
+int ini_convert_double(ini_str_t s, double *value);
+int ini_convert_size(ini_str_t s, uint64_t *value);
+int ini_convert_duration(ini_str_t s, uint64_t *value);
+
+/* Change set between two handles, as seen through ini_get_section() and
+   ini_get_arg(). Removed and modified entries come first in the order of
+   the old file, then added ones in the order of the new file. A section
+   added or removed as a whole is one entry with a NULL arg_name; a section
+   whose args changed gets a modified entry and one entry per changed arg.
+   Sections are compared by a hash of their args computed by ini_open(), so
+   unchanged ones cost one comparison. Names and args point into the
+   handles, which the diff holds a reference to until ini_diff_free(). */
+enum ini_change_type
+{
+    INI_CHANGE_ADDED = 0,
+    INI_CHANGE_REMOVED,
+    INI_CHANGE_MODIFIED,
+};
+
+typedef struct ini_change_s
+{
+    int type;
+    const char *section_name;
+    const char *arg_name;           /* NULL for a section entry */
+    const ini_arg_data_t *old_arg;  /* removed or modified args */
+    const ini_arg_data_t *new_arg;  /* added or modified args */
+} ini_change_t;
+
+typedef struct ini_diff_s
+{
+    ini_t *old_ini;
+    ini_t *new_ini;
+    ini_change_t *changes;
+    size_t changes_number;
+} ini_diff_t;
+
+ini_diff_t* ini_diff(ini_t *old_ini, ini_t *new_ini);
+void ini_diff_free(ini_diff_t *diff);
+void print_diff(const ini_diff_t *diff);
+
+/* Hot reload. A background thread watches the file and its directory with
+   inotify, so in place writes and renames over the file are both seen, and
+   reparses it on change. The new handle is published with an atomic swap;
+   ini_watch_acquire() is wait-free and returns a reference to the current
+   handle that the caller drops with ini_close(). A replaced handle is freed
+   once its last reader closes it. If the new file fails to parse the
+   previous handle stays current; replace the file with a rename for
+   updates to be atomic. The handler, if any, runs on the watcher
+   thread after each reload attempt, with NULL on failure. */
+struct ini_watch_s;
+typedef struct ini_watch_s ini_watch_t;
+typedef void (*ini_watch_handler)(void *user, const ini_t *ini);
+
+ini_watch_t* ini_watch_start(const char *filename, ini_watch_handler handler,
+                             void *user);
+ini_t* ini_watch_acquire(ini_watch_t *watch);
+void ini_watch_stop(ini_watch_t *watch);
+
+/* Journal mode for frequent updates. ini_journal_add_arg() appends the arg
+   as one checksummed record to filename.journal and syncs it, instead of
+   rewriting filename; processes sharing the journal are serialized with
+   flock(). ini_journal_load() opens filename with the journal applied, as
+   ini_txn_commit() of the recorded args would leave it. Compaction folds the
+   journal into filename with a temporary file and a rename, under the lock
+   add_arg() takes on filename so that neither loses an update of the other,
+   and keeps only the records appended meanwhile; ini_journal_compact() runs
+   it, and with compact_bytes set a background thread runs it whenever the
+   journal grows past that size. A crash loses at most the record being
+   written: readers ignore a torn record and the next ini_journal_open() cuts
+   it off. */
+struct ini_journal_s;
+typedef struct ini_journal_s ini_journal_t;
+
+ini_journal_t* ini_journal_open(const char *filename, size_t compact_bytes);
+int ini_journal_add_arg(ini_journal_t *journal, const char *section_name,
+                        const ini_arg_data_t *arg_data);
+int ini_journal_compact(ini_journal_t *journal);
+void ini_journal_close(ini_journal_t *journal);
+ini_t* ini_journal_load(const char *filename);
+
+/* Precompiled binary image. ini_compile() parses a file and writes an image
+   of it: offset-based tables and hashed directories, with the size and
+   mtime of the source. ini_image_open() maps the image and checks its
+   header, so loading does not depend on the size of the config, then looks
+   names up in place. With INI_IMAGE_VERIFY the whole image is checksummed
+   too. A missing, corrupt or stale image (the source changed since
+   ini_compile()) falls back to parsing filename into an image in memory;
+   ini_image_from_file() tells which one was used. filename may be NULL to
+   use the image only, image_filename to always parse. Lookups resolve like
+   ini_get_section()/ini_get_arg() and strings are views into the image,
+   valid until ini_image_close(). */
+struct ini_image_s;
+typedef struct ini_image_s ini_image_t;
+struct ini_image_section_s;
+typedef struct ini_image_section_s ini_image_section_t;
+struct ini_image_arg_s;
+typedef struct ini_image_arg_s ini_image_arg_t;
+
+#define INI_IMAGE_VERIFY 0x1
+
+int ini_compile(const char *filename, const char *image_filename);
+ini_image_t* ini_image_open(const char *image_filename, const char *filename, int flags);
+void ini_image_close(ini_image_t *image);
+int ini_image_from_file(const ini_image_t *image);
+const ini_image_section_t* ini_image_get_section(const ini_image_t *image,
+                                                 const char *section_name);
+const ini_image_arg_t* ini_image_get_arg(const ini_image_t *image,
+                                         const char *section_name,
+                                         const char *arg_name);
+size_t ini_image_sections_number(const ini_image_t *image);
+const ini_image_section_t* ini_image_section_at(const ini_image_t *image, size_t index);
+const ini_image_arg_t* ini_image_arg_at(const ini_image_t *image,
+                                        const ini_image_section_t *section,
+                                        size_t index);
+ini_str_t ini_image_section_name(const ini_image_t *image,
+                                 const ini_image_section_t *section);
+ini_str_t ini_image_arg_name(const ini_image_t *image, const ini_image_arg_t *arg);
+size_t ini_image_values_number(const ini_image_t *image, const ini_image_arg_t *arg);
+ini_str_t ini_image_value(const ini_image_t *image, const ini_image_arg_t *arg,
+                          size_t index);
+void print_image(const ini_image_t *image);
+
+/* Config shared between processes. ini_shm_publish() parses filename into
+   an image (see ini_compile()) and publishes it as POSIX shared memory
+   object name (as for shm_open(), "/name"), replacing the previous one in
+   a single step. Readers ini_shm_attach() to map the current image read
+   only and query it with the ini_image_*() lookups, so a host holds one
+   copy whatever the number of readers. ini_shm_refresh() compares a
+   generation counter without locking and remaps on a republish: it
+   returns 1 if it switched, 0 if nothing changed and -1 on error, keeping
+   the previous image. Views into the image stay valid until the next
+   refresh that returns 1 or ini_shm_detach(). ini_shm_unlink() removes
+   the objects; attached readers keep their mapping. */
+struct ini_shm_s;
+typedef struct ini_shm_s ini_shm_t;
+
+int ini_shm_publish(const char *name, const char *filename);
+int ini_shm_unlink(const char *name);
+ini_shm_t* ini_shm_attach(const char *name);
+int ini_shm_refresh(ini_shm_t *shm);
+const ini_image_t* ini_shm_image(const ini_shm_t *shm);
+uint64_t ini_shm_generation(const ini_shm_t *shm);
+void ini_shm_detach(ini_shm_t *shm);
+
+
+
+/* Log messages of the library. Messages below the runtime level are
+   dropped before they are formatted, the default level lets all through.
+   Debug messages are compiled out unless the library is built with
+   INI_LOG_MIN_LEVEL=0. The sink gets every formatted message, from any
+   thread; without one messages go to stdout. Set it before logging
+   starts. ini_log_async_start() queues messages in a ring of about
+   capacity slots that a thread hands to the sink, so logging never waits
+   on the sink: a full ring drops messages. ini_log_async_stop() writes
+   what is queued and stops the thread. */
+enum ini_log_level
+{
+    INI_LOG_DEBUG = 0,
+    INI_LOG_ERROR,
+};
+
+typedef void (*ini_log_sink)(void *user, int level, const char *msg);
+
+void ini_log_set_level(int level);
+int ini_log_get_level(void);
+void ini_log_set_sink(ini_log_sink sink, void *user);
+int ini_log_async_start(size_t capacity);
+void ini_log_async_stop(void);
+
+/* Opt-in statistics of the parsers and lookups, off by default and
+   process wide. Counters cover every tokenizer and tree builder; the
+   allocation counters cover heap nodes and strings and arena blocks.
+   Early stops are get_section()/get_arg()/get_args() scans that ended
+   before the end of the file. Timers are latency histograms: parse is
+   ini_parse(), ini_parse_arena() and ini_open_ex(), lookup is
+   get_section(), get_arg(), get_args() and the lookups of a handle, and
+   add_arg() is split into
+   finding the place of the arg (tokenize), reading what follows it
+   (build) and writing (write). ini_stats_snapshot() copies the current
+   values and zeroes them with reset; values updated concurrently may be
+   counted in the next snapshot. ini_stats_dump() writes them in the
+   Prometheus text format. */
+enum ini_stat
+{
+    INI_STAT_BYTES_SCANNED = 0,
+    INI_STAT_LINES_SCANNED,
+    INI_STAT_SECTIONS,
+    INI_STAT_KEYS,
+    INI_STAT_VALUES,
+    INI_STAT_ALLOCS,
+    INI_STAT_ALLOC_BYTES,
+    INI_STAT_EARLY_STOPS,
+    INI_STAT_NUMBER,
+};
+
+enum ini_timer
+{
+    INI_TIMER_PARSE = 0,
+    INI_TIMER_LOOKUP,
+    INI_TIMER_ADD_ARG_TOKENIZE,
+    INI_TIMER_ADD_ARG_BUILD,
+    INI_TIMER_ADD_ARG_WRITE,
+    INI_TIMER_NUMBER,
+};
+
+/* Bucket i counts [2^i, 2^(i+1)) ns, the last one everything longer. */
+#define INI_STATS_BUCKETS 32
+
+typedef struct ini_histogram_s
+{
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[INI_STATS_BUCKETS];
+} ini_histogram_t;
+
+typedef struct ini_stats_s
+{
+    uint64_t counters[INI_STAT_NUMBER];
+    ini_histogram_t timers[INI_TIMER_NUMBER];
+} ini_stats_t;
+
+void ini_stats_enable(int enable);
+void ini_stats_snapshot(ini_stats_t *stats, int reset);
+int ini_stats_dump(FILE *file);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* INI_H */
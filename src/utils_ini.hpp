@@ -0,0 +1,404 @@
+/**
+ * inih -- C++17 interface
+ *
+ * Move-only owners over the C API: Config holds an ini_open() handle,
+ * Section a get_section() result and Tree an ini_parse() tree, and each
+ * frees what it holds. Everything else is a view that never copies:
+ * names and values are std::string_view into the owner and stay valid as
+ * long as it lives. Sections, args and the values of an arg are ranges:
+ *
+ *     ini::Config config("collectd.ini");
+ *     for (ini::SectionView section : config.sections())
+ *         for (ini::ArgView arg : section.args())
+ *             for (std::string_view value : arg.values())
+ *                 ...
+ *
+ * Keys hash their names at compile time when declared constexpr, and
+ * Config lookups with them skip hashing:
+ *
+ *     constexpr ini::Key interval("System4", "Interval");
+ *     int seconds = config.get<int>(interval, 10);
+ */
+
+#ifndef INI_HPP
+#define INI_HPP
+
+#include "utils_ini.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace ini {
+
+namespace detail {
+
+constexpr uint64_t fnv_offset = 14695981039346656037ULL;
+constexpr uint64_t fnv_prime = 1099511628211ULL;
+
+constexpr size_t length(const char *s, size_t max)
+{
+    size_t len = 0;
+    while (len < max && s[len] != '\0')
+        len++;
+    return len;
+}
+
+constexpr uint64_t fnv1a(uint64_t hash, const char *s, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        hash ^= static_cast<unsigned char>(s[i]);
+        hash *= fnv_prime;
+    }
+    return hash;
+}
+
+/* Same as ini_key_hash(). */
+constexpr uint64_t key_hash(const char *section_name, const char *arg_name)
+{
+    uint64_t hash = fnv1a(fnv_offset, section_name,
+                          length(section_name, INI_MAX_SECTION - 1));
+    if (arg_name != nullptr) {
+        hash = fnv1a(hash, "", 1);
+        hash = fnv1a(hash, arg_name, length(arg_name, INI_MAX_NAME - 1));
+    }
+    return hash;
+}
+
+/* Bounds of an integral T for ini_get_int(), unsigned ones capped to the
+   int64_t range ini_convert_int() covers. */
+template <typename T>
+constexpr int64_t int_min()
+{
+    return std::is_signed_v<T> ? static_cast<int64_t>(std::numeric_limits<T>::min()) : 0;
+}
+
+template <typename T>
+constexpr int64_t int_max()
+{
+    return static_cast<uint64_t>(std::numeric_limits<T>::max())
+               > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())
+        ? std::numeric_limits<int64_t>::max()
+        : static_cast<int64_t>(std::numeric_limits<T>::max());
+}
+
+template <typename T>
+bool float_in_range(double value)
+{
+    return std::isinf(value) || (value >= std::numeric_limits<T>::lowest()
+                                 && value <= std::numeric_limits<T>::max());
+}
+
+/* ini_convert_int()/ini_convert_bool()/ini_convert_double(), checked
+   against the range of T. */
+template <typename T>
+std::optional<T> convert(const char *s)
+{
+    ini_str_t str = { s, std::strlen(s) };
+    if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string>) {
+        return T(s);
+    } else if constexpr (std::is_same_v<T, bool>) {
+        int value;
+        if (ini_convert_bool(str, &value) != 0)
+            return std::nullopt;
+        return value != 0;
+    } else if constexpr (std::is_integral_v<T>) {
+        int64_t value;
+        if (ini_convert_int(str, &value) != 0 || value < int_min<T>() || value > int_max<T>())
+            return std::nullopt;
+        return static_cast<T>(value);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        double value;
+        if (ini_convert_double(str, &value) != 0 || !float_in_range<T>(value))
+            return std::nullopt;
+        return static_cast<T>(value);
+    } else {
+        static_assert(std::is_arithmetic_v<T>, "ini: no conversion to this type");
+        return std::nullopt;
+    }
+}
+
+/* The same through ini_get_int()/ini_get_bool()/ini_get_double(), which
+   convert once per handle and cache the result on the arg. */
+template <typename T>
+std::optional<T> lookup(const ini_t *ini, const char *section_name, const char *arg_name)
+{
+    static_assert(std::is_arithmetic_v<T>, "ini: no cached conversion to this type");
+    if constexpr (std::is_same_v<T, bool>) {
+        int value;
+        if (ini_get_bool(ini, section_name, arg_name, 0, &value) != 0)
+            return std::nullopt;
+        return value != 0;
+    } else if constexpr (std::is_integral_v<T>) {
+        int64_t value;
+        if (ini_get_int(ini, section_name, arg_name, 0, int_min<T>(), int_max<T>(),
+                        &value) != 0)
+            return std::nullopt;
+        return static_cast<T>(value);
+    } else {
+        double value;
+        if (ini_get_double(ini, section_name, arg_name, 0,
+                           -std::numeric_limits<double>::infinity(),
+                           std::numeric_limits<double>::infinity(), &value) != 0
+            || !float_in_range<T>(value))
+            return std::nullopt;
+        return static_cast<T>(value);
+    }
+}
+
+/* Range over a singly linked list of nodes, viewed as View(&node->data). */
+template <typename Node, typename View>
+class List
+{
+public:
+    class iterator
+    {
+    public:
+        explicit iterator(const Node *node) : node_(node) {}
+        View operator*() const { return View(&node_->data); }
+        iterator& operator++() { node_ = node_->next; return *this; }
+        bool operator==(const iterator &other) const { return node_ == other.node_; }
+        bool operator!=(const iterator &other) const { return node_ != other.node_; }
+
+    private:
+        const Node *node_;
+    };
+
+    explicit List(const Node *head) : head_(head) {}
+    iterator begin() const { return iterator(head_); }
+    iterator end() const { return iterator(nullptr); }
+    bool empty() const { return head_ == nullptr; }
+
+private:
+    const Node *head_;
+};
+
+} // namespace detail
+
+/* A section name, or a section and arg name, with its hash. The names
+   must outlive the key, as literals do. */
+struct Key
+{
+    const char *section_name;
+    const char *arg_name;       /* nullptr for a section */
+    uint64_t hash;
+
+    constexpr Key(const char *section_name, const char *arg_name = nullptr)
+        : section_name(section_name), arg_name(arg_name),
+          hash(detail::key_hash(section_name, arg_name)) {}
+};
+
+/* Values of an arg, more than one for a multi-line value. */
+class Values
+{
+public:
+    class iterator
+    {
+    public:
+        explicit iterator(char *const *value) : value_(value) {}
+        std::string_view operator*() const { return *value_; }
+        iterator& operator++() { value_++; return *this; }
+        bool operator==(const iterator &other) const { return value_ == other.value_; }
+        bool operator!=(const iterator &other) const { return value_ != other.value_; }
+
+    private:
+        char *const *value_;
+    };
+
+    Values(char *const *values, size_t size) : values_(values), size_(size) {}
+    iterator begin() const { return iterator(values_); }
+    iterator end() const { return iterator(values_ + size_); }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    std::string_view operator[](size_t i) const { return values_[i]; }
+
+private:
+    char *const *values_;
+    size_t size_;
+};
+
+/* View of an arg, empty if a lookup found nothing. */
+class ArgView
+{
+public:
+    explicit ArgView(const ini_arg_data_t *data = nullptr) : data_(data) {}
+
+    explicit operator bool() const { return data_ != nullptr; }
+    const ini_arg_data_t* data() const { return data_; }
+    std::string_view name() const { return data_->name; }
+    Values values() const
+    {
+        return data_ != nullptr ? Values(data_->values, data_->values_number)
+                                : Values(nullptr, 0);
+    }
+
+    /* First value converted to T, nothing if there is none or it doesn't
+       convert. T is an arithmetic type, std::string_view or std::string. */
+    template <typename T>
+    std::optional<T> as() const
+    {
+        if (data_ == nullptr || data_->values_number == 0)
+            return std::nullopt;
+        return detail::convert<T>(data_->values[0]);
+    }
+
+private:
+    const ini_arg_data_t *data_;
+};
+
+/* View of a section, empty if a lookup found nothing. */
+class SectionView
+{
+public:
+    explicit SectionView(const ini_section_data_t *data = nullptr) : data_(data) {}
+
+    explicit operator bool() const { return data_ != nullptr; }
+    const ini_section_data_t* data() const { return data_; }
+    std::string_view name() const { return data_->name; }
+    detail::List<ini_arg_t, ArgView> args() const
+    {
+        return detail::List<ini_arg_t, ArgView>(data_ != nullptr ? data_->args : nullptr);
+    }
+
+    /* First arg named arg_name in the order of args(). */
+    ArgView arg(std::string_view arg_name) const
+    {
+        for (ArgView candidate : args()) {
+            if (candidate.name() == arg_name)
+                return candidate;
+        }
+        return ArgView();
+    }
+
+    template <typename T>
+    std::optional<T> get(std::string_view arg_name) const { return arg(arg_name).as<T>(); }
+    template <typename T>
+    T get(std::string_view arg_name, T def) const { return get<T>(arg_name).value_or(def); }
+
+protected:
+    const ini_section_data_t *data_;
+};
+
+/* Parsed config handle, see ini_open(). Lookups are hashed and resolve
+   to the first occurrence in the file. */
+class Config
+{
+public:
+    Config() = default;
+    explicit Config(const char *filename, int flags = 0)
+        : ini_(ini_open_ex(filename, flags)) {}
+    explicit Config(const std::string &filename, int flags = 0)
+        : Config(filename.c_str(), flags) {}
+    Config(Config &&other) noexcept : ini_(std::exchange(other.ini_, nullptr)) {}
+    Config& operator=(Config &&other) noexcept
+    {
+        if (this != &other) {
+            ini_close(ini_);
+            ini_ = std::exchange(other.ini_, nullptr);
+        }
+        return *this;
+    }
+    Config(const Config&) = delete;
+    Config& operator=(const Config&) = delete;
+    ~Config() { ini_close(ini_); }
+
+    explicit operator bool() const { return ini_ != nullptr; }
+    ini_t* handle() const { return ini_; }
+
+    detail::List<ini_section_t, SectionView> sections() const
+    {
+        return detail::List<ini_section_t, SectionView>(ini_sections(ini_));
+    }
+    SectionView section(const Key &key) const
+    {
+        return SectionView(ini_get_section_hashed(ini_, key.hash, key.section_name));
+    }
+    ArgView arg(const Key &key) const
+    {
+        return ArgView(ini_get_arg_hashed(ini_, key.hash, key.section_name, key.arg_name));
+    }
+
+    /* Arithmetic types use the conversions cached on the handle. */
+    template <typename T>
+    std::optional<T> get(const Key &key) const
+    {
+        if constexpr (std::is_arithmetic_v<T>)
+            return detail::lookup<T>(ini_, key.section_name, key.arg_name);
+        else
+            return arg(key).as<T>();
+    }
+    template <typename T>
+    T get(const Key &key, T def) const { return get<T>(key).value_or(def); }
+
+private:
+    ini_t *ini_ = nullptr;
+};
+
+/* A section read from a file by get_section(). */
+class Section : public SectionView
+{
+public:
+    Section() = default;
+    Section(const char *filename, const char *section_name)
+        : SectionView(get_section(filename, section_name)) {}
+    Section(Section &&other) noexcept
+        : SectionView(std::exchange(other.data_, nullptr)) {}
+    Section& operator=(Section &&other) noexcept
+    {
+        if (this != &other) {
+            release();
+            data_ = std::exchange(other.data_, nullptr);
+        }
+        return *this;
+    }
+    Section(const Section&) = delete;
+    Section& operator=(const Section&) = delete;
+    ~Section() { release(); }
+
+private:
+    void release()
+    {
+        ini_section_data_t *data = const_cast<ini_section_data_t*>(data_);
+        free_section_data(data);
+        std::free(data);
+    }
+};
+
+/* All sections of a file as ini_parse() lists them, the last one first. */
+class Tree
+{
+public:
+    Tree() = default;
+    explicit Tree(const char *filename) : sections_(ini_parse(filename)) {}
+    Tree(Tree &&other) noexcept : sections_(std::exchange(other.sections_, nullptr)) {}
+    Tree& operator=(Tree &&other) noexcept
+    {
+        if (this != &other) {
+            free_section(sections_);
+            sections_ = std::exchange(other.sections_, nullptr);
+        }
+        return *this;
+    }
+    Tree(const Tree&) = delete;
+    Tree& operator=(const Tree&) = delete;
+    ~Tree() { free_section(sections_); }
+
+    explicit operator bool() const { return sections_ != nullptr; }
+    detail::List<ini_section_t, SectionView> sections() const
+    {
+        return detail::List<ini_section_t, SectionView>(sections_);
+    }
+
+private:
+    ini_section_t *sections_ = nullptr;
+};
+
+} // namespace ini
+
+#endif /* INI_HPP */
@@ -0,0 +1,259 @@
+/**
+ * inih -- bump allocator owning a whole parse result
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#define INI_ARENA_BLOCK_SIZE (64 * 1024)
+#define INI_ARENA_ALIGN 16
+
+typedef struct ini_arena_block_s ini_arena_block_t;
+struct ini_arena_block_s
+{
+    ini_arena_block_t *next;
+    size_t size;
+    size_t used;
+    /* Offsets are aligned relative to data, malloc() aligns the block. */
+    char data[] __attribute__((aligned(INI_ARENA_ALIGN)));
+};
+
+struct ini_arena_s
+{
+    ini_arena_block_t *blocks;   /* head is the block being filled */
+    size_t block_size;
+};
+
+ini_arena_t* ini_arena_create(size_t block_size)
+{
+    ini_arena_t *arena = (ini_arena_t*)calloc(1, sizeof(ini_arena_t));
+    if (arena == NULL)
+        return NULL;
+
+    arena->block_size = block_size ? block_size : INI_ARENA_BLOCK_SIZE;
+    return arena;
+}
+
+void ini_arena_destroy(ini_arena_t *arena)
+{
+    if (arena == NULL)
+        return;
+
+    ini_arena_block_t *block = arena->blocks;
+    while (block != NULL)
+    {
+        ini_arena_block_t *tmp = block->next;
+        free(block);
+        block = tmp;
+    }
+
+    free(arena);
+}
+
+static ini_arena_block_t* arena_new_block(ini_arena_t *arena, size_t size)
+{
+    ini_arena_block_t *block = (ini_arena_block_t*)malloc(sizeof(ini_arena_block_t) + size);
+    if (block == NULL)
+        return NULL;
+    INI_STATS_ALLOC(sizeof(ini_arena_block_t) + size);
+
+    block->size = size;
+    block->used = 0;
+
+    /* Oversized allocations get their own block behind the current one,
+       so the rest of the current block stays usable. */
+    if (arena->blocks != NULL && size > arena->block_size) {
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+    } else {
+        APPED_ITEM(arena->blocks, block);
+    }
+
+    return block;
+}
+
+void* ini_arena_alloc(ini_arena_t *arena, size_t size, size_t align)
+{
+    ini_arena_block_t *block = arena->blocks;
+    if (block != NULL) {
+        size_t offset = (block->used + align - 1) & ~(align - 1);
+        if (offset + size <= block->size) {
+            block->used = offset + size;
+            return block->data + offset;
+        }
+    }
+
+    size_t block_size = size > arena->block_size ? size : arena->block_size;
+    block = arena_new_block(arena, block_size);
+    if (block == NULL)
+        return NULL;
+
+    block->used = size;
+    return block->data;
+}
+
+void* ini_arena_calloc(ini_arena_t *arena, size_t size)
+{
+    void *ptr = ini_arena_alloc(arena, size, INI_ARENA_ALIGN);
+    if (ptr != NULL)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+char* ini_arena_strndup(ini_arena_t *arena, const char *str, size_t len)
+{
+    char *copy = (char*)ini_arena_alloc(arena, len + 1, 1);
+    if (copy == NULL)
+        return NULL;
+
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/* Append str to an arena owned string array whose capacity is tracked by
+   the caller. The array doubles when full, the old copy stays in the arena
+   until it is destroyed, which bounds the waste to the final array size. */
+int ini_arena_strarray_add(ini_arena_t *arena, char ***ret_array,
+                           size_t *ret_array_len, size_t *ret_capacity,
+                           const char *str, size_t len)
+{
+    char **array = *ret_array;
+    size_t array_len = *ret_array_len;
+
+    if (array_len == *ret_capacity) {
+        size_t capacity = *ret_capacity ? *ret_capacity * 2 : 1;
+        char **bigger = (char**)ini_arena_alloc(arena, capacity * sizeof(*array),
+                                                sizeof(*array));
+        if (bigger == NULL)
+            return ENOMEM;
+
+        if (array_len)
+            memcpy(bigger, array, array_len * sizeof(*array));
+        array = bigger;
+        *ret_array = array;
+        *ret_capacity = capacity;
+    }
+
+    array[array_len] = ini_arena_strndup(arena, str, len);
+    if (array[array_len] == NULL)
+        return ENOMEM;
+    INI_STATS_ADD(INI_STAT_VALUES, 1);
+
+    *ret_array_len = array_len + 1;
+    return 0;
+}
+
+typedef struct arena_build_s
+{
+    ini_arena_t *arena;
+    ini_section_t *sections;
+    size_t values_capacity;   /* of the head arg of the head section */
+} arena_build_t;
+
+/* ini_parse_handler() allocating from the arena. Only the head arg of the
+   head section ever grows, so one capacity is enough. */
+static int arena_build_handler(void *user, ini_str_t section, ini_str_t name,
+                               ini_str_t value, long __attribute__((unused)) pos)
+{
+    arena_build_t *build = (arena_build_t*)(user);
+    ini_section_t **section_head = &build->sections;
+    if ((*section_head) == NULL
+        || !ini_name_equals((*section_head)->data.name, INI_MAX_SECTION, section))
+    {
+        ini_section_t *section_item = (ini_section_t*)ini_arena_calloc(
+            build->arena, sizeof(ini_section_t));
+        if (section_item == NULL)
+            return -1;
+        ini_copy_name(section_item->data.name, INI_MAX_SECTION, section);
+        APPED_ITEM((*section_head), section_item);
+        INI_STATS_ADD(INI_STAT_SECTIONS, 1);
+    }
+
+    if (name.ptr == NULL)
+        return 0;
+
+    ini_arg_t **ini_arg = &(*section_head)->data.args;
+    if (*ini_arg == NULL
+        || !ini_name_equals((*ini_arg)->data.name, INI_MAX_NAME, name))
+    {
+        ini_arg_t *item = (ini_arg_t*)ini_arena_calloc(build->arena, sizeof(ini_arg_t));
+        if (item == NULL)
+            return -1;
+        ini_copy_name(item->data.name, INI_MAX_NAME, name);
+        APPED_ITEM((*ini_arg), item);
+        build->values_capacity = 0;
+        INI_STATS_ADD(INI_STAT_KEYS, 1);
+    }
+
+    if (0 != ini_arena_strarray_add(build->arena,
+                                    &(*ini_arg)->data.values,
+                                    &(*ini_arg)->data.values_number,
+                                    &build->values_capacity,
+                                    value.ptr, value.len))
+    {
+        ERROR("Failed to add value to args. section:%.*s, name:%.*s",
+              (int)section.len, section.ptr, (int)name.len, name.ptr);
+        return -1;
+    }
+
+    return 0;
+}
+
+int ini_arena_parse_buffer(ini_arena_t *arena, const char *buf, size_t len,
+                           ini_section_t **sections, size_t *end_pos)
+{
+    arena_build_t build;
+    memset(&build, 0, sizeof(build));
+    build.arena = arena;
+
+    int ret = parse_buffer_ex(buf, len, arena_build_handler, &build, 0, end_pos);
+    *sections = ret == 0 ? build.sections : NULL;
+    return ret;
+}
+
+/* Blocks of other go behind the head block, which stays the one filled. */
+void ini_arena_adopt(ini_arena_t *arena, ini_arena_t *other)
+{
+    ini_arena_block_t *blocks = other->blocks;
+    free(other);
+    if (blocks == NULL)
+        return;
+
+    if (arena->blocks == NULL) {
+        arena->blocks = blocks;
+        return;
+    }
+
+    ini_arena_block_t *tail = blocks;
+    while (tail->next != NULL)
+        tail = tail->next;
+    tail->next = arena->blocks->next;
+    arena->blocks->next = blocks;
+}
+
+int ini_parse_arena_ex(const char *filename, ini_arena_t *arena,
+                       ini_section_t **sections)
+{
+    arena_build_t build;
+    memset(&build, 0, sizeof(build));
+    build.arena = arena;
+
+    uint64_t start = ini_stats_start();
+    int ret = ini_parse_mmap(filename, arena_build_handler, &build);
+    *sections = ret == 0 ? build.sections : NULL;
+    ini_stats_stop(INI_TIMER_PARSE, start);
+    return ret;
+}
+
+ini_section_t* ini_parse_arena(const char *filename, ini_arena_t *arena)
+{
+    ini_section_t *sections;
+    ini_parse_arena_ex(filename, arena, &sections);
+    return sections;
+}
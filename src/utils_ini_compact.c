@@ -0,0 +1,375 @@
+/**
+ * inih -- compact parse result with interned names
+ *
+ * Sections and args are fixed size records in two arrays, names point to
+ * length-prefixed strings interned in a pool that can be shared between
+ * snapshots, and all values of a snapshot live in one byte buffer indexed
+ * by an offset array.
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+struct ini_name_s
+{
+    uint32_t len;
+    char str[];    /* NUL terminated */
+};
+
+struct ini_intern_s
+{
+    pthread_mutex_t lock;
+    ini_arena_t *arena;
+    ini_index_t index;   /* name -> ini_name_t* */
+    int refs;
+};
+
+struct ini_compact_s
+{
+    ini_intern_t *pool;
+
+    ini_compact_section_t *sections;
+    size_t sections_number;
+    ini_compact_arg_t *args;
+    size_t args_number;
+    uint32_t *value_offsets;   /* values_number + 1 entries */
+    size_t values_number;
+    char *value_bytes;         /* NUL terminated values back to back */
+    size_t value_bytes_len;
+};
+
+ini_intern_t* ini_intern_create(void)
+{
+    ini_intern_t *pool = (ini_intern_t*)calloc(1, sizeof(ini_intern_t));
+    if (pool == NULL)
+        return NULL;
+
+    pool->arena = ini_arena_create(0);
+    if (pool->arena == NULL || ini_index_init(&pool->index, 64) != 0) {
+        ini_arena_destroy(pool->arena);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->refs = 1;
+    return pool;
+}
+
+void ini_intern_release(ini_intern_t *pool)
+{
+    if (pool == NULL || __atomic_sub_fetch(&pool->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    pthread_mutex_destroy(&pool->lock);
+    ini_index_free(&pool->index);
+    ini_arena_destroy(pool->arena);
+    free(pool);
+}
+
+static ini_intern_t* intern_retain(ini_intern_t *pool)
+{
+    __atomic_add_fetch(&pool->refs, 1, __ATOMIC_RELAXED);
+    return pool;
+}
+
+static const ini_name_t* intern(ini_intern_t *pool, ini_str_t str, uint64_t hash)
+{
+    pthread_mutex_lock(&pool->lock);
+    ini_name_t *name = (ini_name_t*)ini_index_find(&pool->index, hash,
+                                                   str.ptr, str.len, NULL, 0);
+    if (name == NULL) {
+        name = (ini_name_t*)ini_arena_alloc(pool->arena,
+                                            sizeof(ini_name_t) + str.len + 1,
+                                            sizeof(uint32_t));
+        if (name != NULL) {
+            name->len = (uint32_t)str.len;
+            memcpy(name->str, str.ptr, str.len);
+            name->str[str.len] = '\0';
+
+            ini_index_slot_t *slot = ini_index_insert(&pool->index, hash,
+                                                      name->str, str.len, NULL, 0);
+            if (slot != NULL)
+                slot->value = name;
+            else
+                name = NULL;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return name;
+}
+
+static int grow(void **array, size_t *capacity, size_t need, size_t elem_size)
+{
+    if (need <= *capacity)
+        return 0;
+
+    size_t bigger = *capacity ? *capacity : 16;
+    while (bigger < need)
+        bigger *= 2;
+
+    void *tmp = realloc(*array, bigger * elem_size);
+    if (tmp == NULL)
+        return ENOMEM;
+
+    *array = tmp;
+    *capacity = bigger;
+    return 0;
+}
+
+typedef struct compact_build_s
+{
+    ini_compact_t *compact;
+    size_t sections_capacity;
+    size_t args_capacity;
+    size_t values_capacity;
+    size_t bytes_capacity;
+} compact_build_t;
+
+static int compact_add_value(compact_build_t *build, ini_str_t value)
+{
+    ini_compact_t *c = build->compact;
+    if (c->value_bytes_len + value.len + 1 > UINT32_MAX)
+        return EFBIG;
+
+    if (grow((void**)&c->value_offsets, &build->values_capacity,
+             c->values_number + 2, sizeof(uint32_t)) != 0
+        || grow((void**)&c->value_bytes, &build->bytes_capacity,
+                c->value_bytes_len + value.len + 1, 1) != 0)
+        return ENOMEM;
+
+    memcpy(c->value_bytes + c->value_bytes_len, value.ptr, value.len);
+    c->value_bytes_len += value.len;
+    c->value_bytes[c->value_bytes_len++] = '\0';
+    c->value_offsets[++c->values_number] = (uint32_t)c->value_bytes_len;
+    return 0;
+}
+
+/* Same grouping as ini_parse_handler(), but in file order: a section only
+   ever gains args while it is the last one, an arg only gains values while
+   it is the last one, so every array is append-only. */
+static int compact_handler(void *user, ini_str_t section, ini_str_t name,
+                           ini_str_t value, long __attribute__((unused)) pos)
+{
+    compact_build_t *build = (compact_build_t*)(user);
+    ini_compact_t *c = build->compact;
+
+    ini_compact_section_t *last_section = c->sections_number
+        ? &c->sections[c->sections_number - 1] : NULL;
+    if (last_section == NULL || last_section->name->len != section.len
+        || memcmp(last_section->name->str, section.ptr, section.len) != 0)
+    {
+        if (grow((void**)&c->sections, &build->sections_capacity,
+                 c->sections_number + 1, sizeof(ini_compact_section_t)) != 0)
+            return -1;
+
+        last_section = &c->sections[c->sections_number++];
+        last_section->hash = ini_hash_key(section.ptr, section.len, NULL, 0);
+        last_section->name = intern(c->pool, section, last_section->hash);
+        last_section->first_arg = (uint32_t)c->args_number;
+        last_section->args_number = 0;
+        if (last_section->name == NULL)
+            return -1;
+    }
+
+    if (name.ptr == NULL)
+        return 0;
+
+    ini_compact_arg_t *last_arg = last_section->args_number
+        ? &c->args[c->args_number - 1] : NULL;
+    if (last_arg == NULL || last_arg->name->len != name.len
+        || memcmp(last_arg->name->str, name.ptr, name.len) != 0)
+    {
+        if (grow((void**)&c->args, &build->args_capacity,
+                 c->args_number + 1, sizeof(ini_compact_arg_t)) != 0)
+            return -1;
+
+        last_arg = &c->args[c->args_number++];
+        last_arg->hash = ini_hash_key(name.ptr, name.len, NULL, 0);
+        last_arg->name = intern(c->pool, name, last_arg->hash);
+        last_arg->first_value = (uint32_t)c->values_number;
+        last_arg->values_number = 0;
+        last_section->args_number++;
+        if (last_arg->name == NULL)
+            return -1;
+    }
+
+    if (compact_add_value(build, value) != 0) {
+        ERROR("Failed to add value to args. section:%.*s, name:%.*s",
+              (int)section.len, section.ptr, (int)name.len, name.ptr);
+        return -1;
+    }
+    last_arg->values_number++;
+
+    return 0;
+}
+
+static void shrink(void **array, size_t number, size_t elem_size)
+{
+    if (number == 0)
+        return;
+
+    void *tmp = realloc(*array, number * elem_size);
+    if (tmp != NULL)
+        *array = tmp;
+}
+
+ini_compact_t* ini_compact_parse(const char *filename, ini_intern_t *pool)
+{
+    ini_compact_t *compact = (ini_compact_t*)calloc(1, sizeof(ini_compact_t));
+    if (compact == NULL)
+        return NULL;
+
+    compact->pool = pool != NULL ? intern_retain(pool) : ini_intern_create();
+    if (compact->pool == NULL) {
+        free(compact);
+        return NULL;
+    }
+
+    compact_build_t build;
+    memset(&build, 0, sizeof(build));
+    build.compact = compact;
+    if (grow((void**)&compact->value_offsets, &build.values_capacity, 1,
+             sizeof(uint32_t)) != 0
+        || ini_parse_mmap(filename, compact_handler, &build) != 0) {
+        ERROR("Failed to load compact ini. file:%s", filename);
+        ini_compact_free(compact);
+        return NULL;
+    }
+    compact->value_offsets[0] = 0;
+
+    shrink((void**)&compact->sections, compact->sections_number,
+           sizeof(ini_compact_section_t));
+    shrink((void**)&compact->args, compact->args_number, sizeof(ini_compact_arg_t));
+    shrink((void**)&compact->value_offsets, compact->values_number + 1,
+           sizeof(uint32_t));
+    shrink((void**)&compact->value_bytes, compact->value_bytes_len, 1);
+
+    return compact;
+}
+
+void ini_compact_free(ini_compact_t *compact)
+{
+    if (compact == NULL)
+        return;
+
+    free(compact->sections);
+    free(compact->args);
+    free(compact->value_offsets);
+    free(compact->value_bytes);
+    ini_intern_release(compact->pool);
+    free(compact);
+}
+
+size_t ini_compact_sections_number(const ini_compact_t *compact)
+{
+    return compact->sections_number;
+}
+
+const ini_compact_section_t* ini_compact_section_at(const ini_compact_t *compact,
+                                                    size_t index)
+{
+    return index < compact->sections_number ? &compact->sections[index] : NULL;
+}
+
+const ini_compact_arg_t* ini_compact_arg_at(const ini_compact_t *compact,
+                                            const ini_compact_section_t *section,
+                                            size_t index)
+{
+    return index < section->args_number
+        ? &compact->args[section->first_arg + index] : NULL;
+}
+
+ini_str_t ini_compact_value(const ini_compact_t *compact,
+                            const ini_compact_arg_t *arg, size_t index)
+{
+    ini_str_t value = { NULL, 0 };
+    if (index >= arg->values_number)
+        return value;
+
+    size_t i = arg->first_value + index;
+    value.ptr = compact->value_bytes + compact->value_offsets[i];
+    value.len = compact->value_offsets[i + 1] - compact->value_offsets[i] - 1;
+    return value;
+}
+
+ini_str_t ini_name_str(const ini_name_t *name)
+{
+    ini_str_t str = { name->str, name->len };
+    return str;
+}
+
+/* The pool isn't touched, the hash of each record rules out nearly every
+   other name before its string is compared. */
+static int name_matches(const ini_name_t *name, uint64_t name_hash,
+                        ini_str_t query, uint64_t hash)
+{
+    return name_hash == hash && name->len == query.len
+        && memcmp(name->str, query.ptr, query.len) == 0;
+}
+
+const ini_compact_section_t* ini_compact_get_section(const ini_compact_t *compact,
+                                                     const char *section_name)
+{
+    ini_str_t query = { section_name, strlen(section_name) };
+    uint64_t hash = ini_hash_key(query.ptr, query.len, NULL, 0);
+
+    for (size_t i = 0; i < compact->sections_number; i++) {
+        const ini_compact_section_t *s = &compact->sections[i];
+        if (name_matches(s->name, s->hash, query, hash))
+            return s;
+    }
+
+    return NULL;
+}
+
+const ini_compact_arg_t* ini_compact_get_arg(const ini_compact_t *compact,
+                                             const char *section_name,
+                                             const char *arg_name)
+{
+    ini_str_t section = { section_name, strlen(section_name) };
+    ini_str_t name = { arg_name, strlen(arg_name) };
+    uint64_t section_hash = ini_hash_key(section.ptr, section.len, NULL, 0);
+    uint64_t hash = ini_hash_key(name.ptr, name.len, NULL, 0);
+
+    for (size_t i = 0; i < compact->sections_number; i++) {
+        const ini_compact_section_t *s = &compact->sections[i];
+        if (!name_matches(s->name, s->hash, section, section_hash))
+            continue;
+
+        for (uint32_t j = 0; j < s->args_number; j++) {
+            const ini_compact_arg_t *arg = &compact->args[s->first_arg + j];
+            if (name_matches(arg->name, arg->hash, name, hash))
+                return arg;
+        }
+    }
+
+    return NULL;
+}
+
+void print_compact(const ini_compact_t *compact)
+{
+    for (size_t i = 0; i < compact->sections_number; i++)
+    {
+        const ini_compact_section_t *section = &compact->sections[i];
+        printf("[%s]\n", section->name->str);
+        for (uint32_t j = 0; j < section->args_number; j++)
+        {
+            const ini_compact_arg_t *arg = &compact->args[section->first_arg + j];
+            printf("    %s = ", arg->name->str);
+            for (uint32_t k = 0; k < arg->values_number; k++)
+            {
+                ini_str_t value = ini_compact_value(compact, arg, k);
+                printf("%.*s; ", (int)value.len, value.ptr);
+            }
+            printf("\n");
+        }
+    }
+}
@@ -0,0 +1,203 @@
+/**
+ * inih -- change set between two handles
+ *
+ * Sections whose content hash is the same in both handles are skipped
+ * without looking at their args, only the args of changed sections are
+ * compared, again by hash first.
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+static ini_index_slot_t* section_slot(const ini_t *ini, const char *section_name,
+                                      size_t section_len)
+{
+    return ini_index_find_slot(&ini->sections_index,
+                               ini_hash_key(section_name, section_len, NULL, 0),
+                               section_name, section_len, NULL, 0);
+}
+
+static ini_index_slot_t* arg_slot(const ini_t *ini, const char *section_name,
+                                  size_t section_len, const char *arg_name)
+{
+    size_t name_len = strlen(arg_name);
+    return ini_index_find_slot(&ini->args_index,
+                               ini_hash_key(section_name, section_len, arg_name, name_len),
+                               section_name, section_len, arg_name, name_len);
+}
+
+static int args_equal(const ini_arg_data_t *a, const ini_arg_data_t *b)
+{
+    if (a->values_number != b->values_number)
+        return 0;
+
+    for (size_t i = 0; i < a->values_number; i++) {
+        if (strcmp(a->values[i], b->values[i]) != 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+static int diff_add(ini_diff_t *diff, size_t *capacity, int type,
+                    const char *section_name, const char *arg_name,
+                    const ini_arg_data_t *old_arg, const ini_arg_data_t *new_arg)
+{
+    if (diff->changes_number == *capacity) {
+        size_t bigger = *capacity ? *capacity * 2 : 16;
+        ini_change_t *tmp = (ini_change_t*)realloc(diff->changes,
+                                                   bigger * sizeof(ini_change_t));
+        if (tmp == NULL)
+            return ENOMEM;
+        diff->changes = tmp;
+        *capacity = bigger;
+    }
+
+    ini_change_t *change = &diff->changes[diff->changes_number++];
+    change->type = type;
+    change->section_name = section_name;
+    change->arg_name = arg_name;
+    change->old_arg = old_arg;
+    change->new_arg = new_arg;
+    return 0;
+}
+
+/* Trees are in reverse file order, changes are collected backwards and
+   flipped. */
+static void reverse_changes(ini_change_t *changes, size_t number)
+{
+    for (size_t i = 0; i < number / 2; i++) {
+        ini_change_t tmp = changes[i];
+        changes[i] = changes[number - 1 - i];
+        changes[number - 1 - i] = tmp;
+    }
+}
+
+/* Walk from's tree against to. Old to new reports removed and modified
+   entries, new to old reports added ones. */
+static int diff_walk(ini_diff_t *diff, size_t *capacity, const ini_t *from,
+                     const ini_t *to, int forward)
+{
+    size_t start = diff->changes_number;
+
+    for (ini_section_t *s = from->sections; s != NULL; s = s->next) {
+        const char *section_name = s->data.name;
+        size_t section_len = strlen(section_name);
+        ini_index_slot_t *from_section = section_slot(from, section_name, section_len);
+        ini_index_slot_t *to_section = section_slot(to, section_name, section_len);
+        int primary = from_section->value == s;
+
+        if (to_section == NULL) {
+            if (primary && diff_add(diff, capacity,
+                                    forward ? INI_CHANGE_REMOVED : INI_CHANGE_ADDED,
+                                    section_name, NULL, NULL, NULL) != 0)
+                return ENOMEM;
+            continue;
+        }
+
+        if (to_section->content_hash == from_section->content_hash)
+            continue;
+
+        for (ini_arg_t *a = s->data.args; a != NULL; a = a->next) {
+            ini_index_slot_t *from_arg = arg_slot(from, section_name, section_len,
+                                                  a->data.name);
+            if (from_arg->value != a)
+                continue;   /* shadowed by an earlier one */
+
+            ini_index_slot_t *to_arg = arg_slot(to, section_name, section_len,
+                                                a->data.name);
+            int ret = 0;
+            if (to_arg == NULL) {
+                ret = forward
+                    ? diff_add(diff, capacity, INI_CHANGE_REMOVED, section_name,
+                               a->data.name, &a->data, NULL)
+                    : diff_add(diff, capacity, INI_CHANGE_ADDED, section_name,
+                               a->data.name, NULL, &a->data);
+            } else if (forward) {
+                const ini_arg_data_t *to_data = &((ini_arg_t*)to_arg->value)->data;
+                if (to_arg->content_hash != from_arg->content_hash
+                    || !args_equal(&a->data, to_data))
+                    ret = diff_add(diff, capacity, INI_CHANGE_MODIFIED, section_name,
+                                   a->data.name, &a->data, to_data);
+            }
+            if (ret != 0)
+                return ret;
+        }
+
+        if (forward && primary
+            && diff_add(diff, capacity, INI_CHANGE_MODIFIED, section_name,
+                        NULL, NULL, NULL) != 0)
+            return ENOMEM;
+    }
+
+    reverse_changes(diff->changes + start, diff->changes_number - start);
+    return 0;
+}
+
+ini_diff_t* ini_diff(ini_t *old_ini, ini_t *new_ini)
+{
+    if (ini_load_all(old_ini) != 0 || ini_load_all(new_ini) != 0)
+        return NULL;
+
+    ini_diff_t *diff = (ini_diff_t*)calloc(1, sizeof(ini_diff_t));
+    if (diff == NULL)
+        return NULL;
+
+    diff->old_ini = ini_retain(old_ini);
+    diff->new_ini = ini_retain(new_ini);
+
+    size_t capacity = 0;
+    if (diff_walk(diff, &capacity, old_ini, new_ini, 1) != 0
+        || diff_walk(diff, &capacity, new_ini, old_ini, 0) != 0) {
+        ERROR("Failed to diff ini, changes_number:%zu", diff->changes_number);
+        ini_diff_free(diff);
+        return NULL;
+    }
+
+    return diff;
+}
+
+void ini_diff_free(ini_diff_t *diff)
+{
+    if (diff == NULL)
+        return;
+
+    ini_close(diff->old_ini);
+    ini_close(diff->new_ini);
+    free(diff->changes);
+    free(diff);
+}
+
+static void print_values(const ini_arg_data_t *arg)
+{
+    for (size_t i = 0; i < arg->values_number; i++)
+        printf("%s; ", arg->values[i]);
+}
+
+void print_diff(const ini_diff_t *diff)
+{
+    static const char *marks[] = { "+", "-", "~" };
+    for (size_t i = 0; i < diff->changes_number; i++)
+    {
+        const ini_change_t *change = &diff->changes[i];
+        printf("%s [%s]", marks[change->type], change->section_name);
+        if (change->arg_name == NULL) {
+            printf("\n");
+            continue;
+        }
+
+        printf(" %s = ", change->arg_name);
+        if (change->old_arg != NULL)
+            print_values(change->old_arg);
+        if (change->type == INI_CHANGE_MODIFIED)
+            printf("-> ");
+        if (change->new_arg != NULL)
+            print_values(change->new_arg);
+        printf("\n");
+    }
+}
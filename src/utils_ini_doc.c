@@ -0,0 +1,621 @@
+/**
+ * inih -- lossless document model
+ *
+ * The document is the list of lines of the file. Lines the tokenizer
+ * understands remember where their section name, arg name and value are,
+ * everything else (comments, blank lines, whatever follows a line that
+ * stops the parse) is carried verbatim. Edits only touch the lines they
+ * change, so writing an unmodified document reproduces the input byte for
+ * byte.
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+enum doc_line_kind
+{
+    DOC_RAW = 0,        /* blank, comment or not understood */
+    DOC_SECTION,
+    DOC_ARG,
+    DOC_CONTINUATION,
+};
+
+typedef struct doc_line_s doc_line_t;
+struct doc_line_s
+{
+    doc_line_t *prev;
+    doc_line_t *next;
+    const char *text;       /* without the '\n' */
+    size_t len;
+    int kind;
+    int newline;            /* line is terminated by '\n' */
+    size_t name_off;        /* section name, or arg name */
+    size_t name_len;
+    size_t value_off;       /* value, DOC_ARG and DOC_CONTINUATION */
+    size_t value_len;
+};
+
+struct ini_doc_s
+{
+    ini_arena_t *arena;     /* lines and edited text */
+    char *buf;              /* original text */
+    doc_line_t *head;
+    doc_line_t *tail;
+    int crlf;               /* new lines end with "\r\n" */
+};
+
+static doc_line_t* doc_new_line(ini_doc_t *doc, const char *text, size_t len)
+{
+    doc_line_t *line = (doc_line_t*)ini_arena_calloc(doc->arena, sizeof(doc_line_t));
+    if (line == NULL)
+        return NULL;
+
+    line->text = text;
+    line->len = len;
+    line->newline = 1;
+    return line;
+}
+
+/* Insert line after pos, or at the head when pos is NULL. */
+static void doc_link_after(ini_doc_t *doc, doc_line_t *pos, doc_line_t *line)
+{
+    line->prev = pos;
+    line->next = pos != NULL ? pos->next : doc->head;
+    if (line->next != NULL)
+        line->next->prev = line;
+    else
+        doc->tail = line;
+    if (pos != NULL)
+        pos->next = line;
+    else
+        doc->head = line;
+}
+
+static void doc_unlink(ini_doc_t *doc, doc_line_t *line)
+{
+    if (line->prev != NULL)
+        line->prev->next = line->next;
+    else
+        doc->head = line->next;
+    if (line->next != NULL)
+        line->next->prev = line->prev;
+    else
+        doc->tail = line->prev;
+}
+
+typedef struct doc_build_s
+{
+    ini_doc_t *doc;
+    doc_line_t *cursor;
+} doc_build_t;
+
+/* Events come in line order, walk the lines along with them. */
+static int doc_build_handler(void *user, ini_str_t section, ini_str_t name,
+                             ini_str_t value, long pos)
+{
+    doc_build_t *build = (doc_build_t*)(user);
+    const char *start = build->doc->buf + pos;
+
+    while (build->cursor != NULL && build->cursor->text != start)
+        build->cursor = build->cursor->next;
+    if (build->cursor == NULL)
+        return -1;
+
+    doc_line_t *line = build->cursor;
+    if (name.ptr == NULL) {
+        line->kind = DOC_SECTION;
+        line->name_off = (size_t)(section.ptr - line->text);
+        line->name_len = section.len;
+    } else if (name.ptr >= line->text && name.ptr < line->text + line->len) {
+        line->kind = DOC_ARG;
+        line->name_off = (size_t)(name.ptr - line->text);
+        line->name_len = name.len;
+    } else {
+        line->kind = DOC_CONTINUATION;
+    }
+    line->value_off = value.ptr != NULL ? (size_t)(value.ptr - line->text) : 0;
+    line->value_len = value.len;
+
+    return 0;
+}
+
+/* Split buf into lines and let the tokenizer classify them. The document
+   takes ownership of buf. */
+static ini_doc_t* doc_build(char *buf, size_t len)
+{
+    ini_doc_t *doc = (ini_doc_t*)calloc(1, sizeof(ini_doc_t));
+    if (doc == NULL) {
+        free(buf);
+        return NULL;
+    }
+
+    doc->buf = buf;
+    doc->arena = ini_arena_create(0);
+    if (doc->arena == NULL)
+        goto error;
+
+    const char *p = buf;
+    const char *end = buf + len;
+    while (p < end) {
+        const char *eol = ini_scan_ops->find_eol(p, end);
+        doc_line_t *line = doc_new_line(doc, p, (size_t)(eol - p));
+        if (line == NULL)
+            goto error;
+        line->newline = eol < end;
+        doc_link_after(doc, doc->tail, line);
+        p = eol < end ? eol + 1 : end;
+    }
+    doc->crlf = doc->head != NULL && doc->head->len > 0
+        && doc->head->text[doc->head->len - 1] == '\r';
+
+    doc_build_t build = { doc, doc->head };
+    if (parse_buffer(buf, len, doc_build_handler, &build) < 0)
+        goto error;
+
+    return doc;
+
+error:
+    ini_doc_free(doc);
+    return NULL;
+}
+
+ini_doc_t* ini_doc_parse(const char *buf, size_t len)
+{
+    char *copy = (char*)malloc(len + 1);
+    if (copy == NULL)
+        return NULL;
+
+    memcpy(copy, buf, len);
+    return doc_build(copy, len);
+}
+
+ini_doc_t* ini_doc_load(const char *filename)
+{
+    FILE *file;
+    file = fopen(filename, "r");
+    if (!file) {
+        ERROR("Failed to open file:%s. errno:%d", filename, errno);
+        return NULL;
+    }
+
+    char *buf = NULL;
+    size_t len = 0;
+    ini_doc_t *doc = NULL;
+    if (ini_read_file(file, &buf, &len) == 0)
+        doc = doc_build(buf, len);
+    else
+        free(buf);
+
+    fclose(file);
+    return doc;
+}
+
+void ini_doc_free(ini_doc_t *doc)
+{
+    if (doc == NULL)
+        return;
+
+    ini_arena_destroy(doc->arena);
+    free(doc->buf);
+    free(doc);
+}
+
+static int span_equals(const doc_line_t *line, size_t off, size_t len,
+                       const char *str)
+{
+    return len == strlen(str) && memcmp(line->text + off, str, len) == 0;
+}
+
+static int is_section(const doc_line_t *line, const char *section_name)
+{
+    return line->kind == DOC_SECTION
+        && span_equals(line, line->name_off, line->name_len, section_name);
+}
+
+static int is_arg(const doc_line_t *line, const char *arg_name)
+{
+    return line->kind == DOC_ARG
+        && span_equals(line, line->name_off, line->name_len, arg_name);
+}
+
+/* Header of the next occurrence of section_name after line (from the start
+   when line is NULL). The "" section is the part before the first header,
+   it is returned as a NULL header with *found set. */
+static doc_line_t* find_section(const ini_doc_t *doc, doc_line_t *after,
+                                const char *section_name, int *found)
+{
+    *found = 0;
+    if (after == NULL && *section_name == '\0') {
+        for (doc_line_t *line = doc->head; line != NULL; line = line->next) {
+            if (line->kind == DOC_SECTION)
+                break;
+            if (line->kind != DOC_RAW) {
+                *found = 1;
+                break;
+            }
+        }
+        return NULL;
+    }
+
+    for (doc_line_t *line = after != NULL ? after->next : doc->head;
+         line != NULL; line = line->next) {
+        if (is_section(line, section_name)) {
+            *found = 1;
+            return line;
+        }
+    }
+
+    return NULL;
+}
+
+static doc_line_t* section_first(const ini_doc_t *doc, doc_line_t *header)
+{
+    return header != NULL ? header->next : doc->head;
+}
+
+/* Replace the [off, off + len) span of a line with str. */
+static int splice_line(ini_doc_t *doc, doc_line_t *line, size_t off, size_t len,
+                       const char *str, size_t str_len)
+{
+    size_t new_len = line->len - len + str_len;
+    char *text = (char*)ini_arena_alloc(doc->arena, new_len + 1, 1);
+    if (text == NULL)
+        return ENOMEM;
+
+    memcpy(text, line->text, off);
+    memcpy(text + off, str, str_len);
+    memcpy(text + off + str_len, line->text + off + len, line->len - off - len);
+    text[new_len] = '\0';
+
+    if (line->name_off > off)
+        line->name_off = line->name_off - len + str_len;
+    if (line->value_off > off)
+        line->value_off = line->value_off - len + str_len;
+    line->text = text;
+    line->len = new_len;
+    return 0;
+}
+
+static doc_line_t* new_text_line(ini_doc_t *doc, int kind, const char *prefix,
+                                 const char *body, const char *suffix)
+{
+    size_t prefix_len = strlen(prefix);
+    size_t body_len = strlen(body);
+    size_t suffix_len = strlen(suffix);
+    size_t len = prefix_len + body_len + suffix_len + (doc->crlf ? 1 : 0);
+
+    char *text = (char*)ini_arena_alloc(doc->arena, len + 1, 1);
+    if (text == NULL)
+        return NULL;
+    snprintf(text, len + 1, "%s%s%s%s", prefix, body, suffix, doc->crlf ? "\r" : "");
+
+    doc_line_t *line = doc_new_line(doc, text, len);
+    if (line == NULL)
+        return NULL;
+    line->kind = kind;
+    if (kind == DOC_SECTION || kind == DOC_ARG) {
+        line->name_off = prefix_len;
+        line->name_len = body_len;
+    } else {
+        line->value_off = prefix_len;
+        line->value_len = body_len;
+    }
+    return line;
+}
+
+/* An indented line right after an arg is read as one of its values. When
+   an edit puts an arg in front of an indented header or arg line, drop the
+   indentation so the line keeps its meaning. */
+static int unindent_after(ini_doc_t *doc, doc_line_t *pos)
+{
+    doc_line_t *prev = pos;
+    while (prev != NULL && prev->kind == DOC_RAW)
+        prev = prev->prev;
+    if (prev == NULL || prev->kind == DOC_SECTION)
+        return 0;
+
+    doc_line_t *line = pos != NULL ? pos->next : doc->head;
+    while (line != NULL && line->kind == DOC_RAW)
+        line = line->next;
+    if (line == NULL || line->kind == DOC_CONTINUATION
+        || line->len == 0 || !ini_isspace(line->text[0]))
+        return 0;
+
+    size_t indent = 0;
+    while (indent < line->len && ini_isspace(line->text[indent]))
+        indent++;
+    return splice_line(doc, line, 0, indent, "", 0);
+}
+
+/* Insert "name = values[0]" and continuation lines after pos. */
+static int insert_arg(ini_doc_t *doc, doc_line_t *pos, const char *arg_name,
+                      const char *const *values, size_t values_number)
+{
+    doc_line_t *line = new_text_line(doc, DOC_ARG, "", arg_name, " = ");
+    if (line == NULL
+        || (values_number && splice_line(doc, line, line->len - doc->crlf, 0,
+                                         values[0], strlen(values[0])) != 0))
+        return ENOMEM;
+    line->value_off = line->name_len + 3;
+    line->value_len = values_number ? strlen(values[0]) : 0;
+    doc_link_after(doc, pos, line);
+
+    for (size_t i = 1; i < values_number; i++) {
+        doc_line_t *cont = new_text_line(doc, DOC_CONTINUATION, "    ", values[i], "");
+        if (cont == NULL)
+            return ENOMEM;
+        doc_link_after(doc, line, cont);
+        line = cont;
+    }
+
+    return unindent_after(doc, line);
+}
+
+/* The previous line must end with a newline before anything is appended. */
+static void terminate_tail(ini_doc_t *doc)
+{
+    if (doc->tail != NULL)
+        doc->tail->newline = 1;
+}
+
+int ini_doc_set(ini_doc_t *doc, const char *section_name,
+                const ini_arg_data_t *arg_data)
+{
+    const char *arg_name = arg_data->name;
+    const char *const *values = (const char *const *)arg_data->values;
+    size_t values_number = arg_data->values_number;
+    int found;
+    doc_line_t *header = find_section(doc, NULL, section_name, &found);
+
+    if (!found) {
+        if (*section_name == '\0')
+            return insert_arg(doc, NULL, arg_name, values, values_number);
+
+        terminate_tail(doc);
+        if (doc->tail != NULL && doc->tail->len > (size_t)doc->crlf) {
+            doc_line_t *blank = new_text_line(doc, DOC_RAW, "", "", "");
+            if (blank == NULL)
+                return ENOMEM;
+            doc_link_after(doc, doc->tail, blank);
+        }
+
+        header = new_text_line(doc, DOC_SECTION, "[", section_name, "]");
+        if (header == NULL)
+            return ENOMEM;
+        doc_link_after(doc, doc->tail, header);
+        return insert_arg(doc, header, arg_name, values, values_number);
+    }
+
+    doc_line_t *last = header;
+    doc_line_t *arg = NULL;
+    for (doc_line_t *line = section_first(doc, header); line != NULL;
+         line = line->next) {
+        if (line->kind == DOC_SECTION && !is_section(line, section_name))
+            break;
+        if (line->kind == DOC_RAW)
+            continue;
+        last = line;
+        if (arg == NULL && is_arg(line, arg_name))
+            arg = line;
+    }
+
+    if (arg == NULL) {
+        if (last != NULL && last->next == NULL)
+            terminate_tail(doc);
+        return insert_arg(doc, last, arg_name, values, values_number);
+    }
+
+    /* Keep the arg line's name, separator and inline comment, swap the
+       value and rebuild the continuation lines. */
+    const char *value = values_number ? values[0] : "";
+    size_t value_len = strlen(value);
+    size_t suffix_off = arg->value_off + arg->value_len;
+    int need_space = value_len && suffix_off < arg->len
+        && !ini_isspace(arg->text[suffix_off])
+        && strchr(INI_INLINE_COMMENT_PREFIXES, arg->text[suffix_off]) != NULL;
+    if (splice_line(doc, arg, arg->value_off, arg->value_len, value, value_len) != 0
+        || (need_space && splice_line(doc, arg, arg->value_off + value_len, 0, " ", 1) != 0))
+        return ENOMEM;
+    arg->value_len = value_len;
+
+    /* The parser merges an arg with the same name right after it, even
+       across a repeated header of the same section, so those lines go
+       too. New continuation lines reuse the indentation of the old ones. */
+    const char *indent = NULL;
+    size_t indent_len = 0;
+    doc_line_t *line = arg->next;
+    while (line != NULL) {
+        doc_line_t *next = line->next;
+        if (line->kind == DOC_CONTINUATION) {
+            if (indent == NULL) {
+                indent = line->text;
+                indent_len = line->value_off;
+            }
+            doc_unlink(doc, line);
+        } else if (is_arg(line, arg_name)) {
+            doc_unlink(doc, line);
+        } else if (line->kind == DOC_ARG
+                   || (line->kind == DOC_SECTION && !is_section(line, section_name))) {
+            break;
+        }
+        line = next;
+    }
+    if (indent == NULL) {
+        indent = "    ";
+        indent_len = 4;
+    }
+
+    char *prefix = ini_arena_strndup(doc->arena, indent, indent_len);
+    if (prefix == NULL)
+        return ENOMEM;
+    line = arg;
+    for (size_t i = 1; i < values_number; i++) {
+        if (line->next == NULL)
+            line->newline = 1;
+        doc_line_t *cont = new_text_line(doc, DOC_CONTINUATION, prefix, values[i], "");
+        if (cont == NULL)
+            return ENOMEM;
+        doc_link_after(doc, line, cont);
+        line = cont;
+    }
+
+    return 0;
+}
+
+static void remove_arg_lines(ini_doc_t *doc, doc_line_t *arg)
+{
+    doc_line_t *line = arg->next;
+    while (line != NULL && line->kind != DOC_SECTION && line->kind != DOC_ARG) {
+        doc_line_t *next = line->next;
+        if (line->kind == DOC_CONTINUATION)
+            doc_unlink(doc, line);
+        line = next;
+    }
+    doc_unlink(doc, arg);
+}
+
+/* Run fn on every line of every occurrence of the section. */
+static int for_each_section_line(ini_doc_t *doc, const char *section_name,
+                                 int (*fn)(ini_doc_t*, doc_line_t*, void*),
+                                 void *arg)
+{
+    int found;
+    int matched = 0;
+    doc_line_t *header = find_section(doc, NULL, section_name, &found);
+    while (found) {
+        doc_line_t *line = section_first(doc, header);
+        while (line != NULL && line->kind != DOC_SECTION) {
+            int ret = fn(doc, line, arg);
+            if (ret < 0)
+                return -ret;
+            matched += ret;
+            /* An unlinked line still points at its live successor. */
+            line = line->next;
+        }
+        if (*section_name == '\0')
+            break;
+        header = find_section(doc, header, section_name, &found);
+    }
+
+    return matched ? 0 : ENOENT;
+}
+
+static int remove_arg_fn(ini_doc_t *doc, doc_line_t *line, void *arg_name)
+{
+    if (!is_arg(line, (const char*)arg_name))
+        return 0;
+
+    remove_arg_lines(doc, line);
+    return 1;
+}
+
+int ini_doc_remove_arg(ini_doc_t *doc, const char *section_name,
+                       const char *arg_name)
+{
+    return for_each_section_line(doc, section_name, remove_arg_fn, (void*)arg_name);
+}
+
+typedef struct rename_s
+{
+    const char *from;
+    const char *to;
+} rename_t;
+
+static int rename_arg_fn(ini_doc_t *doc, doc_line_t *line, void *user)
+{
+    rename_t *rename = (rename_t*)user;
+    if (!is_arg(line, rename->from))
+        return 0;
+
+    if (splice_line(doc, line, line->name_off, line->name_len,
+                    rename->to, strlen(rename->to)) != 0)
+        return -ENOMEM;
+    line->name_len = strlen(rename->to);
+    return 1;
+}
+
+int ini_doc_rename_arg(ini_doc_t *doc, const char *section_name,
+                       const char *old_name, const char *new_name)
+{
+    rename_t rename = { old_name, new_name };
+    return for_each_section_line(doc, section_name, rename_arg_fn, &rename);
+}
+
+/* Removes the header and body of every occurrence of the section. */
+int ini_doc_remove_section(ini_doc_t *doc, const char *section_name)
+{
+    int found;
+    int matched = 0;
+    doc_line_t *header = find_section(doc, NULL, section_name, &found);
+    while (found) {
+        doc_line_t *line = section_first(doc, header);
+        while (line != NULL && line->kind != DOC_SECTION) {
+            doc_line_t *next = line->next;
+            doc_unlink(doc, line);
+            line = next;
+        }
+        matched = 1;
+        if (header == NULL)
+            break;
+
+        doc_line_t *prev = header->prev;
+        doc_unlink(doc, header);
+        if (unindent_after(doc, prev) != 0)
+            return ENOMEM;
+        header = find_section(doc, prev, section_name, &found);
+    }
+
+    return matched ? 0 : ENOENT;
+}
+
+int ini_doc_rename_section(ini_doc_t *doc, const char *old_name,
+                           const char *new_name)
+{
+    int matched = 0;
+    for (doc_line_t *line = doc->head; line != NULL; line = line->next) {
+        if (!is_section(line, old_name))
+            continue;
+
+        if (splice_line(doc, line, line->name_off, line->name_len,
+                        new_name, strlen(new_name)) != 0)
+            return ENOMEM;
+        line->name_len = strlen(new_name);
+        matched = 1;
+    }
+
+    return matched ? 0 : ENOENT;
+}
+
+int ini_doc_write(const ini_doc_t *doc, FILE *file)
+{
+    for (const doc_line_t *line = doc->head; line != NULL; line = line->next) {
+        fwrite(line->text, sizeof(char), line->len, file);
+        if (line->newline)
+            fputc('\n', file);
+    }
+
+    return ferror(file) ? -1 : 0;
+}
+
+/* Written to a temporary file next to filename and renamed over it, so
+   readers see either the old or the new document. */
+int ini_doc_save(const ini_doc_t *doc, const char *filename)
+{
+    char *tmp_name;
+    FILE *file = ini_temp_create(filename, &tmp_name);
+    if (file == NULL)
+        return -1;
+
+    if (ini_doc_write(doc, file) != 0) {
+        ERROR("Failed to save file:%s. errno:%d", filename, errno);
+        ini_temp_discard(file, tmp_name);
+        return -1;
+    }
+    return ini_temp_commit(file, tmp_name, filename);
+}
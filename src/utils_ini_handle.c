@@ -0,0 +1,623 @@
+/**
+ * inih -- parsed config handle with hashed section/arg lookup
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+int ini_index_init(ini_index_t *index, size_t hint)
+{
+    size_t capacity = 16;
+    while (capacity < hint * 2)
+        capacity <<= 1;
+
+    index->slots = (ini_index_slot_t*)calloc(capacity, sizeof(ini_index_slot_t));
+    if (index->slots == NULL)
+        return ENOMEM;
+
+    index->mask = capacity - 1;
+    index->count = 0;
+    return 0;
+}
+
+void ini_index_free(ini_index_t *index)
+{
+    sfree(index->slots);
+    index->mask = 0;
+    index->count = 0;
+}
+
+static inline size_t index_bucket(const ini_index_t *index, uint64_t hash)
+{
+    return (size_t)(hash ^ (hash >> 32)) & index->mask;
+}
+
+static inline int slot_matches(const ini_index_slot_t *slot, uint64_t hash,
+                               const char *section, size_t section_len,
+                               const char *name, size_t name_len)
+{
+    if (slot->hash != hash || slot->section_len != section_len)
+        return 0;
+    if ((slot->name == NULL) != (name == NULL))
+        return 0;
+    if (memcmp(slot->section, section, section_len) != 0)
+        return 0;
+    return name == NULL
+        || (slot->name_len == name_len && memcmp(slot->name, name, name_len) == 0);
+}
+
+static int index_grow(ini_index_t *index)
+{
+    ini_index_t bigger;
+    bigger.mask = index->mask * 2 + 1;
+    bigger.count = index->count;
+    bigger.slots = (ini_index_slot_t*)calloc(bigger.mask + 1, sizeof(ini_index_slot_t));
+    if (bigger.slots == NULL)
+        return ENOMEM;
+
+    for (size_t i = 0; i <= index->mask; i++) {
+        ini_index_slot_t *slot = &index->slots[i];
+        if (slot->section == NULL)
+            continue;
+
+        size_t b = index_bucket(&bigger, slot->hash);
+        while (bigger.slots[b].section != NULL)
+            b = (b + 1) & bigger.mask;
+        bigger.slots[b] = *slot;
+    }
+
+    free(index->slots);
+    *index = bigger;
+    return 0;
+}
+
+ini_index_slot_t* ini_index_insert(ini_index_t *index, uint64_t hash,
+                                   const char *section, size_t section_len,
+                                   const char *name, size_t name_len)
+{
+    if ((index->count + 1) * 2 > index->mask + 1 && index_grow(index) != 0)
+        return NULL;
+
+    size_t b = index_bucket(index, hash);
+    while (index->slots[b].section != NULL) {
+        if (slot_matches(&index->slots[b], hash, section, section_len, name, name_len))
+            return &index->slots[b];
+        b = (b + 1) & index->mask;
+    }
+
+    ini_index_slot_t *slot = &index->slots[b];
+    slot->hash = hash;
+    slot->section = section;
+    slot->section_len = (uint32_t)section_len;
+    slot->name = name;
+    slot->name_len = (uint32_t)name_len;
+    slot->value = NULL;
+    slot->content_hash = 0;
+    slot->cache = NULL;
+    index->count++;
+    return slot;
+}
+
+ini_index_slot_t* ini_index_find_slot(const ini_index_t *index, uint64_t hash,
+                                      const char *section, size_t section_len,
+                                      const char *name, size_t name_len)
+{
+    if (index->slots == NULL)
+        return NULL;
+
+    size_t b = index_bucket(index, hash);
+    while (index->slots[b].section != NULL) {
+        if (slot_matches(&index->slots[b], hash, section, section_len, name, name_len))
+            return &index->slots[b];
+        b = (b + 1) & index->mask;
+    }
+
+    return NULL;
+}
+
+void* ini_index_find(const ini_index_t *index, uint64_t hash,
+                     const char *section, size_t section_len,
+                     const char *name, size_t name_len)
+{
+    ini_index_slot_t *slot = ini_index_find_slot(index, hash, section, section_len,
+                                                 name, name_len);
+    return slot != NULL ? slot->value : NULL;
+}
+
+static inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb3fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Hash the values of every indexed arg, and give each section the sum of
+   its args' hashes mixed with their keys, so two handles agree on a section
+   hash when lookups through it return the same values, in any order. */
+static void hash_contents(ini_t *ini)
+{
+    for (size_t i = 0; i <= ini->args_index.mask; i++) {
+        ini_index_slot_t *slot = &ini->args_index.slots[i];
+        if (slot->section == NULL)
+            continue;
+
+        const ini_arg_data_t *arg = &((ini_arg_t*)slot->value)->data;
+        uint64_t hash = ini_fnv1a(INI_FNV_OFFSET, (const char*)&arg->values_number,
+                                  sizeof(arg->values_number));
+        for (size_t j = 0; j < arg->values_number; j++)
+            hash = ini_fnv1a(hash, arg->values[j], strlen(arg->values[j]) + 1);
+        slot->content_hash = hash;
+
+        ini_index_slot_t *section = ini_index_find_slot(
+            &ini->sections_index, ini_hash_key(slot->section, slot->section_len, NULL, 0),
+            slot->section, slot->section_len, NULL, 0);
+        section->content_hash += mix64(slot->hash ^ hash);
+    }
+}
+
+/* The tree is in reverse file order, so overwriting on every visit leaves
+   the first occurrence in the file in the index. */
+static int build_index(ini_t *ini)
+{
+    size_t sections = 0, args = 0;
+    for (ini_section_t *s = ini->sections; s != NULL; s = s->next) {
+        sections++;
+        for (ini_arg_t *a = s->data.args; a != NULL; a = a->next)
+            args++;
+    }
+
+    if (ini_index_init(&ini->sections_index, sections) != 0
+        || ini_index_init(&ini->args_index, args) != 0)
+        return ENOMEM;
+
+    for (ini_section_t *s = ini->sections; s != NULL; s = s->next) {
+        size_t section_len = strlen(s->data.name);
+        ini_index_slot_t *slot = ini_index_insert(&ini->sections_index,
+                                                  ini_hash_key(s->data.name, section_len, NULL, 0),
+                                                  s->data.name, section_len, NULL, 0);
+        if (slot == NULL)
+            return ENOMEM;
+        slot->value = s;
+
+        for (ini_arg_t *a = s->data.args; a != NULL; a = a->next) {
+            size_t name_len = strlen(a->data.name);
+            slot = ini_index_insert(&ini->args_index,
+                                    ini_hash_key(s->data.name, section_len,
+                                                 a->data.name, name_len),
+                                    s->data.name, section_len,
+                                    a->data.name, name_len);
+            if (slot == NULL)
+                return ENOMEM;
+            slot->value = a;
+        }
+    }
+
+    hash_contents(ini);
+    return 0;
+}
+
+/* A lazy handle keeps one node per run of adjacent headers with the same
+   name, the way the parser merges them, with the byte range of the run's
+   body in the mapping. Nodes with the same name are chained in file order
+   and only ever parsed in that order, so the first occurrence of an arg is
+   always the first one inserted into the index. */
+typedef struct lazy_section_s lazy_section_t;
+struct lazy_section_s
+{
+    ini_section_t section;        /* first, the index points here */
+    const char *body;
+    size_t body_len;
+    lazy_section_t *next_same;
+    lazy_section_t *last_same;    /* chain tail, on the chain head */
+    int parsed;
+};
+
+typedef struct lazy_scan_s
+{
+    ini_t *ini;
+    const char *buf;
+    lazy_section_t *current;
+} lazy_scan_t;
+
+static lazy_section_t* lazy_add_section(lazy_scan_t *scan, ini_str_t name,
+                                        const char *body)
+{
+    ini_t *ini = scan->ini;
+    lazy_section_t *node = (lazy_section_t*)ini_arena_calloc(ini->arena,
+                                                             sizeof(lazy_section_t));
+    if (node == NULL)
+        return NULL;
+
+    ini_copy_name(node->section.data.name, INI_MAX_SECTION, name);
+    node->body = body;
+    INI_STATS_ADD(INI_STAT_SECTIONS, 1);
+    ini_section_t *section = &node->section;
+    APPED_ITEM(ini->sections, section);
+
+    size_t section_len = strlen(node->section.data.name);
+    ini_index_slot_t *slot = ini_index_insert(
+        &ini->sections_index, ini_hash_key(node->section.data.name, section_len, NULL, 0),
+        node->section.data.name, section_len, NULL, 0);
+    if (slot == NULL)
+        return NULL;
+
+    if (slot->value == NULL) {
+        slot->value = node;
+        node->last_same = node;
+    } else {
+        lazy_section_t *head = (lazy_section_t*)slot->value;
+        head->last_same->next_same = node;
+        head->last_same = node;
+    }
+
+    return node;
+}
+
+static void lazy_end_section(lazy_scan_t *scan, size_t pos)
+{
+    if (scan->current != NULL)
+        scan->current->body_len = (size_t)(scan->buf + pos - scan->current->body);
+}
+
+/* Section events, and names of args before the first header. */
+static int lazy_scan_handler(void *user, ini_str_t section, ini_str_t name,
+                             ini_str_t __attribute__((unused)) value, long pos)
+{
+    lazy_scan_t *scan = (lazy_scan_t*)(user);
+
+    if (name.ptr != NULL) {
+        if (scan->current == NULL
+            && (scan->current = lazy_add_section(scan, section, scan->buf)) == NULL)
+            return -1;
+        return 0;
+    }
+
+    if (scan->current != NULL
+        && ini_name_equals(scan->current->section.data.name, INI_MAX_SECTION, section))
+        return 0;
+
+    lazy_end_section(scan, (size_t)pos);
+    const char *eol = memchr(section.ptr, '\n', (size_t)(scan->ini->map_len
+                             - (size_t)(section.ptr - scan->buf)));
+    const char *body = eol != NULL ? eol + 1 : scan->buf + scan->ini->map_len;
+    scan->current = lazy_add_section(scan, section, body);
+    return scan->current != NULL ? 0 : -1;
+}
+
+typedef struct lazy_build_s
+{
+    ini_arena_t *arena;
+    ini_section_t *section;
+    size_t values_capacity;
+} lazy_build_t;
+
+/* arena_build_handler() for a single section; headers inside the body are
+   repeats of its own name. */
+static int lazy_build_handler(void *user, ini_str_t __attribute__((unused)) section,
+                              ini_str_t name, ini_str_t value,
+                              long __attribute__((unused)) pos)
+{
+    lazy_build_t *build = (lazy_build_t*)(user);
+    if (name.ptr == NULL)
+        return 0;
+
+    ini_arg_t **ini_arg = &build->section->data.args;
+    if (*ini_arg == NULL
+        || !ini_name_equals((*ini_arg)->data.name, INI_MAX_NAME, name))
+    {
+        ini_arg_t *item = (ini_arg_t*)ini_arena_calloc(build->arena, sizeof(ini_arg_t));
+        if (item == NULL)
+            return -1;
+        ini_copy_name(item->data.name, INI_MAX_NAME, name);
+        APPED_ITEM((*ini_arg), item);
+        build->values_capacity = 0;
+        INI_STATS_ADD(INI_STAT_KEYS, 1);
+    }
+
+    return ini_arena_strarray_add(build->arena, &(*ini_arg)->data.values,
+                                  &(*ini_arg)->data.values_number,
+                                  &build->values_capacity,
+                                  value.ptr, value.len) == 0 ? 0 : -1;
+}
+
+/* Called with the lock held. */
+static int lazy_parse(ini_t *ini, lazy_section_t *node)
+{
+    if (node->parsed)
+        return 0;
+
+    lazy_build_t build = { ini->arena, &node->section, 0 };
+    if (parse_buffer(node->body, node->body_len, lazy_build_handler, &build) != 0)
+        return -1;
+
+    /* Args are listed newest first, index them oldest first and keep what
+       an earlier node already put there. */
+    size_t args = 0;
+    for (ini_arg_t *a = node->section.data.args; a != NULL; a = a->next)
+        args++;
+    ini_arg_t **order = (ini_arg_t**)calloc(args + 1, sizeof(ini_arg_t*));
+    if (order == NULL)
+        return ENOMEM;
+    size_t i = args;
+    for (ini_arg_t *a = node->section.data.args; a != NULL; a = a->next)
+        order[--i] = a;
+
+    const char *section_name = node->section.data.name;
+    size_t section_len = strlen(section_name);
+    int ret = 0;
+    for (i = 0; i < args; i++) {
+        ini_arg_t *arg = order[i];
+        size_t name_len = strlen(arg->data.name);
+        ini_index_slot_t *slot = ini_index_insert(
+            &ini->args_index,
+            ini_hash_key(section_name, section_len, arg->data.name, name_len),
+            section_name, section_len, arg->data.name, name_len);
+        if (slot == NULL) {
+            ret = ENOMEM;
+            break;
+        }
+        if (slot->value == NULL)
+            slot->value = arg;
+    }
+
+    free(order);
+    node->parsed = ret == 0;
+    return ret;
+}
+
+static int lazy_open(ini_t *ini, const char *filename)
+{
+    pthread_mutex_init(&ini->lock, NULL);
+    if (ini_map_file(filename, &ini->map, &ini->map_len) != 0
+        || ini_index_init(&ini->sections_index, 16) != 0
+        || ini_index_init(&ini->args_index, 16) != 0)
+        return -1;
+
+    lazy_scan_t scan = { ini, (const char*)ini->map, NULL };
+    size_t end_pos = 0;
+    if (parse_buffer_ex(scan.buf, ini->map_len, lazy_scan_handler, &scan,
+                        INI_PARSE_HEADERS, &end_pos) != 0)
+        return -1;
+    lazy_end_section(&scan, end_pos);
+
+    return 0;
+}
+
+int ini_load_all(ini_t *ini)
+{
+    if (!(ini->flags & INI_OPEN_LAZY) || __atomic_load_n(&ini->complete, __ATOMIC_ACQUIRE))
+        return 0;
+
+    int ret = 0;
+    pthread_mutex_lock(&ini->lock);
+    for (size_t i = 0; i <= ini->sections_index.mask && ret == 0; i++) {
+        lazy_section_t *node = (lazy_section_t*)ini->sections_index.slots[i].value;
+        for (; node != NULL && ret == 0; node = node->next_same)
+            ret = lazy_parse(ini, node);
+    }
+    if (ret == 0 && !ini->complete) {
+        hash_contents(ini);
+        __atomic_store_n(&ini->complete, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&ini->lock);
+
+    return ret;
+}
+
+ini_t* ini_open_ex(const char *filename, int flags)
+{
+    ini_t *ini = (ini_t*)calloc(1, sizeof(ini_t));
+    if (ini == NULL)
+        return NULL;
+
+    ini->refs = 1;
+    ini->flags = flags;
+    ini->arena = ini_arena_create(0);
+    if (ini->arena == NULL
+        || ((flags & INI_OPEN_LAZY)
+            ? lazy_open(ini, filename)
+            : (ini_parse_arena_ex(filename, ini->arena, &ini->sections) != 0
+               || build_index(ini) != 0)) != 0) {
+        ERROR("Failed to load ini. file:%s", filename);
+        ini_close(ini);
+        return NULL;
+    }
+
+    return ini;
+}
+
+ini_t* ini_open_buffer(const char *buf, size_t len)
+{
+    ini_t *ini = (ini_t*)calloc(1, sizeof(ini_t));
+    if (ini == NULL)
+        return NULL;
+
+    ini->refs = 1;
+    ini->arena = ini_arena_create(0);
+    if (ini->arena == NULL
+        || ini_arena_parse_buffer(ini->arena, buf, len, &ini->sections, NULL) != 0
+        || build_index(ini) != 0) {
+        ERROR("Failed to load ini from buffer, len:%zu", len);
+        ini_close(ini);
+        return NULL;
+    }
+
+    return ini;
+}
+
+ini_t* ini_open(const char *filename)
+{
+    return ini_open_ex(filename, 0);
+}
+
+ini_t* ini_retain(ini_t *ini)
+{
+    __atomic_add_fetch(&ini->refs, 1, __ATOMIC_RELAXED);
+    return ini;
+}
+
+void ini_close(ini_t *ini)
+{
+    if (ini == NULL || __atomic_sub_fetch(&ini->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    if (ini->flags & INI_OPEN_LAZY) {
+        pthread_mutex_destroy(&ini->lock);
+        if (ini->map != NULL)
+            munmap(ini->map, ini->map_len);
+    }
+    if (ini->caches) {
+        for (size_t i = 0; i <= ini->args_index.mask; i++)
+            free(ini->args_index.slots[i].cache);
+    }
+    ini_index_free(&ini->sections_index);
+    ini_index_free(&ini->args_index);
+    ini_arena_destroy(ini->arena);
+    free(ini);
+}
+
+const ini_section_t* ini_sections(const ini_t *ini)
+{
+    if (ini_load_all((ini_t*)ini) != 0)
+        return NULL;
+    return ini->sections;
+}
+
+static int lazy_locked(const ini_t *ini)
+{
+    if (!(ini->flags & INI_OPEN_LAZY) || __atomic_load_n(&ini->complete, __ATOMIC_ACQUIRE))
+        return 0;
+
+    pthread_mutex_lock((pthread_mutex_t*)&ini->lock);
+    return 1;
+}
+
+static void lazy_unlock(const ini_t *ini, int locked)
+{
+    if (locked)
+        pthread_mutex_unlock((pthread_mutex_t*)&ini->lock);
+}
+
+/* Names are stored truncated like get_section()/get_arg() truncate their
+   queries, so match on the same prefix. */
+uint64_t ini_key_hash(const char *section_name, const char *arg_name)
+{
+    size_t section_len = strnlen(section_name, INI_MAX_SECTION - 1);
+    if (arg_name == NULL)
+        return ini_hash_key(section_name, section_len, NULL, 0);
+    return ini_hash_key(section_name, section_len,
+                        arg_name, strnlen(arg_name, INI_MAX_NAME - 1));
+}
+
+const ini_section_data_t* ini_get_section_hashed(const ini_t *ini, uint64_t hash,
+                                                 const char *section_name)
+{
+    uint64_t start = ini_stats_start();
+    size_t section_len = strnlen(section_name, INI_MAX_SECTION - 1);
+    int locked = lazy_locked(ini);
+    ini_section_t *section = (ini_section_t*)ini_index_find(
+        &ini->sections_index, hash, section_name, section_len, NULL, 0);
+    if (section != NULL && locked && lazy_parse((ini_t*)ini, (lazy_section_t*)section) != 0)
+        section = NULL;
+    lazy_unlock(ini, locked);
+    ini_stats_stop(INI_TIMER_LOOKUP, start);
+
+    return section != NULL ? &section->data : NULL;
+}
+
+const ini_section_data_t* ini_get_section(const ini_t *ini, const char *section_name)
+{
+    return ini_get_section_hashed(ini, ini_key_hash(section_name, NULL), section_name);
+}
+
+/* Find the slot of an arg, parsing on a lazy handle as far as needed.
+   Slots may move while a lazy handle is incomplete: keep the lock taken
+   by the caller as long as the slot is used. */
+static ini_index_slot_t* find_arg_slot(const ini_t *ini, uint64_t hash,
+                                       const char *section_name,
+                                       const char *arg_name, int locked)
+{
+    size_t section_len = strnlen(section_name, INI_MAX_SECTION - 1);
+    size_t name_len = strnlen(arg_name, INI_MAX_NAME - 1);
+    ini_index_slot_t *slot = ini_index_find_slot(&ini->args_index, hash,
+                                                 section_name, section_len,
+                                                 arg_name, name_len);
+
+    /* Parsed nodes are a prefix of the chain, parse on until found. */
+    if (slot == NULL && locked) {
+        lazy_section_t *node = (lazy_section_t*)ini_index_find(
+            &ini->sections_index, ini_hash_key(section_name, section_len, NULL, 0),
+            section_name, section_len, NULL, 0);
+        for (; node != NULL && slot == NULL; node = node->next_same) {
+            if (node->parsed)
+                continue;
+            if (lazy_parse((ini_t*)ini, node) != 0)
+                break;
+            slot = ini_index_find_slot(&ini->args_index, hash,
+                                       section_name, section_len,
+                                       arg_name, name_len);
+        }
+    }
+
+    return slot;
+}
+
+const ini_arg_data_t* ini_get_arg_hashed(const ini_t *ini, uint64_t hash,
+                                         const char *section_name,
+                                         const char *arg_name)
+{
+    uint64_t start = ini_stats_start();
+    int locked = lazy_locked(ini);
+    ini_index_slot_t *slot = find_arg_slot(ini, hash, section_name, arg_name, locked);
+    ini_arg_t *arg = slot != NULL ? (ini_arg_t*)slot->value : NULL;
+    lazy_unlock(ini, locked);
+    ini_stats_stop(INI_TIMER_LOOKUP, start);
+
+    return arg != NULL ? &arg->data : NULL;
+}
+
+const ini_arg_data_t* ini_get_arg(const ini_t *ini,
+                                  const char *section_name,
+                                  const char *arg_name)
+{
+    return ini_get_arg_hashed(ini, ini_key_hash(section_name, arg_name),
+                              section_name, arg_name);
+}
+
+int ini_arg_cache(const ini_t *ini, const char *section_name, const char *arg_name,
+                  ini_cache_builder build, const void **cache)
+{
+    int ret = 0;
+    int locked = lazy_locked(ini);
+    ini_index_slot_t *slot = find_arg_slot(ini, ini_key_hash(section_name, arg_name),
+                                           section_name, arg_name, locked);
+    if (slot == NULL) {
+        ret = ENOENT;
+    } else if ((*cache = __atomic_load_n(&slot->cache, __ATOMIC_ACQUIRE)) == NULL) {
+        /* Racing builders agree on the content, the first one is kept. */
+        void *built = build(&((ini_arg_t*)slot->value)->data);
+        void *expected = NULL;
+        if (built == NULL) {
+            ret = ENOMEM;
+        } else if (__atomic_compare_exchange_n(&slot->cache, &expected, built, 0,
+                                               __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&((ini_t*)ini)->caches, 1, __ATOMIC_RELAXED);
+            *cache = built;
+        } else {
+            free(built);
+            *cache = expected;
+        }
+    }
+    lazy_unlock(ini, locked);
+
+    return ret;
+}
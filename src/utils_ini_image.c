@@ -0,0 +1,603 @@
+/**
+ * inih -- precompiled binary image
+ *
+ * ini_compile() lays a parsed handle out as flat tables addressed by
+ * offsets: sections, args, value strings and two hashed directories over a
+ * shared string table. Loading is an mmap() and a header check, lookups
+ * probe the directories in place.
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+static inline const ini_image_header_t* image_header(const ini_image_t *image)
+{
+    return (const ini_image_header_t*)image->base;
+}
+
+#define IMAGE_TABLE(image, type, field) \
+    ((const type*)((image)->base + image_header(image)->field))
+
+static inline size_t bucket_of(uint64_t hash, uint32_t buckets_number)
+{
+    return (size_t)(hash ^ (hash >> 32)) & (buckets_number - 1);
+}
+
+/* Out of range strings read as empty rather than out of the image. */
+static ini_str_t image_str(const ini_image_t *image, ini_image_str_t str)
+{
+    const ini_image_header_t *header = image_header(image);
+    ini_str_t ret = { "", 0 };
+    if (str.offset < header->strings_size && str.len < header->strings_size - str.offset) {
+        ret.ptr = image->base + header->strings_offset + str.offset;
+        ret.len = str.len;
+    }
+    return ret;
+}
+
+static int image_str_equals(const ini_image_t *image, ini_image_str_t str,
+                            const char *s, size_t len)
+{
+    ini_str_t value = image_str(image, str);
+    return value.len == len && memcmp(value.ptr, s, len) == 0;
+}
+
+static const ini_image_section_t* find_section(const ini_image_t *image, uint64_t hash,
+                                               const char *name, size_t len)
+{
+    const ini_image_header_t *header = image_header(image);
+    const uint32_t *buckets = IMAGE_TABLE(image, uint32_t, section_buckets_offset);
+    const ini_image_section_t *sections = IMAGE_TABLE(image, ini_image_section_t,
+                                                      sections_offset);
+
+    size_t b = bucket_of(hash, header->section_buckets_number);
+    for (uint32_t probe = 0; probe < header->section_buckets_number; probe++) {
+        uint32_t index = buckets[b];
+        if (index == 0)
+            break;
+        if (index <= header->sections_number) {
+            const ini_image_section_t *section = &sections[index - 1];
+            if (section->hash == hash && image_str_equals(image, section->name, name, len))
+                return section;
+        }
+        b = (b + 1) & (header->section_buckets_number - 1);
+    }
+
+    return NULL;
+}
+
+static const ini_image_arg_t* find_arg(const ini_image_t *image, uint64_t hash,
+                                       const char *section_name, size_t section_len,
+                                       const char *name, size_t name_len)
+{
+    const ini_image_header_t *header = image_header(image);
+    const uint32_t *buckets = IMAGE_TABLE(image, uint32_t, arg_buckets_offset);
+    const ini_image_section_t *sections = IMAGE_TABLE(image, ini_image_section_t,
+                                                      sections_offset);
+    const ini_image_arg_t *args = IMAGE_TABLE(image, ini_image_arg_t, args_offset);
+
+    size_t b = bucket_of(hash, header->arg_buckets_number);
+    for (uint32_t probe = 0; probe < header->arg_buckets_number; probe++) {
+        uint32_t index = buckets[b];
+        if (index == 0)
+            break;
+        if (index <= header->args_number) {
+            const ini_image_arg_t *arg = &args[index - 1];
+            if (arg->hash == hash && arg->section < header->sections_number
+                && image_str_equals(image, arg->name, name, name_len)
+                && image_str_equals(image, sections[arg->section].name,
+                                    section_name, section_len))
+                return arg;
+        }
+        b = (b + 1) & (header->arg_buckets_number - 1);
+    }
+
+    return NULL;
+}
+
+static void dir_insert(uint32_t *buckets, uint32_t buckets_number, uint64_t hash,
+                       uint32_t index)
+{
+    size_t b = bucket_of(hash, buckets_number);
+    while (buckets[b] != 0)
+        b = (b + 1) & (buckets_number - 1);
+    buckets[b] = index + 1;
+}
+
+static uint32_t buckets_for(size_t number)
+{
+    uint32_t buckets = 1;
+    while (buckets < number * 2)
+        buckets <<= 1;
+    return buckets;
+}
+
+typedef struct image_strings_s
+{
+    char *data;
+    size_t len;
+    size_t capacity;
+    ini_index_t index;      /* string -> offset + 1 */
+} image_strings_t;
+
+/* Every distinct string is stored once. str must outlive the build. */
+static int strings_add(image_strings_t *strings, const char *str, size_t len,
+                       ini_image_str_t *ret)
+{
+    ini_index_slot_t *slot = ini_index_insert(&strings->index,
+                                              ini_hash_key(str, len, NULL, 0),
+                                              str, len, NULL, 0);
+    if (slot == NULL)
+        return ENOMEM;
+
+    if (slot->value == NULL) {
+        if (strings->len + len + 1 > UINT32_MAX)
+            return EFBIG;
+        if (strings->len + len + 1 > strings->capacity) {
+            size_t capacity = strings->capacity ? strings->capacity : 4096;
+            while (capacity < strings->len + len + 1)
+                capacity *= 2;
+            char *tmp = (char*)realloc(strings->data, capacity);
+            if (tmp == NULL)
+                return ENOMEM;
+            strings->data = tmp;
+            strings->capacity = capacity;
+        }
+
+        memcpy(strings->data + strings->len, str, len);
+        strings->data[strings->len + len] = '\0';
+        slot->value = (void*)(uintptr_t)(strings->len + 1);
+        strings->len += len + 1;
+    }
+
+    ret->offset = (uint32_t)((uintptr_t)slot->value - 1);
+    ret->len = (uint32_t)len;
+    return 0;
+}
+
+typedef struct image_build_s
+{
+    ini_section_t **sections;      /* file order */
+    ini_arg_t **args;              /* file order within each section */
+    ini_image_section_t *section_records;
+    ini_image_arg_t *arg_records;
+    ini_image_str_t *value_records;
+    image_strings_t strings;
+} image_build_t;
+
+static void image_build_free(image_build_t *build)
+{
+    free(build->sections);
+    free(build->args);
+    free(build->section_records);
+    free(build->arg_records);
+    free(build->value_records);
+    free(build->strings.data);
+    ini_index_free(&build->strings.index);
+}
+
+static int image_build_records(image_build_t *build, ini_t *ini, ini_image_header_t *header)
+{
+    size_t sections_number = 0, args_number = 0, values_number = 0;
+    for (ini_section_t *s = ini->sections; s != NULL; s = s->next) {
+        sections_number++;
+        for (ini_arg_t *a = s->data.args; a != NULL; a = a->next) {
+            args_number++;
+            values_number += a->data.values_number;
+        }
+    }
+    if (sections_number > UINT32_MAX || args_number > UINT32_MAX
+        || values_number > UINT32_MAX)
+        return EFBIG;
+
+    build->sections = (ini_section_t**)calloc(sections_number + 1, sizeof(ini_section_t*));
+    build->args = (ini_arg_t**)calloc(args_number + 1, sizeof(ini_arg_t*));
+    build->section_records = (ini_image_section_t*)calloc(sections_number + 1,
+                                                          sizeof(ini_image_section_t));
+    build->arg_records = (ini_image_arg_t*)calloc(args_number + 1, sizeof(ini_image_arg_t));
+    build->value_records = (ini_image_str_t*)calloc(values_number + 1, sizeof(ini_image_str_t));
+    if (build->sections == NULL || build->args == NULL || build->section_records == NULL
+        || build->arg_records == NULL || build->value_records == NULL
+        || ini_index_init(&build->strings.index, args_number + sections_number) != 0)
+        return ENOMEM;
+
+    size_t i = sections_number;
+    for (ini_section_t *s = ini->sections; s != NULL; s = s->next)
+        build->sections[--i] = s;
+
+    size_t arg = 0, value = 0;
+    for (i = 0; i < sections_number; i++) {
+        ini_section_data_t *data = &build->sections[i]->data;
+        size_t section_len = strlen(data->name);
+        ini_image_section_t *record = &build->section_records[i];
+        record->hash = ini_hash_key(data->name, section_len, NULL, 0);
+        record->first_arg = (uint32_t)arg;
+        if (strings_add(&build->strings, data->name, section_len, &record->name) != 0)
+            return ENOMEM;
+
+        for (ini_arg_t *a = data->args; a != NULL; a = a->next)
+            record->args_number++;
+        size_t j = arg + record->args_number;
+        for (ini_arg_t *a = data->args; a != NULL; a = a->next)
+            build->args[--j] = a;
+
+        for (j = arg; j < arg + record->args_number; j++) {
+            ini_arg_data_t *arg_data = &build->args[j]->data;
+            size_t name_len = strlen(arg_data->name);
+            ini_image_arg_t *arg_record = &build->arg_records[j];
+            arg_record->hash = ini_hash_key(data->name, section_len, arg_data->name, name_len);
+            arg_record->section = (uint32_t)i;
+            arg_record->first_value = (uint32_t)value;
+            arg_record->values_number = (uint32_t)arg_data->values_number;
+            if (strings_add(&build->strings, arg_data->name, name_len, &arg_record->name) != 0)
+                return ENOMEM;
+
+            for (size_t k = 0; k < arg_data->values_number; k++) {
+                if (strings_add(&build->strings, arg_data->values[k],
+                                strlen(arg_data->values[k]),
+                                &build->value_records[value++]) != 0)
+                    return ENOMEM;
+            }
+        }
+        arg += record->args_number;
+    }
+
+    header->sections_number = (uint32_t)sections_number;
+    header->args_number = (uint32_t)args_number;
+    header->values_number = (uint32_t)values_number;
+    return 0;
+}
+
+int ini_image_build(ini_t *ini, const struct stat *source, char **ret_buf, size_t *ret_len)
+{
+    if (ini_load_all(ini) != 0)
+        return -1;
+
+    ini_image_header_t header;
+    memset(&header, 0, sizeof(header));
+    image_build_t build;
+    memset(&build, 0, sizeof(build));
+    int ret = image_build_records(&build, ini, &header);
+    if (ret != 0) {
+        ERROR("Failed to build image records, ret:%d", ret);
+        image_build_free(&build);
+        return -1;
+    }
+
+    header.magic = INI_IMAGE_MAGIC;
+    header.version = INI_IMAGE_VERSION;
+    header.section_buckets_number = buckets_for(header.sections_number);
+    header.arg_buckets_number = buckets_for(header.args_number);
+
+    size_t offset = ALIGN8(sizeof(header));
+    header.sections_offset = (uint32_t)offset;
+    offset = ALIGN8(offset + header.sections_number * sizeof(ini_image_section_t));
+    header.args_offset = (uint32_t)offset;
+    offset = ALIGN8(offset + header.args_number * sizeof(ini_image_arg_t));
+    header.values_offset = (uint32_t)offset;
+    offset = ALIGN8(offset + header.values_number * sizeof(ini_image_str_t));
+    header.section_buckets_offset = (uint32_t)offset;
+    offset = ALIGN8(offset + header.section_buckets_number * sizeof(uint32_t));
+    header.arg_buckets_offset = (uint32_t)offset;
+    offset = ALIGN8(offset + header.arg_buckets_number * sizeof(uint32_t));
+    header.strings_offset = (uint32_t)offset;
+    header.strings_size = (uint32_t)build.strings.len;
+    offset = ALIGN8(offset + build.strings.len);
+    header.image_size = offset;
+    if (offset > UINT32_MAX) {
+        ERROR("Image too large, size:%zu", offset);
+        image_build_free(&build);
+        return -1;
+    }
+
+    if (source != NULL) {
+        header.source_size = (uint64_t)source->st_size;
+        header.source_mtime_sec = (int64_t)source->st_mtim.tv_sec;
+        header.source_mtime_nsec = (int64_t)source->st_mtim.tv_nsec;
+    }
+
+    char *buf = (char*)calloc(1, offset);
+    if (buf == NULL) {
+        image_build_free(&build);
+        return -1;
+    }
+
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + header.sections_offset, build.section_records,
+           header.sections_number * sizeof(ini_image_section_t));
+    memcpy(buf + header.args_offset, build.arg_records,
+           header.args_number * sizeof(ini_image_arg_t));
+    memcpy(buf + header.values_offset, build.value_records,
+           header.values_number * sizeof(ini_image_str_t));
+    if (build.strings.len)
+        memcpy(buf + header.strings_offset, build.strings.data, build.strings.len);
+
+    /* Directories keep the first section and the first arg of each name,
+       probing the image as it fills up. */
+    ini_image_t view = { buf, offset, 0, NULL };
+    uint32_t *section_buckets = (uint32_t*)(buf + header.section_buckets_offset);
+    for (uint32_t i = 0; i < header.sections_number; i++) {
+        const ini_image_section_t *record = &build.section_records[i];
+        const char *name = build.sections[i]->data.name;
+        if (find_section(&view, record->hash, name, record->name.len) == NULL)
+            dir_insert(section_buckets, header.section_buckets_number, record->hash, i);
+    }
+
+    uint32_t *arg_buckets = (uint32_t*)(buf + header.arg_buckets_offset);
+    for (uint32_t i = 0; i < header.args_number; i++) {
+        const ini_image_arg_t *record = &build.arg_records[i];
+        const ini_section_data_t *section = &build.sections[record->section]->data;
+        const char *name = build.args[i]->data.name;
+        if (find_arg(&view, record->hash, section->name,
+                     build.section_records[record->section].name.len,
+                     name, record->name.len) == NULL)
+            dir_insert(arg_buckets, header.arg_buckets_number, record->hash, i);
+    }
+
+    ini_image_header_t *out = (ini_image_header_t*)buf;
+    out->payload_checksum = ini_fnv1a(INI_FNV_OFFSET, buf + sizeof(header),
+                                      offset - sizeof(header));
+    out->header_checksum = ini_fnv1a(INI_FNV_OFFSET, buf,
+                                     offsetof(ini_image_header_t, header_checksum));
+
+    image_build_free(&build);
+    *ret_buf = buf;
+    *ret_len = offset;
+    return 0;
+}
+
+static int table_fits(uint64_t image_size, uint32_t offset, uint64_t number, size_t size)
+{
+    return offset >= sizeof(ini_image_header_t) && offset % 8 == 0
+        && offset <= image_size && number * size <= image_size - offset;
+}
+
+int ini_image_attach(ini_image_t *image, const void *base, size_t size, int verify)
+{
+    const ini_image_header_t *header = (const ini_image_header_t*)base;
+    if (size < sizeof(ini_image_header_t) || header->magic != INI_IMAGE_MAGIC
+        || header->version != INI_IMAGE_VERSION
+        || header->header_checksum != ini_fnv1a(INI_FNV_OFFSET, (const char*)base,
+                                                offsetof(ini_image_header_t, header_checksum))
+        || header->image_size > size)
+        return -1;
+
+    uint32_t sb = header->section_buckets_number;
+    uint32_t ab = header->arg_buckets_number;
+    if (sb == 0 || (sb & (sb - 1)) != 0 || ab == 0 || (ab & (ab - 1)) != 0
+        || !table_fits(header->image_size, header->sections_offset,
+                       header->sections_number, sizeof(ini_image_section_t))
+        || !table_fits(header->image_size, header->args_offset,
+                       header->args_number, sizeof(ini_image_arg_t))
+        || !table_fits(header->image_size, header->values_offset,
+                       header->values_number, sizeof(ini_image_str_t))
+        || !table_fits(header->image_size, header->section_buckets_offset, sb,
+                       sizeof(uint32_t))
+        || !table_fits(header->image_size, header->arg_buckets_offset, ab,
+                       sizeof(uint32_t))
+        || !table_fits(header->image_size, header->strings_offset,
+                       header->strings_size, 1))
+        return -1;
+
+    if (verify && header->payload_checksum != ini_fnv1a(
+            INI_FNV_OFFSET, (const char*)base + sizeof(ini_image_header_t),
+            header->image_size - sizeof(ini_image_header_t)))
+        return -1;
+
+    image->base = (const char*)base;
+    image->size = size;
+    return 0;
+}
+
+static int image_open_file(ini_image_t *image, const char *image_filename,
+                           const char *filename, int flags)
+{
+    void *map;
+    size_t len;
+    if (ini_map_file(image_filename, &map, &len) != 0 || map == NULL)
+        return -1;
+
+    if (ini_image_attach(image, map, len, flags & INI_IMAGE_VERIFY) != 0) {
+        ERROR("Invalid image file:%s", image_filename);
+        munmap(map, len);
+        return -1;
+    }
+
+    /* A source that is gone leaves the image as the only copy. */
+    struct stat st;
+    const ini_image_header_t *header = image_header(image);
+    if (filename != NULL && stat(filename, &st) == 0
+        && ((uint64_t)st.st_size != header->source_size
+            || (int64_t)st.st_mtim.tv_sec != header->source_mtime_sec
+            || (int64_t)st.st_mtim.tv_nsec != header->source_mtime_nsec)) {
+        DEBUG("Image file:%s is older than file:%s", image_filename, filename);
+        munmap(map, len);
+        return -1;
+    }
+
+    image->from_file = 1;
+    return 0;
+}
+
+ini_image_t* ini_image_open(const char *image_filename, const char *filename, int flags)
+{
+    ini_image_t *image = (ini_image_t*)calloc(1, sizeof(ini_image_t));
+    if (image == NULL)
+        return NULL;
+
+    if (image_filename != NULL
+        && image_open_file(image, image_filename, filename, flags) == 0)
+        return image;
+
+    /* Fall back to parsing, into an image in memory. */
+    ini_t *ini = filename != NULL ? ini_open(filename) : NULL;
+    char *buf = NULL;
+    size_t len = 0;
+    if (ini == NULL || ini_image_build(ini, NULL, &buf, &len) != 0
+        || ini_image_attach(image, buf, len, 0) != 0) {
+        ERROR("Failed to load image:%s or file:%s", image_filename, filename);
+        ini_close(ini);
+        free(buf);
+        free(image);
+        return NULL;
+    }
+
+    ini_close(ini);
+    image->owned = buf;
+    return image;
+}
+
+void ini_image_close(ini_image_t *image)
+{
+    if (image == NULL)
+        return;
+
+    if (image->from_file)
+        munmap((void*)image->base, image->size);
+    free(image->owned);
+    free(image);
+}
+
+int ini_image_from_file(const ini_image_t *image)
+{
+    return image->from_file;
+}
+
+int ini_compile(const char *filename, const char *image_filename)
+{
+    struct stat st;
+    if (stat(filename, &st) != 0) {
+        ERROR("Failed to stat file:%s. errno:%d", filename, errno);
+        return -1;
+    }
+
+    ini_t *ini = ini_open(filename);
+    if (ini == NULL)
+        return -1;
+
+    char *buf = NULL;
+    size_t len = 0;
+    int ret = ini_image_build(ini, &st, &buf, &len);
+    ini_close(ini);
+    if (ret != 0)
+        return -1;
+
+    /* Replace the image with a rename, a running reader keeps its mapping
+       of the old one. */
+    char *tmp_name;
+    FILE *file = ini_temp_create(image_filename, &tmp_name);
+    ret = -1;
+    if (file != NULL) {
+        if (fwrite(buf, 1, len, file) == len) {
+            ret = ini_temp_commit(file, tmp_name, image_filename);
+        } else {
+            ERROR("Failed to write image:%s. errno:%d", image_filename, errno);
+            ini_temp_discard(file, tmp_name);
+        }
+    }
+
+    free(buf);
+    return ret;
+}
+
+size_t ini_image_sections_number(const ini_image_t *image)
+{
+    return image_header(image)->sections_number;
+}
+
+const ini_image_section_t* ini_image_section_at(const ini_image_t *image, size_t index)
+{
+    return index < image_header(image)->sections_number
+        ? &IMAGE_TABLE(image, ini_image_section_t, sections_offset)[index] : NULL;
+}
+
+const ini_image_arg_t* ini_image_arg_at(const ini_image_t *image,
+                                        const ini_image_section_t *section,
+                                        size_t index)
+{
+    size_t arg = (size_t)section->first_arg + index;
+    return index < section->args_number && arg < image_header(image)->args_number
+        ? &IMAGE_TABLE(image, ini_image_arg_t, args_offset)[arg] : NULL;
+}
+
+ini_str_t ini_image_section_name(const ini_image_t *image,
+                                 const ini_image_section_t *section)
+{
+    return image_str(image, section->name);
+}
+
+ini_str_t ini_image_arg_name(const ini_image_t *image, const ini_image_arg_t *arg)
+{
+    return image_str(image, arg->name);
+}
+
+size_t ini_image_values_number(const ini_image_t *image, const ini_image_arg_t *arg)
+{
+    uint64_t end = (uint64_t)arg->first_value + arg->values_number;
+    return end <= image_header(image)->values_number ? arg->values_number : 0;
+}
+
+ini_str_t ini_image_value(const ini_image_t *image, const ini_image_arg_t *arg,
+                          size_t index)
+{
+    ini_str_t value = { NULL, 0 };
+    if (index >= ini_image_values_number(image, arg))
+        return value;
+
+    return image_str(image, IMAGE_TABLE(image, ini_image_str_t,
+                                        values_offset)[arg->first_value + index]);
+}
+
+/* Queries are truncated like ini_get_section()/ini_get_arg() truncate them. */
+const ini_image_section_t* ini_image_get_section(const ini_image_t *image,
+                                                 const char *section_name)
+{
+    size_t section_len = strnlen(section_name, INI_MAX_SECTION - 1);
+    return find_section(image, ini_hash_key(section_name, section_len, NULL, 0),
+                        section_name, section_len);
+}
+
+const ini_image_arg_t* ini_image_get_arg(const ini_image_t *image,
+                                         const char *section_name,
+                                         const char *arg_name)
+{
+    size_t section_len = strnlen(section_name, INI_MAX_SECTION - 1);
+    size_t name_len = strnlen(arg_name, INI_MAX_NAME - 1);
+    return find_arg(image, ini_hash_key(section_name, section_len, arg_name, name_len),
+                    section_name, section_len, arg_name, name_len);
+}
+
+void print_image(const ini_image_t *image)
+{
+    for (size_t i = 0; i < ini_image_sections_number(image); i++)
+    {
+        const ini_image_section_t *section = ini_image_section_at(image, i);
+        ini_str_t name = ini_image_section_name(image, section);
+        printf("[%.*s]\n", (int)name.len, name.ptr);
+        for (size_t j = 0; j < section->args_number; j++)
+        {
+            const ini_image_arg_t *arg = ini_image_arg_at(image, section, j);
+            if (arg == NULL)
+                break;
+            name = ini_image_arg_name(image, arg);
+            printf("    %.*s = ", (int)name.len, name.ptr);
+            for (size_t k = 0; k < ini_image_values_number(image, arg); k++)
+            {
+                ini_str_t value = ini_image_value(image, arg, k);
+                printf("%.*s; ", (int)value.len, value.ptr);
+            }
+            printf("\n");
+        }
+    }
+}
@@ -0,0 +1,492 @@
+/**
+ * inih -- append-only update journal
+ *
+ * Updates are records in filename.journal: a header and a payload of NUL
+ * terminated strings, the section, the arg name and the values. The config
+ * is the base file with the records applied in order by the add_arg()
+ * rules. A record only sets values, so applying one twice changes nothing,
+ * which is what keeps compaction crash safe: it writes the base with a
+ * prefix of the journal applied to a temporary file and renames it over the
+ * base, and only then replaces the journal by the records appended since,
+ * also through a rename. Writers hold flock() on the journal and reopen it
+ * when it was replaced under them; compaction also holds the add_arg() lock
+ * on the base while it reads and replaces it. Readers take no lock and read
+ * the journal before the base, which is never older than the journal read.
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define JOURNAL_MAGIC 0x4a494e49    /* "INIJ" */
+#define JOURNAL_SUFFIX ".journal"
+
+typedef struct journal_record_s
+{
+    uint32_t magic;
+    uint32_t len;               /* of the payload */
+    uint64_t checksum;          /* FNV-1a of the payload */
+} journal_record_t;
+
+struct ini_journal_s
+{
+    char *filename;
+    char *journal_name;
+    int fd;                     /* the journal, -1 until opened */
+    ino_t ino;                  /* of fd */
+    size_t compact_bytes;
+    pthread_mutex_t lock;       /* fd and the compaction thread state */
+    pthread_mutex_t compact_lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int thread_started;
+    int pending;
+    int stop;
+};
+
+static int journal_reopen(ini_journal_t *journal)
+{
+    if (journal->fd != -1)
+        close(journal->fd);
+
+    struct stat st;
+    journal->fd = open(journal->journal_name, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC,
+                       0666);
+    if (journal->fd == -1 || fstat(journal->fd, &st) != 0) {
+        ERROR("Failed to open journal:%s. errno:%d", journal->journal_name, errno);
+        if (journal->fd != -1)
+            close(journal->fd);
+        journal->fd = -1;
+        return -1;
+    }
+
+    journal->ino = st.st_ino;
+    return 0;
+}
+
+/* Lock the journal the name refers to now, reopening it if a compaction
+   replaced the one held. */
+static int journal_lock(ini_journal_t *journal)
+{
+    pthread_mutex_lock(&journal->lock);
+    for (;;) {
+        if (journal->fd == -1 && journal_reopen(journal) != 0)
+            break;
+        if (flock(journal->fd, LOCK_EX) != 0) {
+            if (errno == EINTR)
+                continue;
+            ERROR("Failed to lock journal:%s. errno:%d", journal->journal_name, errno);
+            break;
+        }
+
+        struct stat st;
+        if (stat(journal->journal_name, &st) == 0 && st.st_ino == journal->ino)
+            return 0;
+        close(journal->fd);
+        journal->fd = -1;
+    }
+
+    pthread_mutex_unlock(&journal->lock);
+    return -1;
+}
+
+static void journal_unlock(ini_journal_t *journal)
+{
+    flock(journal->fd, LOCK_UN);
+    pthread_mutex_unlock(&journal->lock);
+}
+
+static int journal_read(int fd, char **buf, size_t *len)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return -1;
+
+    *len = (size_t)st.st_size;
+    *buf = (char*)malloc(*len + 1);
+    if (*buf == NULL) {
+        ERROR("Failed to malloc buf, len(%zu)", *len);
+        return -1;
+    }
+
+    for (size_t done = 0; done < *len; ) {
+        ssize_t n = pread(fd, *buf + done, *len - done, (off_t)done);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR)
+                continue;
+            *len = done;        /* shrunk meanwhile */
+            break;
+        }
+        done += (size_t)n;
+    }
+
+    return 0;
+}
+
+/* Return 1 and advance pos past the record at pos if it is whole and
+   intact, 0 at the end of the records. */
+static int journal_next(const char *buf, size_t len, size_t *pos, ini_str_t *payload)
+{
+    journal_record_t record;
+    if (len - *pos < sizeof(record))
+        return 0;
+    memcpy(&record, buf + *pos, sizeof(record));
+
+    const char *p = buf + *pos + sizeof(record);
+    if (record.magic != JOURNAL_MAGIC || record.len < 2
+        || record.len > len - *pos - sizeof(record) || p[record.len - 1] != '\0'
+        || memchr(p, '\0', record.len - 1) == NULL
+        || ini_fnv1a(INI_FNV_OFFSET, p, record.len) != record.checksum)
+        return 0;
+
+    payload->ptr = p;
+    payload->len = record.len;
+    *pos += sizeof(record) + record.len;
+    return 1;
+}
+
+static int journal_apply(ini_txn_t *txn, ini_str_t payload)
+{
+    const char *section_name = payload.ptr;
+    const char *name = section_name + strlen(section_name) + 1;
+    const char *end = payload.ptr + payload.len;
+
+    ini_arg_data_t arg_data;
+    memset(&arg_data, 0, sizeof(arg_data));
+    ini_str_t name_str = { name, strlen(name) };
+    ini_copy_name(arg_data.name, sizeof(arg_data.name), name_str);
+
+    const char *value = name + name_str.len + 1;
+    for (const char *p = value; p < end; p += strlen(p) + 1)
+        arg_data.values_number++;
+    if (arg_data.values_number) {
+        arg_data.values = (char**)malloc(arg_data.values_number * sizeof(char*));
+        if (arg_data.values == NULL)
+            return ENOMEM;
+    }
+    for (size_t i = 0; i < arg_data.values_number; value += strlen(value) + 1)
+        arg_data.values[i++] = (char*)value;
+
+    int ret = ini_txn_add_arg(txn, section_name, &arg_data);
+    free(arg_data.values);
+    return ret;
+}
+
+/* Write the base file with the records in buf applied to out. */
+static int journal_render(const char *filename, const char *buf, size_t len, FILE *out)
+{
+    ini_txn_t *txn = ini_txn_begin(filename);
+    if (txn == NULL)
+        return -1;
+
+    int ret = 0;
+    ini_str_t payload;
+    for (size_t pos = 0; ret == 0 && journal_next(buf, len, &pos, &payload); )
+        ret = journal_apply(txn, payload);
+
+    static char empty[1];
+    char *base = empty;
+    size_t base_len = 0;
+    FILE *file = ret == 0 ? fopen(filename, "r") : NULL;
+    if (file != NULL) {
+        ret = ini_read_file(file, &base, &base_len);
+        fclose(file);
+    } else if (ret == 0 && errno != ENOENT) {
+        ERROR("Failed to open file:%s. errno:%d", filename, errno);
+        ret = -1;
+    }
+
+    long first;
+    if (ret == 0 && (ini_txn_plan(txn, base, base_len, &first) != 0
+                     || ini_txn_render(txn, base, base_len, 0, out) != 0))
+        ret = -1;
+
+    if (base != empty)
+        free(base);
+    ini_txn_abort(txn);
+    return ret;
+}
+
+int ini_journal_compact(ini_journal_t *journal)
+{
+    pthread_mutex_lock(&journal->compact_lock);
+
+    char *records = NULL;
+    size_t len = 0;
+    if (journal_lock(journal) != 0) {
+        pthread_mutex_unlock(&journal->compact_lock);
+        return -1;
+    }
+    ino_t ino = journal->ino;
+    int ret = journal_read(journal->fd, &records, &len);
+    journal_unlock(journal);
+
+    /* The base is rewritten without holding the journal, but with the lock
+       add_arg() takes on it, or an add_arg() between the read and the
+       rename would be lost. */
+    char *tmp_name = NULL;
+    FILE *base = NULL;
+    FILE *file = NULL;
+    if (ret == 0 && len > 0) {
+        base = ini_open_locked(journal->filename);
+        if (base != NULL)
+            file = ini_temp_create(journal->filename, &tmp_name);
+        if (file == NULL || journal_render(journal->filename, records, len, file) != 0) {
+            ERROR("Failed to compact journal:%s", journal->journal_name);
+            ret = -1;
+        }
+    }
+
+    if (file != NULL && ret == 0 && journal_lock(journal) == 0) {
+        char *all = NULL;
+        size_t all_len = 0;
+        FILE *tail = NULL;
+        char *tail_name = NULL;
+        if (journal->ino != ino) {
+            /* Another process compacted meanwhile, ours is stale. */
+            ini_temp_discard(file, tmp_name);
+        } else if ((ret = ini_temp_commit(file, tmp_name, journal->filename)) == 0) {
+            /* Keep what was appended since the journal was read. */
+            ret = -1;
+            if (journal_read(journal->fd, &all, &all_len) == 0
+                && (tail = ini_temp_create(journal->journal_name, &tail_name)) != NULL) {
+                if (all_len > len)
+                    fwrite(all + len, sizeof(char), all_len - len, tail);
+                ret = ini_temp_commit(tail, tail_name, journal->journal_name);
+            }
+            if (ret == 0)
+                journal_reopen(journal);
+            free(all);
+        }
+        journal_unlock(journal);
+    } else if (file != NULL) {
+        ini_temp_discard(file, tmp_name);
+        ret = -1;
+    }
+
+    if (base != NULL)
+        fclose(base);
+    free(records);
+    pthread_mutex_unlock(&journal->compact_lock);
+    return ret;
+}
+
+static void* journal_thread(void *arg)
+{
+    ini_journal_t *journal = (ini_journal_t*)arg;
+
+    pthread_mutex_lock(&journal->lock);
+    while (!journal->stop) {
+        if (!journal->pending) {
+            pthread_cond_wait(&journal->cond, &journal->lock);
+            continue;
+        }
+
+        journal->pending = 0;
+        pthread_mutex_unlock(&journal->lock);
+        ini_journal_compact(journal);
+        pthread_mutex_lock(&journal->lock);
+    }
+    pthread_mutex_unlock(&journal->lock);
+
+    return NULL;
+}
+
+ini_journal_t* ini_journal_open(const char *filename, size_t compact_bytes)
+{
+    ini_journal_t *journal = (ini_journal_t*)calloc(1, sizeof(ini_journal_t));
+    if (journal == NULL)
+        return NULL;
+
+    size_t len = strlen(filename);
+    journal->fd = -1;
+    journal->compact_bytes = compact_bytes;
+    journal->filename = strdup(filename);
+    journal->journal_name = (char*)malloc(len + sizeof(JOURNAL_SUFFIX));
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_mutex_init(&journal->compact_lock, NULL);
+    pthread_cond_init(&journal->cond, NULL);
+    if (journal->filename == NULL || journal->journal_name == NULL) {
+        ini_journal_close(journal);
+        return NULL;
+    }
+    memcpy(journal->journal_name, filename, len);
+    memcpy(journal->journal_name + len, JOURNAL_SUFFIX, sizeof(JOURNAL_SUFFIX));
+
+    /* Cut off a record torn by a crash, appends would go after it. */
+    if (journal_lock(journal) != 0) {
+        ini_journal_close(journal);
+        return NULL;
+    }
+    char *buf = NULL;
+    size_t pos = 0;
+    int ret = journal_read(journal->fd, &buf, &len);
+    if (ret == 0) {
+        ini_str_t payload;
+        while (journal_next(buf, len, &pos, &payload))
+            ;
+        if (pos < len) {
+            ERROR("Dropping %zu bytes of torn records, journal:%s", len - pos,
+                  journal->journal_name);
+            ret = ftruncate(journal->fd, (off_t)pos);
+        }
+    }
+    journal_unlock(journal);
+    free(buf);
+
+    if (ret == 0 && compact_bytes > 0) {
+        ret = pthread_create(&journal->thread, NULL, journal_thread, journal);
+        journal->thread_started = ret == 0;
+    }
+    if (ret != 0) {
+        ini_journal_close(journal);
+        return NULL;
+    }
+
+    return journal;
+}
+
+void ini_journal_close(ini_journal_t *journal)
+{
+    if (journal == NULL)
+        return;
+
+    if (journal->thread_started) {
+        pthread_mutex_lock(&journal->lock);
+        journal->stop = 1;
+        pthread_cond_signal(&journal->cond);
+        pthread_mutex_unlock(&journal->lock);
+        pthread_join(journal->thread, NULL);
+    }
+
+    if (journal->fd != -1)
+        close(journal->fd);
+    pthread_cond_destroy(&journal->cond);
+    pthread_mutex_destroy(&journal->compact_lock);
+    pthread_mutex_destroy(&journal->lock);
+    free(journal->journal_name);
+    free(journal->filename);
+    free(journal);
+}
+
+int ini_journal_add_arg(ini_journal_t *journal, const char *section_name,
+                        const ini_arg_data_t *arg_data)
+{
+    journal_record_t record;
+    size_t section_len = strlen(section_name) + 1;
+    size_t name_len = strlen(arg_data->name) + 1;
+    size_t len = section_len + name_len;
+    for (size_t i = 0; i < arg_data->values_number; i++)
+        len += strlen(arg_data->values[i]) + 1;
+
+    char *buf = (char*)malloc(sizeof(record) + len);
+    if (buf == NULL) {
+        ERROR("Failed to malloc record, len(%zu)", len);
+        return -1;
+    }
+
+    char *p = buf + sizeof(record);
+    memcpy(p, section_name, section_len);
+    p += section_len;
+    memcpy(p, arg_data->name, name_len);
+    p += name_len;
+    for (size_t i = 0; i < arg_data->values_number; i++) {
+        size_t value_len = strlen(arg_data->values[i]) + 1;
+        memcpy(p, arg_data->values[i], value_len);
+        p += value_len;
+    }
+    record.magic = JOURNAL_MAGIC;
+    record.len = (uint32_t)len;
+    record.checksum = ini_fnv1a(INI_FNV_OFFSET, buf + sizeof(record), len);
+    memcpy(buf, &record, sizeof(record));
+
+    if (journal_lock(journal) != 0) {
+        free(buf);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(journal->fd, &st) != 0) {
+        ERROR("Failed to stat journal:%s. errno:%d", journal->journal_name, errno);
+        journal_unlock(journal);
+        free(buf);
+        return -1;
+    }
+
+    int ret = 0;
+    size_t done = 0;
+    while (ret == 0 && done < sizeof(record) + len) {
+        ssize_t n = write(journal->fd, buf + done, sizeof(record) + len - done);
+        if (n > 0)
+            done += (size_t)n;
+        else if (n == 0 || errno != EINTR)
+            ret = -1;           /* write() returning 0 would spin forever */
+    }
+    if (ret == 0)
+        ret = fdatasync(journal->fd);
+
+    if (ret != 0) {
+        ERROR("Failed to append to journal:%s. errno:%d", journal->journal_name, errno);
+        /* Don't leave a partial record for the next ones to follow. */
+        if (ftruncate(journal->fd, st.st_size) != 0)
+            ERROR("Failed to ftruncate.");
+    } else if (journal->compact_bytes > 0
+               && (size_t)st.st_size + done >= journal->compact_bytes
+               && !journal->pending) {
+        journal->pending = 1;
+        pthread_cond_signal(&journal->cond);
+    }
+
+    journal_unlock(journal);
+    free(buf);
+    return ret;
+}
+
+ini_t* ini_journal_load(const char *filename)
+{
+    size_t len = strlen(filename);
+    char *journal_name = (char*)malloc(len + sizeof(JOURNAL_SUFFIX));
+    if (journal_name == NULL)
+        return NULL;
+    memcpy(journal_name, filename, len);
+    memcpy(journal_name + len, JOURNAL_SUFFIX, sizeof(JOURNAL_SUFFIX));
+
+    char *records = NULL;
+    size_t records_len = 0;
+    int fd = open(journal_name, O_RDONLY | O_CLOEXEC);
+    free(journal_name);
+    if (fd != -1) {
+        int ret = journal_read(fd, &records, &records_len);
+        close(fd);
+        if (ret != 0)
+            return NULL;
+    }
+    if (records_len < sizeof(journal_record_t)) {
+        free(records);
+        return ini_open(filename);
+    }
+
+    char *buf = NULL;
+    size_t buf_len = 0;
+    FILE *out = open_memstream(&buf, &buf_len);
+    int ret = out != NULL ? journal_render(filename, records, records_len, out) : -1;
+    if (out != NULL && fclose(out) != 0)
+        ret = -1;
+    free(records);
+
+    ini_t *ini = ret == 0 ? ini_open_buffer(buf, buf_len) : NULL;
+    if (ini == NULL)
+        ERROR("Failed to load ini with journal. file:%s", filename);
+    free(buf);
+    return ini;
+}
@@ -0,0 +1,222 @@
+/**
+ * inih -- logging
+ *
+ * Messages at or above the runtime level are formatted and handed to the
+ * sink. With the asynchronous sink started, callers only format into a
+ * slot of a bounded ring and a background thread calls the sink: a full
+ * ring drops the message rather than block. Producers claim slots with a
+ * compare and swap on the tail and publish them with a per slot sequence
+ * number, so they never take a lock.
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+
+/* Longer messages are cut. */
+#define INI_LOG_MSG_MAX 1024
+
+typedef struct log_slot_s
+{
+    size_t seq;                 /* == position when free, + 1 when full */
+    int level;
+    char msg[INI_LOG_MSG_MAX];
+} log_slot_t;
+
+typedef struct log_ring_s
+{
+    log_slot_t *slots;
+    size_t mask;
+    size_t head;                /* next to drain, drain thread only */
+    size_t tail;                /* next to claim */
+    size_t dropped;
+    int stop;
+    sem_t ready;
+    pthread_t thread;
+} log_ring_t;
+
+int ini_log_level = INI_LOG_DEBUG;
+
+static ini_log_sink log_sink;
+static void *log_sink_user;
+static log_ring_t *log_ring;
+static size_t log_producers;    /* inside log_push() */
+static pthread_mutex_t log_async_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void ini_log_set_level(int level)
+{
+    __atomic_store_n(&ini_log_level, level, __ATOMIC_RELAXED);
+}
+
+int ini_log_get_level(void)
+{
+    return __atomic_load_n(&ini_log_level, __ATOMIC_RELAXED);
+}
+
+void ini_log_set_sink(ini_log_sink sink, void *user)
+{
+    log_sink = sink;
+    log_sink_user = user;
+}
+
+static void log_write(int level, const char *msg)
+{
+    if (log_sink != NULL)
+        log_sink(log_sink_user, level, msg);
+    else
+        printf("%s\n", msg);
+}
+
+/* Format into a free slot of the ring. Return 0, or -1 if the ring is
+   gone and the caller writes the message itself. */
+static int log_push(int level, const char *format, va_list ap)
+{
+    __atomic_add_fetch(&log_producers, 1, __ATOMIC_SEQ_CST);
+    log_ring_t *ring = __atomic_load_n(&log_ring, __ATOMIC_SEQ_CST);
+    if (ring == NULL) {
+        __atomic_sub_fetch(&log_producers, 1, __ATOMIC_SEQ_CST);
+        return -1;
+    }
+
+    size_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    log_slot_t *slot;
+    for (;;) {
+        slot = &ring->slots[pos & ring->mask];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (seq < pos) {
+            slot = NULL;        /* full */
+            break;
+        } else {
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (slot == NULL) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+    } else {
+        slot->level = level;
+        vsnprintf(slot->msg, sizeof(slot->msg), format, ap);
+        __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+        sem_post(&ring->ready);
+    }
+
+    __atomic_sub_fetch(&log_producers, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+/* Write the published slots in order. A claimed slot not yet published
+   stops the drain until its producer posts. */
+static void log_drain(log_ring_t *ring)
+{
+    for (;;) {
+        log_slot_t *slot = &ring->slots[ring->head & ring->mask];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring->head + 1)
+            break;
+
+        log_write(slot->level, slot->msg);
+        __atomic_store_n(&slot->seq, ring->head + ring->mask + 1, __ATOMIC_RELEASE);
+        ring->head++;
+    }
+}
+
+static void* log_thread(void *arg)
+{
+    log_ring_t *ring = (log_ring_t*)arg;
+    while (!__atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE)) {
+        while (sem_wait(&ring->ready) != 0 && errno == EINTR)
+            ;
+        log_drain(ring);
+    }
+
+    return NULL;
+}
+
+int ini_log_async_start(size_t capacity)
+{
+    size_t size = 16;
+    while (size < capacity)
+        size *= 2;
+
+    pthread_mutex_lock(&log_async_lock);
+    if (log_ring != NULL) {
+        pthread_mutex_unlock(&log_async_lock);
+        return 0;
+    }
+
+    int ret = ENOMEM;
+    log_ring_t *ring = (log_ring_t*)calloc(1, sizeof(log_ring_t));
+    if (ring != NULL)
+        ring->slots = (log_slot_t*)malloc(size * sizeof(log_slot_t));
+    if (ring != NULL && ring->slots != NULL) {
+        ring->mask = size - 1;
+        for (size_t i = 0; i < size; i++)
+            ring->slots[i].seq = i;
+        ret = sem_init(&ring->ready, 0, 0) == 0 ? 0 : errno;
+        if (ret == 0) {
+            ret = pthread_create(&ring->thread, NULL, log_thread, ring);
+            if (ret != 0)
+                sem_destroy(&ring->ready);
+        }
+    }
+
+    if (ret == 0) {
+        __atomic_store_n(&log_ring, ring, __ATOMIC_SEQ_CST);
+    } else if (ring != NULL) {
+        free(ring->slots);
+        free(ring);
+    }
+    pthread_mutex_unlock(&log_async_lock);
+    return ret;
+}
+
+void ini_log_async_stop(void)
+{
+    pthread_mutex_lock(&log_async_lock);
+    log_ring_t *ring = __atomic_exchange_n(&log_ring, NULL, __ATOMIC_SEQ_CST);
+    if (ring == NULL) {
+        pthread_mutex_unlock(&log_async_lock);
+        return;
+    }
+
+    /* New messages are written directly now, wait for the ones in flight. */
+    while (__atomic_load_n(&log_producers, __ATOMIC_SEQ_CST) != 0)
+        sched_yield();
+
+    __atomic_store_n(&ring->stop, 1, __ATOMIC_RELEASE);
+    sem_post(&ring->ready);
+    pthread_join(ring->thread, NULL);
+    log_drain(ring);
+
+    size_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    sem_destroy(&ring->ready);
+    free(ring->slots);
+    free(ring);
+    pthread_mutex_unlock(&log_async_lock);
+
+    if (dropped > 0)
+        ERROR("Dropped %zu log messages, the ring was full", dropped);
+}
+
+void print_log(int level, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    if (__atomic_load_n(&log_ring, __ATOMIC_RELAXED) == NULL || log_push(level, format, ap) != 0) {
+        char msg[INI_LOG_MSG_MAX];
+        vsnprintf(msg, sizeof(msg), format, ap);
+        log_write(level, msg);
+    }
+    va_end(ap);
+}
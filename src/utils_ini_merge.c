@@ -0,0 +1,172 @@
+/**
+ * inih -- parse with repeated sections and keys merged
+ *
+ * Sections and (section, key) pairs are hashed while parsing, so a repeat
+ * anywhere in the file resolves to its node in O(1) instead of adding a
+ * node. Nodes are appended through tail pointers and the tree comes out
+ * in file order.
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+typedef struct merge_arg_s
+{
+    ini_arg_t arg;              /* first, the tree links these */
+    size_t values_capacity;
+} merge_arg_t;
+
+typedef struct merge_section_s
+{
+    ini_section_t section;      /* first, the tree links these */
+    ini_arg_t **args_tail;
+} merge_section_t;
+
+typedef struct merge_build_s
+{
+    ini_arena_t *arena;
+    int policy;
+    const char *buf;
+    ini_section_t *sections;
+    ini_section_t **sections_tail;
+    ini_index_t sections_index;     /* name -> merge_section_t* */
+    ini_index_t args_index;         /* (section, name) -> merge_arg_t* */
+    merge_section_t *section;       /* current */
+    merge_arg_t *arg;               /* last key line of the current section */
+} merge_build_t;
+
+static merge_section_t* merge_section(merge_build_t *build, ini_str_t name, int header)
+{
+    size_t len = name.len < INI_MAX_SECTION - 1 ? name.len : INI_MAX_SECTION - 1;
+    ini_index_slot_t *slot = ini_index_insert(&build->sections_index,
+                                              ini_hash_key(name.ptr, len, NULL, 0),
+                                              name.ptr, len, NULL, 0);
+    if (slot == NULL)
+        return NULL;
+
+    merge_section_t *section = (merge_section_t*)slot->value;
+    if (section != NULL) {
+        if (header && build->policy == INI_MERGE_ERROR) {
+            ERROR("Duplicate section:%.*s", (int)len, name.ptr);
+            return NULL;
+        }
+        return section;
+    }
+
+    section = (merge_section_t*)ini_arena_calloc(build->arena, sizeof(merge_section_t));
+    if (section == NULL)
+        return NULL;
+    ini_copy_name(section->section.data.name, INI_MAX_SECTION, name);
+    section->args_tail = &section->section.data.args;
+    INI_STATS_ADD(INI_STAT_SECTIONS, 1);
+    *build->sections_tail = &section->section;
+    build->sections_tail = &section->section.next;
+
+    /* The key must outlive the slice, point it at the copy. */
+    slot->section = section->section.data.name;
+    slot->value = section;
+    return section;
+}
+
+static merge_arg_t* merge_arg(merge_build_t *build, ini_str_t name)
+{
+    const char *section_name = build->section->section.data.name;
+    size_t section_len = strlen(section_name);
+    size_t len = name.len < INI_MAX_NAME - 1 ? name.len : INI_MAX_NAME - 1;
+    ini_index_slot_t *slot = ini_index_insert(
+        &build->args_index, ini_hash_key(section_name, section_len, name.ptr, len),
+        section_name, section_len, name.ptr, len);
+    if (slot == NULL)
+        return NULL;
+
+    merge_arg_t *arg = (merge_arg_t*)slot->value;
+    if (arg != NULL) {
+        if (build->policy == INI_MERGE_ERROR) {
+            ERROR("Duplicate arg:%.*s in section:%s", (int)len, name.ptr, section_name);
+            return NULL;
+        }
+        if (build->policy == INI_MERGE_LAST_WINS)
+            arg->arg.data.values_number = 0;
+        return arg;
+    }
+
+    arg = (merge_arg_t*)ini_arena_calloc(build->arena, sizeof(merge_arg_t));
+    if (arg == NULL)
+        return NULL;
+    ini_copy_name(arg->arg.data.name, INI_MAX_NAME, name);
+    *build->section->args_tail = &arg->arg;
+    INI_STATS_ADD(INI_STAT_KEYS, 1);
+    build->section->args_tail = &arg->arg.next;
+
+    slot->name = arg->arg.data.name;
+    slot->value = arg;
+    return arg;
+}
+
+/* Every key line is an occurrence of its key, continuation lines add to
+   the occurrence above them. The tokenizer reports both the same way: a
+   continuation is an indented line after a key line of the section. */
+static int merge_build_handler(void *user, ini_str_t section, ini_str_t name,
+                               ini_str_t value, long pos)
+{
+    merge_build_t *build = (merge_build_t*)(user);
+
+    if (name.ptr == NULL || build->section == NULL) {
+        build->section = merge_section(build, section, name.ptr == NULL);
+        build->arg = NULL;
+        if (build->section == NULL)
+            return -1;
+        if (name.ptr == NULL)
+            return 0;
+    }
+
+    if (build->arg == NULL || !ini_isspace(build->buf[pos])) {
+        build->arg = merge_arg(build, name);
+        if (build->arg == NULL)
+            return -1;
+    }
+
+    if (0 != ini_arena_strarray_add(build->arena,
+                                    &build->arg->arg.data.values,
+                                    &build->arg->arg.data.values_number,
+                                    &build->arg->values_capacity,
+                                    value.ptr, value.len))
+    {
+        ERROR("Failed to add value to args. section:%.*s, name:%.*s",
+              (int)section.len, section.ptr, (int)name.len, name.ptr);
+        return -1;
+    }
+
+    return 0;
+}
+
+ini_section_t* ini_parse_merged(const char *filename, ini_arena_t *arena, int policy)
+{
+    void *map;
+    size_t len;
+    if (ini_map_file(filename, &map, &len) != 0 || map == NULL)
+        return NULL;
+
+    merge_build_t build;
+    memset(&build, 0, sizeof(build));
+    build.arena = arena;
+    build.policy = policy;
+    build.buf = (const char*)map;
+    build.sections_tail = &build.sections;
+
+    int ret = -1;
+    if (ini_index_init(&build.sections_index, 0) == 0
+        && ini_index_init(&build.args_index, len / 64) == 0)
+        ret = parse_buffer(build.buf, len, merge_build_handler, &build);
+
+    ini_index_free(&build.sections_index);
+    ini_index_free(&build.args_index);
+    munmap(map, len);
+    return ret == 0 ? build.sections : NULL;
+}
@@ -0,0 +1,241 @@
+/**
+ * inih -- parallel parse of large files
+ *
+ * The mapped file is cut before lines starting with '[', which are always
+ * section headers, so every chunk but the first starts in a known section
+ * and no continuation line crosses a cut. Chunks are parsed into private
+ * arenas by a pool of threads, then the trees are joined in file order,
+ * merging a section split by a cut the way the sequential parser merges
+ * same-name sections that follow each other.
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/* Smaller files, or chunks, are not worth a thread. */
+#ifndef INI_PARALLEL_MIN_CHUNK
+#define INI_PARALLEL_MIN_CHUNK (256 * 1024)
+#endif
+/* Chunks per thread, so a slow chunk doesn't hold the others up. */
+#define INI_PARALLEL_CHUNKS_PER_THREAD 4
+
+typedef struct parallel_chunk_s
+{
+    const char *buf;
+    size_t len;
+    ini_arena_t *arena;
+    ini_section_t *sections;
+    size_t end_pos;             /* < len if the parse stopped early */
+    int ret;
+} parallel_chunk_t;
+
+typedef struct parallel_job_s
+{
+    parallel_chunk_t *chunks;
+    size_t chunks_number;
+    size_t next;                /* next chunk to take */
+} parallel_job_t;
+
+static void* parallel_worker(void *arg)
+{
+    parallel_job_t *job = (parallel_job_t*)arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->chunks_number)
+            break;
+
+        parallel_chunk_t *chunk = &job->chunks[i];
+        chunk->arena = ini_arena_create(0);
+        if (chunk->arena == NULL) {
+            chunk->ret = -1;
+            continue;
+        }
+        chunk->ret = ini_arena_parse_buffer(chunk->arena, chunk->buf, chunk->len,
+                                            &chunk->sections, &chunk->end_pos);
+    }
+
+    return NULL;
+}
+
+/* Cut buf in about chunks_number pieces, each starting at a header line
+   except the first. Return the number of chunks. */
+static size_t parallel_split(const char *buf, size_t len, parallel_chunk_t *chunks,
+                             size_t chunks_number)
+{
+    size_t target = len / chunks_number;
+    size_t begin = 0;
+    size_t n = 0;
+
+    while (begin < len && n < chunks_number - 1) {
+        size_t cut = begin + target;
+        const char *p = buf + (cut < len ? cut : len);
+        for (;;) {
+            p = (const char*)memchr(p, '\n', (size_t)(buf + len - p));
+            if (p == NULL || p + 1 >= buf + len || p[1] == '[')
+                break;
+            p++;
+        }
+        if (p == NULL || p + 1 >= buf + len)
+            break;
+
+        chunks[n].buf = buf + begin;
+        chunks[n].len = (size_t)(p + 1 - buf) - begin;
+        n++;
+        begin = (size_t)(p + 1 - buf);
+    }
+
+    chunks[n].buf = buf + begin;
+    chunks[n].len = len - begin;
+    return n + 1;
+}
+
+/* Append the args of from, the first section of a chunk, to into, the
+   last section before it. The last arg of into and the first of from are
+   one arg if they share a name. Lists are in reverse file order. */
+static int parallel_merge_args(ini_arena_t *arena, ini_section_t *into,
+                               ini_section_t *from)
+{
+    if (from->data.args == NULL)
+        return 0;
+
+    ini_arg_t **first = &from->data.args;
+    while ((*first)->next != NULL)
+        first = &(*first)->next;
+
+    ini_arg_t *last = into->data.args;
+    if (last != NULL && strcmp(last->data.name, (*first)->data.name) == 0) {
+        ini_arg_data_t *data = &(*first)->data;
+        size_t number = last->data.values_number + data->values_number;
+        char **values = (char**)ini_arena_alloc(arena, number * sizeof(char*),
+                                                sizeof(char*));
+        if (values == NULL)
+            return ENOMEM;
+
+        memcpy(values, last->data.values, last->data.values_number * sizeof(char*));
+        memcpy(values + last->data.values_number, data->values,
+               data->values_number * sizeof(char*));
+        last->data.values = values;
+        last->data.values_number = number;
+        *first = last;
+    } else {
+        (*first)->next = last;
+    }
+
+    into->data.args = from->data.args;
+    return 0;
+}
+
+/* Put the tree of a chunk on top of the sections before it. */
+static int parallel_join(ini_arena_t *arena, ini_section_t **sections,
+                         ini_section_t *chunk)
+{
+    if (chunk == NULL)
+        return 0;
+    if (*sections == NULL) {
+        *sections = chunk;
+        return 0;
+    }
+
+    ini_section_t **first = &chunk;
+    while ((*first)->next != NULL)
+        first = &(*first)->next;
+
+    ini_section_t *last = *sections;
+    if (strcmp(last->data.name, (*first)->data.name) == 0) {
+        if (parallel_merge_args(arena, last, *first) != 0)
+            return ENOMEM;
+        *first = last;
+    } else {
+        (*first)->next = last;
+    }
+
+    *sections = chunk;
+    return 0;
+}
+
+static int parallel_parse(const char *filename, ini_arena_t *arena, int threads,
+                          ini_section_t **sections)
+{
+    *sections = NULL;
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+
+    void *map;
+    size_t len;
+    if (ini_map_file(filename, &map, &len) != 0)
+        return -1;
+    if (map == NULL)
+        return 0;
+
+    size_t chunks_number = (size_t)threads * INI_PARALLEL_CHUNKS_PER_THREAD;
+    if (chunks_number > len / INI_PARALLEL_MIN_CHUNK)
+        chunks_number = len / INI_PARALLEL_MIN_CHUNK;
+    if (chunks_number < 1)
+        chunks_number = 1;
+
+    parallel_chunk_t *chunks = (parallel_chunk_t*)calloc(chunks_number,
+                                                         sizeof(parallel_chunk_t));
+    if (chunks == NULL) {
+        munmap(map, len);
+        return -1;
+    }
+
+    parallel_job_t job = { chunks, 0, 0 };
+    job.chunks_number = parallel_split((const char*)map, len, chunks, chunks_number);
+
+    size_t workers_number = (size_t)threads - 1;
+    if (workers_number > job.chunks_number - 1)
+        workers_number = job.chunks_number - 1;
+    pthread_t *workers = (pthread_t*)calloc(workers_number + 1, sizeof(pthread_t));
+    size_t started = 0;
+    while (workers != NULL && started < workers_number
+           && pthread_create(&workers[started], NULL, parallel_worker, &job) == 0)
+        started++;
+
+    /* The calling thread works too, and alone if no thread started. */
+    parallel_worker(&job);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    /* A parse stopped by a malformed line drops everything after it, like
+       the sequential parser does. */
+    int ret = 0;
+    size_t i;
+    for (i = 0; i < job.chunks_number && ret == 0; i++) {
+        parallel_chunk_t *chunk = &chunks[i];
+        ret = chunk->ret;
+        if (ret == 0 && parallel_join(arena, sections, chunk->sections) != 0)
+            ret = -1;
+        if (chunk->arena != NULL)
+            ini_arena_adopt(arena, chunk->arena);
+        chunk->arena = NULL;
+        if (ret == 0 && chunk->end_pos < chunk->len)
+            break;
+    }
+    for (; i < job.chunks_number; i++)
+        ini_arena_destroy(chunks[i].arena);
+
+    if (ret != 0)
+        *sections = NULL;
+    free(chunks);
+    munmap(map, len);
+    return ret;
+}
+
+ini_section_t* ini_parse_parallel(const char *filename, ini_arena_t *arena, int threads)
+{
+    ini_section_t *sections;
+    parallel_parse(filename, arena, threads, &sections);
+    return sections;
+}
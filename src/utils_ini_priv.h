@@ -0,0 +1,348 @@
+/**
+ * inih -- internal declarations shared between the library sources.
+ *
+ * Nothing in here is part of the public API.
+ */
+
+#ifndef INI_PRIV_H
+#define INI_PRIV_H
+
+#include "utils_ini.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#ifndef INI_INLINE_COMMENT_PREFIXES
+#define INI_INLINE_COMMENT_PREFIXES ";"
+#endif
+
+/* Keep library internals out of the exported symbol table. */
+#define INI_LOCAL __attribute__((visibility("hidden")))
+
+#define sfree(ptr)                                                             \
+  do {                                                                         \
+    free(ptr);                                                                 \
+    (ptr) = NULL;                                                              \
+  } while (0)
+
+#define APPED_ITEM(head, item)  \
+    do {                        \
+        item->next = head;  \
+        head = item;        \
+    } while(0)
+
+#define LOG_DBG INI_LOG_DEBUG
+#define LOG_ERR INI_LOG_ERROR
+
+/* Messages below this level compile to nothing. */
+#ifndef INI_LOG_MIN_LEVEL
+#define INI_LOG_MIN_LEVEL LOG_ERR
+#endif
+
+/* The arguments are only evaluated for a message that is written. */
+#define INI_LOG(level, ...)                                                   \
+    do {                                                                      \
+        if ((level) >= INI_LOG_MIN_LEVEL                                      \
+            && (level) >= __atomic_load_n(&ini_log_level, __ATOMIC_RELAXED))  \
+            print_log(level, __VA_ARGS__);                                    \
+    } while (0)
+#define DEBUG(...) INI_LOG(LOG_DBG, __VA_ARGS__)
+#define ERROR(...) INI_LOG(LOG_ERR, __VA_ARGS__)
+
+INI_LOCAL extern int ini_log_level;
+
+/* Statistics, see ini_stats_enable(). Arguments are only evaluated while
+   enabled, a timer started while disabled records nothing. */
+INI_LOCAL extern int ini_stats_enabled;
+INI_LOCAL void ini_stats_count(int stat, uint64_t n);
+INI_LOCAL void ini_stats_record(int timer, uint64_t ns);
+INI_LOCAL uint64_t ini_stats_clock(void);
+
+#define INI_STATS_ON() \
+    __builtin_expect(__atomic_load_n(&ini_stats_enabled, __ATOMIC_RELAXED), 0)
+#define INI_STATS_ADD(stat, n)                                                \
+    do {                                                                      \
+        if (INI_STATS_ON())                                                   \
+            ini_stats_count(stat, n);                                         \
+    } while (0)
+/* One heap allocation of size bytes. */
+#define INI_STATS_ALLOC(size)                                                 \
+    do {                                                                      \
+        if (INI_STATS_ON()) {                                                 \
+            ini_stats_count(INI_STAT_ALLOCS, 1);                              \
+            ini_stats_count(INI_STAT_ALLOC_BYTES, size);                      \
+        }                                                                     \
+    } while (0)
+
+static inline uint64_t ini_stats_start(void)
+{
+    return INI_STATS_ON() ? ini_stats_clock() : 0;
+}
+
+static inline void ini_stats_stop(int timer, uint64_t start)
+{
+    if (start != 0)
+        ini_stats_record(timer, ini_stats_clock() - start);
+}
+void print_log(int level, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+INI_LOCAL int strarray_addn(char ***ret_array, size_t *ret_array_len,
+                            char const *str, size_t len);
+
+typedef int (*HANDLER)(void *user, const char *section,
+                       const char *name, const char *value, long pos);
+
+INI_LOCAL int parse_stream(void *stream, HANDLER handler, void *user);
+INI_LOCAL int parse_buffer(const char *buf, size_t len,
+                           ini_str_handler handler, void *user);
+#define INI_PARSE_HEADERS 0x1
+INI_LOCAL int parse_buffer_ex(const char *buf, size_t len, ini_str_handler handler,
+                              void *user, int flags, size_t *end_pos);
+/* mmap() a whole file read-only; an empty file gives a NULL map. */
+INI_LOCAL int ini_map_file(const char *filename, void **map, size_t *len);
+INI_LOCAL int ini_parse_handler(void *user, const char *section,
+                                const char *name, const char *value,
+                                long pos);
+
+/* isspace() for the C locale, without the function call. */
+static inline int ini_isspace(char c)
+{
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+/* Copy a slice into a fixed size name buffer, truncating like sstrncpy(). */
+static inline void ini_copy_name(char *dest, size_t size, ini_str_t src)
+{
+    size_t len = src.len < size - 1 ? src.len : size - 1;
+    memcpy(dest, src.ptr, len);
+    dest[len] = '\0';
+}
+
+/* Compare a name buffer with a slice truncated to the same size. */
+static inline int ini_name_equals(const char *name, size_t size, ini_str_t str)
+{
+    size_t len = str.len < size - 1 ? str.len : size - 1;
+    return strncmp(name, str.ptr, len) == 0 && name[len] == '\0';
+}
+
+/* Scanning kernels, see utils_ini_scan.c. Both return end if nothing is
+   found. find_chars_or_comment() has the semantics of the tokenizer's
+   find_chars_or_comment(): first char of chars, or first inline comment
+   prefix that follows whitespace. */
+typedef struct ini_scan_ops_s
+{
+    const char *name;
+    const char* (*find_eol)(const char *s, const char *end);
+    const char* (*find_chars_or_comment)(const char *s, const char *end,
+                                         const char *chars);
+} ini_scan_ops_t;
+
+INI_LOCAL extern const ini_scan_ops_t *ini_scan_ops;
+
+/* Arena allocation, see utils_ini_arena.c. */
+INI_LOCAL void* ini_arena_alloc(ini_arena_t *arena, size_t size, size_t align);
+INI_LOCAL void* ini_arena_calloc(ini_arena_t *arena, size_t size);
+INI_LOCAL char* ini_arena_strndup(ini_arena_t *arena, const char *str, size_t len);
+INI_LOCAL int ini_arena_strarray_add(ini_arena_t *arena, char ***ret_array,
+                                     size_t *ret_array_len, size_t *ret_capacity,
+                                     const char *str, size_t len);
+/* Parse a buffer into an arena owned tree; end_pos as for
+   parse_buffer_ex(). */
+INI_LOCAL int ini_arena_parse_buffer(ini_arena_t *arena, const char *buf, size_t len,
+                                     ini_section_t **sections, size_t *end_pos);
+/* Move every block of other into arena and free other. */
+INI_LOCAL void ini_arena_adopt(ini_arena_t *arena, ini_arena_t *other);
+/* ini_parse_arena() that tells an empty file apart from a failure. */
+INI_LOCAL int ini_parse_arena_ex(const char *filename, ini_arena_t *arena,
+                                 ini_section_t **sections);
+
+/* Read the whole file into a malloc()ed buffer. */
+INI_LOCAL int ini_read_file(FILE *file, char **buf, size_t *len);
+/* Open filename for update, creating it if missing, with an exclusive
+   flock() held until fclose(). */
+INI_LOCAL FILE* ini_open_locked(const char *filename);
+/* Replacing a file with a rename: ini_temp_create() opens a temporary
+   file next to name, with the mode of name or, if it doesn't exist, the
+   one open() would give it. ini_temp_commit() syncs and renames it over
+   name, ini_temp_discard() removes it; both free tmp_name. */
+INI_LOCAL FILE* ini_temp_create(const char *name, char **tmp_name);
+INI_LOCAL int ini_temp_commit(FILE *file, char *tmp_name, const char *name);
+INI_LOCAL void ini_temp_discard(FILE *file, char *tmp_name);
+
+/* Transaction internals, see utils_ini_txn.c. ini_txn_plan() positions the
+   queued ops in buf, ini_txn_render() writes buf from offset from with
+   them applied. */
+INI_LOCAL int ini_txn_plan(ini_txn_t *txn, const char *buf, size_t len,
+                           long *first);
+INI_LOCAL int ini_txn_render(ini_txn_t *txn, const char *buf, size_t len,
+                             long from, FILE *file);
+
+/* FNV-1a, 64 bit. Section keys hash the section name; arg keys continue
+   the section hash over a '\0' separator and then the arg name. */
+#define INI_FNV_OFFSET 14695981039346656037ULL
+#define INI_FNV_PRIME  1099511628211ULL
+
+static inline uint64_t ini_fnv1a(uint64_t hash, const char *s, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)s[i];
+        hash *= INI_FNV_PRIME;
+    }
+    return hash;
+}
+
+static inline uint64_t ini_hash_key(const char *section, size_t section_len,
+                                    const char *name, size_t name_len)
+{
+    uint64_t hash = ini_fnv1a(INI_FNV_OFFSET, section, section_len);
+    if (name != NULL) {
+        hash = ini_fnv1a(hash, "", 1);
+        hash = ini_fnv1a(hash, name, name_len);
+    }
+    return hash;
+}
+
+/* Open addressing hash table keyed by (section) or (section, name). */
+typedef struct ini_index_slot_s
+{
+    uint64_t hash;
+    const char *section;  /* NULL marks an empty slot */
+    const char *name;     /* NULL for section keys */
+    uint32_t section_len;
+    uint32_t name_len;
+    void *value;
+    uint64_t content_hash; /* of what value holds, set by the owner */
+    void *cache;           /* malloc()ed by the owner, published with a CAS */
+} ini_index_slot_t;
+
+typedef struct ini_index_s
+{
+    ini_index_slot_t *slots;
+    size_t mask;
+    size_t count;
+} ini_index_t;
+
+INI_LOCAL int ini_index_init(ini_index_t *index, size_t hint);
+INI_LOCAL void ini_index_free(ini_index_t *index);
+/* Return the slot for the key, inserting an empty-valued one if missing.
+   NULL on allocation failure. */
+INI_LOCAL ini_index_slot_t* ini_index_insert(ini_index_t *index, uint64_t hash,
+                                             const char *section, size_t section_len,
+                                             const char *name, size_t name_len);
+INI_LOCAL void* ini_index_find(const ini_index_t *index, uint64_t hash,
+                               const char *section, size_t section_len,
+                               const char *name, size_t name_len);
+INI_LOCAL ini_index_slot_t* ini_index_find_slot(const ini_index_t *index, uint64_t hash,
+                                                const char *section, size_t section_len,
+                                                const char *name, size_t name_len);
+
+/* Indexed handle, see ini_open(). The content hash of a section slot
+   covers the args seen through it, the one of an arg slot its values. */
+struct ini_s
+{
+    ini_arena_t *arena;           /* owns the whole tree */
+    ini_section_t *sections;
+    ini_index_t sections_index;   /* section name -> ini_section_t* */
+    ini_index_t args_index;       /* (section, arg name) -> ini_arg_t* */
+    int refs;
+
+    /* INI_OPEN_LAZY: bodies are parsed from the mapping on first access,
+       under lock until complete is set. */
+    int flags;
+    void *map;
+    size_t map_len;
+    pthread_mutex_t lock;
+    int complete;
+    int caches;                   /* some arg slot has a cache */
+};
+
+/* Parse whatever a lazy handle has not parsed yet and hash its contents. */
+INI_LOCAL int ini_load_all(ini_t *ini);
+/* Eager handle of a buffer, which can go once it returns. */
+INI_LOCAL ini_t* ini_open_buffer(const char *buf, size_t len);
+/* Cache of an arg of a handle, built by build() on first use and kept
+   until ini_close(). Return 0 with *cache set, ENOENT if there is no such
+   arg or ENOMEM. */
+typedef void* (*ini_cache_builder)(const ini_arg_data_t *arg);
+INI_LOCAL int ini_arg_cache(const ini_t *ini, const char *section_name,
+                            const char *arg_name, ini_cache_builder build,
+                            const void **cache);
+
+/* Binary image, see ini_compile(). Every offset is relative to the start
+   of the image and every table is 8 byte aligned, so an image can be used
+   wherever it is mapped. Strings are NUL terminated and shared. */
+#define INI_IMAGE_MAGIC   0x474d4949u   /* "IIMG" */
+#define INI_IMAGE_VERSION 1
+
+typedef struct ini_image_header_s
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t image_size;
+    uint64_t source_size;       /* of the .ini the image was built from */
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    uint64_t payload_checksum;  /* FNV-1a of the bytes after the header */
+    uint32_t sections_number;
+    uint32_t args_number;
+    uint32_t values_number;
+    uint32_t section_buckets_number;   /* powers of two */
+    uint32_t arg_buckets_number;
+    uint32_t sections_offset;
+    uint32_t args_offset;
+    uint32_t values_offset;
+    uint32_t section_buckets_offset;
+    uint32_t arg_buckets_offset;
+    uint32_t strings_offset;
+    uint32_t strings_size;
+    uint64_t header_checksum;   /* FNV-1a of the header up to here */
+} ini_image_header_t;
+
+typedef struct ini_image_str_s
+{
+    uint32_t offset;            /* into the string table */
+    uint32_t len;
+} ini_image_str_t;
+
+/* One per section of the file, merged like the parser merges them. */
+struct ini_image_section_s
+{
+    uint64_t hash;              /* ini_hash_key(name) */
+    ini_image_str_t name;
+    uint32_t first_arg;
+    uint32_t args_number;
+};
+
+struct ini_image_arg_s
+{
+    uint64_t hash;              /* ini_hash_key(section name, name) */
+    ini_image_str_t name;
+    uint32_t section;
+    uint32_t first_value;
+    uint32_t values_number;
+    uint32_t reserved;
+};
+
+/* Buckets hold a record index + 1, 0 is empty. The section directory maps
+   a name to its first section, the arg directory a (section name, name)
+   pair to its first arg, as ini_get_section()/ini_get_arg() resolve. */
+
+struct ini_image_s
+{
+    const char *base;
+    size_t size;
+    int from_file;              /* base is a mapping of an image file */
+    void *owned;                /* malloc()ed image, or NULL */
+};
+
+/* Build an image of a handle in a malloc()ed buffer; source may be NULL. */
+INI_LOCAL int ini_image_build(ini_t *ini, const struct stat *source,
+                              char **buf, size_t *len);
+/* Point image at size bytes of base after checking the header, and the
+   payload checksum too if verify is set. */
+INI_LOCAL int ini_image_attach(ini_image_t *image, const void *base, size_t size,
+                               int verify);
+
+#endif /* INI_PRIV_H */
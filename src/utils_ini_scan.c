@@ -0,0 +1,251 @@
+/**
+ * inih -- line and delimiter scanning kernels
+ *
+ * The tokenizer spends its time looking for the end of a line and for the
+ * first delimiter or whitespace prefixed inline comment on it. These are
+ * done 16 (SSE2) or 32 (AVX2) bytes at a time when the CPU supports it,
+ * the kernel is picked once at load time and can be overridden with
+ * ini_scan_select().
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define INI_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/* Vector kernels handle delimiter and comment prefix sets up to this size,
+   larger sets go through the scalar kernel. */
+#define INI_SCAN_MAX_CHARS 4
+
+static inline int is_comment_prefix(char c)
+{
+    return c != '\0' && strchr(INI_INLINE_COMMENT_PREFIXES, c) != NULL;
+}
+
+static inline int is_wanted(const char *chars, char c)
+{
+    return chars != NULL && c != '\0' && strchr(chars, c) != NULL;
+}
+
+/* Byte by byte scan, also used for the tails of the vector kernels.
+   was_space tells whether the byte before s was whitespace. */
+static const char* scan_tail(const char *s, const char *end,
+                             const char *chars, int was_space)
+{
+    while (s < end && !is_wanted(chars, *s) &&
+           !(was_space && is_comment_prefix(*s))) {
+        was_space = ini_isspace(*s);
+        s++;
+    }
+
+    return s;
+}
+
+static const char* scalar_find_eol(const char *s, const char *end)
+{
+    const char *eol = (const char*)memchr(s, '\n', (size_t)(end - s));
+    return eol != NULL ? eol : end;
+}
+
+static const char* scalar_find_chars_or_comment(const char *s, const char *end,
+                                                const char *chars)
+{
+    return scan_tail(s, end, chars, 0);
+}
+
+#ifdef INI_SCAN_X86
+
+static inline int set_size(const char *chars)
+{
+    return chars != NULL ? (int)strlen(chars) : 0;
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sse2_space_mask(__m128i v)
+{
+    /* ' ' or '\t' .. '\r', bytes >= 0x80 are negative and never match */
+    __m128i ctrl = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(8)),
+                                 _mm_cmplt_epi8(v, _mm_set1_epi8(14)));
+    return _mm_or_si128(ctrl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+__attribute__((target("sse2")))
+static const char* sse2_find_eol(const char *s, const char *end)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; s + 16 <= end; s += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)s);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask)
+            return s + __builtin_ctz(mask);
+    }
+
+    while (s < end && *s != '\n')
+        s++;
+    return s;
+}
+
+/* carry is 1 if the byte before s was whitespace */
+__attribute__((target("sse2")))
+static const char* sse2_scan(const char *s, const char *end,
+                             const char *chars, unsigned carry)
+{
+    const char *comments = INI_INLINE_COMMENT_PREFIXES;
+    int nchars = set_size(chars);
+    int ncomments = set_size(comments);
+    if (nchars > INI_SCAN_MAX_CHARS || ncomments > INI_SCAN_MAX_CHARS)
+        return scan_tail(s, end, chars, (int)carry);
+
+    __m128i want[INI_SCAN_MAX_CHARS];
+    __m128i comment[INI_SCAN_MAX_CHARS];
+    for (int i = 0; i < nchars; i++)
+        want[i] = _mm_set1_epi8(chars[i]);
+    for (int i = 0; i < ncomments; i++)
+        comment[i] = _mm_set1_epi8(comments[i]);
+
+    for (; s + 16 <= end; s += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)s);
+        __m128i hit = _mm_setzero_si128();
+        __m128i cm = _mm_setzero_si128();
+        for (int i = 0; i < nchars; i++)
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, want[i]));
+        for (int i = 0; i < ncomments; i++)
+            cm = _mm_or_si128(cm, _mm_cmpeq_epi8(v, comment[i]));
+
+        unsigned space = (unsigned)_mm_movemask_epi8(sse2_space_mask(v));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit)
+                      | ((unsigned)_mm_movemask_epi8(cm) & ((space << 1) | carry));
+        if (mask)
+            return s + __builtin_ctz(mask);
+        carry = (space >> 15) & 1;
+    }
+
+    return scan_tail(s, end, chars, (int)carry);
+}
+
+__attribute__((target("sse2")))
+static const char* sse2_find_chars_or_comment(const char *s, const char *end,
+                                              const char *chars)
+{
+    return sse2_scan(s, end, chars, 0);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_space_mask(__m256i v)
+{
+    __m256i ctrl = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(8)),
+                                    _mm256_cmpgt_epi8(_mm256_set1_epi8(14), v));
+    return _mm256_or_si256(ctrl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+}
+
+__attribute__((target("avx2")))
+static const char* avx2_find_eol(const char *s, const char *end)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    for (; s + 32 <= end; s += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)s);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (mask)
+            return s + __builtin_ctz(mask);
+    }
+
+    return sse2_find_eol(s, end);
+}
+
+__attribute__((target("avx2")))
+static const char* avx2_find_chars_or_comment(const char *s, const char *end,
+                                              const char *chars)
+{
+    const char *comments = INI_INLINE_COMMENT_PREFIXES;
+    int nchars = set_size(chars);
+    int ncomments = set_size(comments);
+    if (s + 32 > end || nchars > INI_SCAN_MAX_CHARS || ncomments > INI_SCAN_MAX_CHARS)
+        return sse2_scan(s, end, chars, 0);
+
+    __m256i want[INI_SCAN_MAX_CHARS];
+    __m256i comment[INI_SCAN_MAX_CHARS];
+    for (int i = 0; i < nchars; i++)
+        want[i] = _mm256_set1_epi8(chars[i]);
+    for (int i = 0; i < ncomments; i++)
+        comment[i] = _mm256_set1_epi8(comments[i]);
+
+    uint32_t carry = 0;
+    for (; s + 32 <= end; s += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)s);
+        __m256i hit = _mm256_setzero_si256();
+        __m256i cm = _mm256_setzero_si256();
+        for (int i = 0; i < nchars; i++)
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, want[i]));
+        for (int i = 0; i < ncomments; i++)
+            cm = _mm256_or_si256(cm, _mm256_cmpeq_epi8(v, comment[i]));
+
+        uint32_t space = (uint32_t)_mm256_movemask_epi8(avx2_space_mask(v));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit)
+                      | ((uint32_t)_mm256_movemask_epi8(cm) & ((space << 1) | carry));
+        if (mask)
+            return s + __builtin_ctz(mask);
+        carry = space >> 31;
+    }
+
+    /* Finish with 16 byte steps, short lines never fill 32 */
+    return sse2_scan(s, end, chars, carry);
+}
+
+#endif /* INI_SCAN_X86 */
+
+static const ini_scan_ops_t scan_impls[] = {
+#ifdef INI_SCAN_X86
+    { "avx2", avx2_find_eol, avx2_find_chars_or_comment },
+    { "sse2", sse2_find_eol, sse2_find_chars_or_comment },
+#endif
+    { "scalar", scalar_find_eol, scalar_find_chars_or_comment },
+};
+
+#define SCAN_IMPLS_NUMBER (sizeof(scan_impls) / sizeof(scan_impls[0]))
+
+const ini_scan_ops_t *ini_scan_ops = &scan_impls[SCAN_IMPLS_NUMBER - 1];
+
+static int scan_impl_supported(const ini_scan_ops_t *ops)
+{
+#ifdef INI_SCAN_X86
+    __builtin_cpu_init();
+    if (strcmp(ops->name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (strcmp(ops->name, "sse2") == 0)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return 1;
+}
+
+int ini_scan_select(const char *name)
+{
+    for (size_t i = 0; i < SCAN_IMPLS_NUMBER; i++) {
+        const ini_scan_ops_t *ops = &scan_impls[i];
+        if (name != NULL && strcmp(name, ops->name) != 0)
+            continue;
+        if (!scan_impl_supported(ops))
+            continue;
+
+        ini_scan_ops = ops;
+        return 0;
+    }
+
+    return -1;
+}
+
+const char* ini_scan_impl(void)
+{
+    return ini_scan_ops->name;
+}
+
+__attribute__((constructor))
+static void scan_init(void)
+{
+    ini_scan_select(NULL);
+}
@@ -0,0 +1,286 @@
+/**
+ * inih -- config publication over POSIX shared memory
+ *
+ * The control object "name" holds the current generation. Every publish
+ * writes a new image object "name.<generation>", then advances the
+ * generation with a compare and swap and unlinks the replaced object.
+ * Readers that still map it keep their pages until they refresh.
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INI_SHM_MAGIC 0x4d484949u   /* "IIHM" */
+
+typedef struct ini_shm_control_s
+{
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t generation;        /* 0 until the first publish */
+} ini_shm_control_t;
+
+struct ini_shm_s
+{
+    char *name;
+    ini_shm_control_t *control;
+    uint64_t generation;
+    ini_image_t image;          /* base is a mapping of name.<generation> */
+};
+
+static int shm_image_name(char *buf, size_t size, const char *name, uint64_t generation)
+{
+    int len = snprintf(buf, size, "%s.%llu", name, (unsigned long long)generation);
+    return len > 0 && (size_t)len < size ? 0 : ENAMETOOLONG;
+}
+
+/* Publishers map the control object writable and create it if missing,
+   readers map it read only. */
+static ini_shm_control_t* shm_map_control(const char *name, int create)
+{
+    int fd = shm_open(name, create ? O_CREAT | O_RDWR : O_RDONLY, 0644);
+    if (fd == -1) {
+        ERROR("Failed to open shm:%s. errno:%d", name, errno);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (st.st_size < (off_t)sizeof(ini_shm_control_t)
+        && (!create || ftruncate(fd, sizeof(ini_shm_control_t)) != 0))) {
+        ERROR("Invalid shm:%s. errno:%d", name, errno);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, sizeof(ini_shm_control_t),
+                     create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        ERROR("Failed to mmap shm:%s. errno:%d", name, errno);
+        return NULL;
+    }
+
+    ini_shm_control_t *control = (ini_shm_control_t*)map;
+    if (create) {
+        uint32_t magic = 0;
+        __atomic_compare_exchange_n(&control->magic, &magic, INI_SHM_MAGIC, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+    if (__atomic_load_n(&control->magic, __ATOMIC_ACQUIRE) != INI_SHM_MAGIC) {
+        ERROR("Not an ini shm:%s", name);
+        munmap(map, sizeof(ini_shm_control_t));
+        return NULL;
+    }
+
+    return control;
+}
+
+/* Create name.<generation> holding the image, EEXIST if another publisher
+   took that generation. */
+static int shm_write_image(const char *name, uint64_t generation,
+                           const char *buf, size_t len)
+{
+    char image_name[256];
+    int ret = shm_image_name(image_name, sizeof(image_name), name, generation);
+    if (ret != 0)
+        return ret;
+
+    int fd = shm_open(image_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd == -1)
+        return errno;
+
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = write(fd, buf + written, len - written);
+        if (n <= 0 && errno != EINTR)
+            break;
+        if (n > 0)
+            written += (size_t)n;
+    }
+    ret = written == len ? 0 : errno ? errno : EIO;
+    close(fd);
+    if (ret != 0)
+        shm_unlink(image_name);
+    return ret;
+}
+
+int ini_shm_publish(const char *name, const char *filename)
+{
+    ini_t *ini = ini_open(filename);
+    if (ini == NULL)
+        return -1;
+
+    char *buf = NULL;
+    size_t len = 0;
+    int ret = ini_image_build(ini, NULL, &buf, &len);
+    ini_close(ini);
+    if (ret != 0)
+        return -1;
+
+    ini_shm_control_t *control = shm_map_control(name, 1);
+    if (control == NULL) {
+        free(buf);
+        return -1;
+    }
+
+    /* Concurrent publishers race for the swap, the loser retries on top of
+       the winner. A generation already taken, by a publisher in progress or
+       one that died before its swap, is skipped. */
+    uint64_t old = __atomic_load_n(&control->generation, __ATOMIC_ACQUIRE);
+    uint64_t generation = old + 1;
+    for (;;) {
+        ret = shm_write_image(name, generation, buf, len);
+        if (ret == EEXIST) {
+            generation++;
+            continue;
+        }
+        if (ret != 0)
+            break;
+
+        if (__atomic_compare_exchange_n(&control->generation, &old, generation, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE))
+            break;
+
+        char image_name[256];
+        shm_image_name(image_name, sizeof(image_name), name, generation);
+        shm_unlink(image_name);
+        generation = old + 1;
+    }
+
+    if (ret == 0 && old != 0) {
+        char image_name[256];
+        shm_image_name(image_name, sizeof(image_name), name, old);
+        shm_unlink(image_name);
+    }
+    if (ret != 0)
+        ERROR("Failed to publish shm:%s. ret:%d", name, ret);
+
+    munmap(control, sizeof(ini_shm_control_t));
+    free(buf);
+    return ret == 0 ? 0 : -1;
+}
+
+int ini_shm_unlink(const char *name)
+{
+    ini_shm_control_t *control = shm_map_control(name, 0);
+    if (control == NULL)
+        return -1;
+
+    char image_name[256];
+    uint64_t generation = __atomic_load_n(&control->generation, __ATOMIC_ACQUIRE);
+    if (generation != 0
+        && shm_image_name(image_name, sizeof(image_name), name, generation) == 0)
+        shm_unlink(image_name);
+    munmap(control, sizeof(ini_shm_control_t));
+    return shm_unlink(name) == 0 ? 0 : -1;
+}
+
+/* Map the image of generation read only. ENOENT if a publisher replaced
+   and unlinked it since the generation was read. */
+static int shm_map_image(ini_shm_t *shm, uint64_t generation, ini_image_t *image)
+{
+    char image_name[256];
+    int ret = shm_image_name(image_name, sizeof(image_name), shm->name, generation);
+    if (ret != 0)
+        return ret;
+
+    int fd = shm_open(image_name, O_RDONLY, 0);
+    if (fd == -1)
+        return errno;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return EINVAL;
+
+    if (ini_image_attach(image, map, (size_t)st.st_size, 0) != 0) {
+        ERROR("Invalid image in shm:%s", image_name);
+        munmap(map, (size_t)st.st_size);
+        return EINVAL;
+    }
+
+    image->from_file = 1;
+    return 0;
+}
+
+int ini_shm_refresh(ini_shm_t *shm)
+{
+    uint64_t generation = __atomic_load_n(&shm->control->generation, __ATOMIC_ACQUIRE);
+    if (generation == shm->generation)
+        return 0;
+
+    ini_image_t image;
+    memset(&image, 0, sizeof(image));
+    for (;;) {
+        if (generation == 0)
+            return -1;
+
+        int ret = shm_map_image(shm, generation, &image);
+        if (ret == 0)
+            break;
+
+        uint64_t current = __atomic_load_n(&shm->control->generation, __ATOMIC_ACQUIRE);
+        if (ret != ENOENT || current == generation) {
+            ERROR("Failed to map shm:%s generation:%llu. ret:%d", shm->name,
+                  (unsigned long long)generation, ret);
+            return -1;
+        }
+        generation = current;
+    }
+
+    if (shm->image.base != NULL)
+        munmap((void*)shm->image.base, shm->image.size);
+    shm->image = image;
+    shm->generation = generation;
+    return 1;
+}
+
+ini_shm_t* ini_shm_attach(const char *name)
+{
+    ini_shm_t *shm = (ini_shm_t*)calloc(1, sizeof(ini_shm_t));
+    if (shm == NULL)
+        return NULL;
+
+    shm->name = strdup(name);
+    if (shm->name == NULL || (shm->control = shm_map_control(name, 0)) == NULL
+        || ini_shm_refresh(shm) != 1) {
+        ini_shm_detach(shm);
+        return NULL;
+    }
+
+    return shm;
+}
+
+void ini_shm_detach(ini_shm_t *shm)
+{
+    if (shm == NULL)
+        return;
+
+    if (shm->image.base != NULL)
+        munmap((void*)shm->image.base, shm->image.size);
+    if (shm->control != NULL)
+        munmap(shm->control, sizeof(ini_shm_control_t));
+    sfree(shm->name);
+    free(shm);
+}
+
+const ini_image_t* ini_shm_image(const ini_shm_t *shm)
+{
+    return &shm->image;
+}
+
+uint64_t ini_shm_generation(const ini_shm_t *shm)
+{
+    return shm->generation;
+}
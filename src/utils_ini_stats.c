@@ -0,0 +1,124 @@
+/**
+ * inih -- parse and lookup statistics
+ *
+ * Counters and histograms are process wide and updated with relaxed
+ * atomics, only while enabled: disabled, the instrumented paths cost a
+ * predictable branch. Histogram bucket i counts the latencies of
+ * [2^i, 2^(i+1)) nanoseconds, the last one everything longer.
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const char *stat_names[INI_STAT_NUMBER] = {
+    "ini_bytes_scanned_total",
+    "ini_lines_scanned_total",
+    "ini_sections_created_total",
+    "ini_keys_created_total",
+    "ini_values_created_total",
+    "ini_allocations_total",
+    "ini_allocated_bytes_total",
+    "ini_early_stops_total",
+};
+
+static const char *timer_names[INI_TIMER_NUMBER] = {
+    "ini_parse_seconds",
+    "ini_lookup_seconds",
+    "ini_add_arg_tokenize_seconds",
+    "ini_add_arg_build_seconds",
+    "ini_add_arg_write_seconds",
+};
+
+int ini_stats_enabled;
+
+static ini_stats_t stats;
+
+void ini_stats_enable(int enable)
+{
+    __atomic_store_n(&ini_stats_enabled, enable != 0, __ATOMIC_RELAXED);
+}
+
+void ini_stats_count(int stat, uint64_t n)
+{
+    __atomic_add_fetch(&stats.counters[stat], n, __ATOMIC_RELAXED);
+}
+
+uint64_t ini_stats_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void ini_stats_record(int timer, uint64_t ns)
+{
+    ini_histogram_t *histogram = &stats.timers[timer];
+    int bucket = ns > 1 ? 63 - __builtin_clzll(ns) : 0;
+    if (bucket >= INI_STATS_BUCKETS)
+        bucket = INI_STATS_BUCKETS - 1;
+
+    __atomic_add_fetch(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->sum_ns, ns, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&histogram->max_ns, &max, ns, 1,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static uint64_t stats_take(uint64_t *value, int reset)
+{
+    return reset ? __atomic_exchange_n(value, 0, __ATOMIC_RELAXED)
+                 : __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+void ini_stats_snapshot(ini_stats_t *snapshot, int reset)
+{
+    for (int i = 0; i < INI_STAT_NUMBER; i++)
+        snapshot->counters[i] = stats_take(&stats.counters[i], reset);
+
+    for (int i = 0; i < INI_TIMER_NUMBER; i++) {
+        ini_histogram_t *from = &stats.timers[i];
+        ini_histogram_t *to = &snapshot->timers[i];
+        to->count = stats_take(&from->count, reset);
+        to->sum_ns = stats_take(&from->sum_ns, reset);
+        to->max_ns = stats_take(&from->max_ns, reset);
+        for (int b = 0; b < INI_STATS_BUCKETS; b++)
+            to->buckets[b] = stats_take(&from->buckets[b], reset);
+    }
+}
+
+int ini_stats_dump(FILE *file)
+{
+    ini_stats_t snapshot;
+    ini_stats_snapshot(&snapshot, 0);
+
+    for (int i = 0; i < INI_STAT_NUMBER; i++)
+        fprintf(file, "# TYPE %s counter\n%s %llu\n", stat_names[i], stat_names[i],
+                (unsigned long long)snapshot.counters[i]);
+
+    for (int i = 0; i < INI_TIMER_NUMBER; i++) {
+        const ini_histogram_t *histogram = &snapshot.timers[i];
+        const char *name = timer_names[i];
+        uint64_t cumulative = 0;
+
+        fprintf(file, "# TYPE %s histogram\n", name);
+        for (int b = 0; b < INI_STATS_BUCKETS - 1; b++) {
+            cumulative += histogram->buckets[b];
+            fprintf(file, "%s_bucket{le=\"%.9g\"} %llu\n", name,
+                    (double)(2ULL << b) / 1e9, (unsigned long long)cumulative);
+        }
+        fprintf(file, "%s_bucket{le=\"+Inf\"} %llu\n", name,
+                (unsigned long long)histogram->count);
+        fprintf(file, "%s_sum %.9f\n%s_count %llu\n", name, histogram->sum_ns / 1e9,
+                name, (unsigned long long)histogram->count);
+    }
+
+    return ferror(file) ? -1 : 0;
+}
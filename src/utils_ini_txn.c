@@ -0,0 +1,518 @@
+/**
+ * inih -- batched add_arg() transactions
+ *
+ * Operations are queued in memory. On commit the file is parsed once to
+ * find the position of every queued arg, with the same rules add_arg()
+ * uses for a single arg, and everything from the first change to the end
+ * is rewritten in one sequential pass followed by one fsync().
+ *
+ * add_arg_ex() with INI_ADD_COALESCE combines concurrent callers: the
+ * first one to find no rewrite of the file in progress takes everything
+ * queued for it and commits it as one transaction, the others wait for a
+ * writer to report their result.
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+typedef struct txn_op_s txn_op_t;
+struct txn_op_s
+{
+    char section_name[INI_MAX_SECTION];
+    ini_arg_data_t arg;
+    size_t seq;                 /* queue order of the first add */
+    long section_pos;
+    long arg_bpos;
+    long arg_epos;
+    txn_op_t *next_in_section;
+};
+
+struct ini_txn_s
+{
+    char *filename;
+    ini_arena_t *arena;
+    txn_op_t **ops;
+    size_t ops_number;
+    size_t ops_capacity;
+    ini_index_t sections_index;   /* section name -> first txn_op_t */
+    ini_index_t args_index;       /* (section, arg name) -> txn_op_t */
+};
+
+ini_txn_t* ini_txn_begin(const char *filename)
+{
+    ini_txn_t *txn = (ini_txn_t*)calloc(1, sizeof(ini_txn_t));
+    if (txn == NULL)
+        return NULL;
+
+    txn->filename = strdup(filename);
+    txn->arena = ini_arena_create(0);
+    if (txn->filename == NULL || txn->arena == NULL
+        || ini_index_init(&txn->sections_index, 8) != 0
+        || ini_index_init(&txn->args_index, 16) != 0) {
+        ini_txn_abort(txn);
+        return NULL;
+    }
+
+    return txn;
+}
+
+void ini_txn_abort(ini_txn_t *txn)
+{
+    if (txn == NULL)
+        return;
+
+    ini_index_free(&txn->sections_index);
+    ini_index_free(&txn->args_index);
+    ini_arena_destroy(txn->arena);
+    free(txn->ops);
+    free(txn->filename);
+    free(txn);
+}
+
+size_t ini_txn_size(const ini_txn_t *txn)
+{
+    return txn->ops_number;
+}
+
+/* Adding the same arg twice keeps the place of the first add and the
+   values of the last one, which is what two add_arg() calls leave. */
+int ini_txn_add_arg(ini_txn_t *txn, const char *section_name,
+                    const ini_arg_data_t *arg_data)
+{
+    char section[INI_MAX_SECTION];
+    char name[INI_MAX_NAME];
+    ini_str_t section_str = { section_name, strlen(section_name) };
+    ini_str_t name_str = { arg_data->name, strlen(arg_data->name) };
+    ini_copy_name(section, sizeof(section), section_str);
+    ini_copy_name(name, sizeof(name), name_str);
+    size_t section_len = strlen(section);
+    size_t name_len = strlen(name);
+
+    txn_op_t *op = (txn_op_t*)ini_index_find(
+        &txn->args_index, ini_hash_key(section, section_len, name, name_len),
+        section, section_len, name, name_len);
+    if (op == NULL) {
+        if (txn->ops_number == txn->ops_capacity) {
+            size_t capacity = txn->ops_capacity ? txn->ops_capacity * 2 : 16;
+            txn_op_t **ops = (txn_op_t**)realloc(txn->ops, capacity * sizeof(*ops));
+            if (ops == NULL)
+                return ENOMEM;
+            txn->ops = ops;
+            txn->ops_capacity = capacity;
+        }
+
+        op = (txn_op_t*)ini_arena_calloc(txn->arena, sizeof(txn_op_t));
+        if (op == NULL)
+            return ENOMEM;
+        memcpy(op->section_name, section, section_len + 1);
+        memcpy(op->arg.name, name, name_len + 1);
+        op->seq = txn->ops_number;
+
+        ini_index_slot_t *slot = ini_index_insert(
+            &txn->args_index, ini_hash_key(section, section_len, name, name_len),
+            op->section_name, section_len, op->arg.name, name_len);
+        if (slot == NULL)
+            return ENOMEM;
+        slot->value = op;
+
+        slot = ini_index_insert(&txn->sections_index,
+                                ini_hash_key(section, section_len, NULL, 0),
+                                op->section_name, section_len, NULL, 0);
+        if (slot == NULL)
+            return ENOMEM;
+        if (slot->value == NULL) {
+            slot->value = op;
+        } else {
+            txn_op_t *tail = (txn_op_t*)slot->value;
+            while (tail->next_in_section != NULL)
+                tail = tail->next_in_section;
+            tail->next_in_section = op;
+        }
+
+        txn->ops[txn->ops_number++] = op;
+    }
+
+    char **values = NULL;
+    if (arg_data->values_number) {
+        values = (char**)ini_arena_alloc(txn->arena,
+                                         arg_data->values_number * sizeof(char*),
+                                         sizeof(char*));
+        if (values == NULL)
+            return ENOMEM;
+    }
+    for (size_t i = 0; i < arg_data->values_number; i++) {
+        values[i] = ini_arena_strndup(txn->arena, arg_data->values[i],
+                                      strlen(arg_data->values[i]));
+        if (values[i] == NULL)
+            return ENOMEM;
+    }
+    op->arg.values = values;
+    op->arg.values_number = arg_data->values_number;
+
+    return 0;
+}
+
+typedef struct txn_plan_s
+{
+    ini_txn_t *txn;
+    ini_str_t section;          /* section of the previous event */
+    txn_op_t *section_ops;      /* ops of the current section, if active */
+    txn_op_t *running;          /* op whose arg the previous event belonged to */
+} txn_plan_t;
+
+/* Leaving a section ends its run and places the args it does not have at
+   pos, like add_arg_handler() does for one arg. */
+static void plan_end_section(txn_plan_t *plan, long pos)
+{
+    if (plan->running != NULL) {
+        plan->running->arg_epos = pos;
+        plan->running = NULL;
+    }
+
+    for (txn_op_t *op = plan->section_ops; op != NULL; op = op->next_in_section) {
+        if (op->arg_bpos == -1)
+            op->arg_bpos = op->arg_epos = pos;
+    }
+    plan->section_ops = NULL;
+}
+
+static int txn_plan_handler(void *user, ini_str_t section, ini_str_t name,
+                            ini_str_t __attribute__((unused)) value, long pos)
+{
+    txn_plan_t *plan = (txn_plan_t*)(user);
+    ini_txn_t *txn = plan->txn;
+
+    char section_name[INI_MAX_SECTION];
+    ini_copy_name(section_name, sizeof(section_name), section);
+    size_t section_len = strlen(section_name);
+
+    if (plan->section.ptr == NULL
+        || !ini_name_equals(section_name, sizeof(section_name), plan->section))
+    {
+        plan_end_section(plan, pos);
+        plan->section = section;
+
+        /* Only the first occurrence of a section is considered */
+        txn_op_t *ops = (txn_op_t*)ini_index_find(
+            &txn->sections_index, ini_hash_key(section_name, section_len, NULL, 0),
+            section_name, section_len, NULL, 0);
+        if (ops != NULL && ops->section_pos == -1) {
+            for (txn_op_t *op = ops; op != NULL; op = op->next_in_section)
+                op->section_pos = pos;
+            plan->section_ops = ops;
+        }
+    }
+
+    if (name.ptr == NULL || plan->section_ops == NULL)
+        return 0;
+
+    char arg_name[INI_MAX_NAME];
+    ini_copy_name(arg_name, sizeof(arg_name), name);
+    if (plan->running != NULL
+        && strcmp(plan->running->arg.name, arg_name) != 0) {
+        plan->running->arg_epos = pos;
+        plan->running = NULL;
+    }
+
+    size_t name_len = strlen(arg_name);
+    txn_op_t *op = (txn_op_t*)ini_index_find(
+        &txn->args_index, ini_hash_key(section_name, section_len, arg_name, name_len),
+        section_name, section_len, arg_name, name_len);
+    if (op != NULL && op->arg_bpos == -1) {
+        op->arg_bpos = pos;
+        plan->running = op;
+    }
+
+    return 0;
+}
+
+/* The layout write_arg() produces. An arg without values still gets its
+   newline, so it can't swallow the line after it. */
+static void write_arg_text(FILE *file, const ini_arg_data_t *arg_data)
+{
+    fprintf(file, "%s = ", arg_data->name);
+    for (size_t i = 0; i < arg_data->values_number; ++i)
+        fprintf(file, "    %s\n", arg_data->values[i]);
+    if (arg_data->values_number == 0)
+        fputc('\n', file);
+}
+
+/* In-place edits go in file order; edits at the same position keep the
+   queue order, and go before args of sections that don't exist yet. */
+static int op_compare(const void *a, const void *b)
+{
+    const txn_op_t *x = *(const txn_op_t* const*)a;
+    const txn_op_t *y = *(const txn_op_t* const*)b;
+    int x_new = x->section_pos == -1;
+    int y_new = y->section_pos == -1;
+
+    if (x_new != y_new)
+        return x_new - y_new;
+    if (!x_new && x->arg_bpos != y->arg_bpos)
+        return x->arg_bpos < y->arg_bpos ? -1 : 1;
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+/* Position edits for buf, sort them and return the offset of the first
+   byte that changes. */
+int ini_txn_plan(ini_txn_t *txn, const char *buf, size_t len, long *first)
+{
+    for (size_t i = 0; i < txn->ops_number; i++) {
+        txn_op_t *op = txn->ops[i];
+        op->section_pos = op->arg_bpos = op->arg_epos = -1;
+    }
+
+    txn_plan_t plan;
+    memset(&plan, 0, sizeof(plan));
+    plan.txn = txn;
+    if (parse_buffer(buf, len, txn_plan_handler, &plan) < 0)
+        return -1;
+    plan_end_section(&plan, (long)len);
+
+    qsort(txn->ops, txn->ops_number, sizeof(txn_op_t*), op_compare);
+
+    *first = (long)len;
+    for (size_t i = 0; i < txn->ops_number; i++) {
+        if (txn->ops[i]->section_pos != -1 && txn->ops[i]->arg_bpos < *first)
+            *first = txn->ops[i]->arg_bpos;
+    }
+
+    return 0;
+}
+
+/* Write buf from offset from to the end with the planned edits applied. */
+int ini_txn_render(ini_txn_t *txn, const char *buf, size_t len, long from,
+                   FILE *file)
+{
+    long cursor = from;
+    size_t i = 0;
+
+    for (; i < txn->ops_number && txn->ops[i]->section_pos != -1; i++) {
+        txn_op_t *op = txn->ops[i];
+        fwrite(buf + cursor, sizeof(char), (size_t)(op->arg_bpos - cursor), file);
+        write_arg_text(file, &op->arg);
+        cursor = op->arg_epos;
+    }
+    fwrite(buf + cursor, sizeof(char), len - (size_t)cursor, file);
+
+    /* New sections, grouped, in the order they were first added */
+    for (; i < txn->ops_number; i++) {
+        txn_op_t *op = txn->ops[i];
+        if (op->section_pos == -2)
+            continue;
+
+        fprintf(file, "\n[%s]\n", op->section_name);
+        for (txn_op_t *s = op; s != NULL; s = s->next_in_section) {
+            write_arg_text(file, &s->arg);
+            s->section_pos = -2;
+        }
+    }
+
+    return ferror(file) ? -1 : 0;
+}
+
+int ini_read_file(FILE *file, char **buf, size_t *len)
+{
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0)
+        return -1;
+
+    *len = (size_t)st.st_size;
+    *buf = (char*)malloc(*len + 1);
+    if (*buf == NULL) {
+        ERROR("Failed to malloc buf, len(%zu)", *len);
+        return -1;
+    }
+
+    rewind(file);
+    if (*len != fread(*buf, sizeof(char), *len, file)) {
+        ERROR("Failed to read content, len:%zu", *len);
+        sfree(*buf);
+        return -1;
+    }
+
+    return 0;
+}
+
+int ini_txn_commit(ini_txn_t *txn)
+{
+    if (txn->ops_number == 0) {
+        ini_txn_abort(txn);
+        return 0;
+    }
+
+    FILE *file = ini_open_locked(txn->filename);
+    if (!file) {
+        ini_txn_abort(txn);
+        return -1;
+    }
+
+    char *buf = NULL;
+    size_t len = 0;
+    long first;
+    int ret = -1;
+    if (ini_read_file(file, &buf, &len) != 0
+        || ini_txn_plan(txn, buf, len, &first) != 0) {
+        ERROR("Failed to parse stream to get position, %s.", txn->filename);
+        goto out;
+    }
+
+    fseek(file, first, SEEK_SET);
+    if (ini_txn_render(txn, buf, len, first, file) != 0 || fflush(file) != 0) {
+        ERROR("Failed to write args. file:%s", txn->filename);
+        goto out;
+    }
+
+    if (-1 == ftruncate(fileno(file), ftell(file))) {
+        ERROR("Failed to ftruncate.");
+        goto out;
+    }
+    fsync(fileno(file));
+    ret = 0;
+
+out:
+    free(buf);
+    fclose(file);
+    ini_txn_abort(txn);
+    return ret;
+}
+
+typedef struct coalesce_req_s coalesce_req_t;
+struct coalesce_req_s
+{
+    const char *section_name;
+    const ini_arg_data_t *arg_data;
+    int ret;
+    int done;
+    coalesce_req_t *next;
+};
+
+typedef struct coalesce_file_s coalesce_file_t;
+struct coalesce_file_s
+{
+    char *filename;
+    coalesce_req_t *head;         /* queued, not taken by a writer yet */
+    coalesce_req_t **tail;
+    int writing;
+    int users;                    /* callers inside add_arg_ex() */
+    pthread_cond_t cond;
+    coalesce_file_t *next;
+};
+
+static pthread_mutex_t coalesce_lock = PTHREAD_MUTEX_INITIALIZER;
+static coalesce_file_t *coalesce_files;
+
+/* Called with coalesce_lock held. */
+static coalesce_file_t* coalesce_get(const char *filename)
+{
+    coalesce_file_t *file = coalesce_files;
+    while (file != NULL && strcmp(file->filename, filename) != 0)
+        file = file->next;
+    if (file != NULL)
+        return file;
+
+    file = (coalesce_file_t*)calloc(1, sizeof(coalesce_file_t));
+    if (file == NULL || (file->filename = strdup(filename)) == NULL) {
+        sfree(file);
+        return NULL;
+    }
+    file->tail = &file->head;
+    pthread_cond_init(&file->cond, NULL);
+    file->next = coalesce_files;
+    coalesce_files = file;
+    return file;
+}
+
+/* Called with coalesce_lock held. */
+static void coalesce_put(coalesce_file_t *file)
+{
+    if (--file->users != 0)
+        return;
+
+    coalesce_file_t **link = &coalesce_files;
+    while (*link != file)
+        link = &(*link)->next;
+    *link = file->next;
+    pthread_cond_destroy(&file->cond);
+    free(file->filename);
+    free(file);
+}
+
+static int coalesce_write(const char *filename, coalesce_req_t *reqs)
+{
+    ini_txn_t *txn = ini_txn_begin(filename);
+    if (txn == NULL)
+        return -1;
+
+    for (coalesce_req_t *req = reqs; req != NULL; req = req->next) {
+        if (ini_txn_add_arg(txn, req->section_name, req->arg_data) != 0) {
+            ERROR("Failed to queue arg:%s. file:%s", req->arg_data->name, filename);
+            ini_txn_abort(txn);
+            return -1;
+        }
+    }
+
+    return ini_txn_commit(txn);
+}
+
+int add_arg_ex(const char *filename, const char *section_name, ini_arg_data_t *arg_data,
+               int flags)
+{
+    if (!(flags & INI_ADD_COALESCE))
+        return add_arg(filename, section_name, arg_data);
+
+    coalesce_req_t req;
+    memset(&req, 0, sizeof(req));
+    req.section_name = section_name;
+    req.arg_data = arg_data;
+
+    pthread_mutex_lock(&coalesce_lock);
+    coalesce_file_t *file = coalesce_get(filename);
+    if (file == NULL) {
+        pthread_mutex_unlock(&coalesce_lock);
+        ERROR("Failed to malloc coalescing state. file:%s", filename);
+        return -1;
+    }
+    file->users++;
+    *file->tail = &req;
+    file->tail = &req.next;
+
+    while (!req.done) {
+        if (file->writing) {
+            pthread_cond_wait(&file->cond, &coalesce_lock);
+            continue;
+        }
+
+        /* Write everything queued, ours included. */
+        coalesce_req_t *batch = file->head;
+        file->head = NULL;
+        file->tail = &file->head;
+        file->writing = 1;
+        pthread_mutex_unlock(&coalesce_lock);
+
+        int ret = coalesce_write(filename, batch);
+
+        pthread_mutex_lock(&coalesce_lock);
+        while (batch != NULL) {
+            coalesce_req_t *next = batch->next;
+            batch->ret = ret;
+            batch->done = 1;
+            batch = next;
+        }
+        file->writing = 0;
+        pthread_cond_broadcast(&file->cond);
+    }
+
+    coalesce_put(file);
+    pthread_mutex_unlock(&coalesce_lock);
+    return req.ret;
+}
@@ -0,0 +1,284 @@
+/**
+ * inih -- typed accessors of a parsed config
+ *
+ * The first value of an arg is converted to every type at its first typed
+ * lookup and the results are cached on the arg for the life of the handle,
+ * so later lookups cost the hashed lookup and a range check.
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+
+#define INI_CONV_INT        0x01
+#define INI_CONV_BOOL       0x02
+#define INI_CONV_DOUBLE     0x04
+#define INI_CONV_SIZE       0x08
+#define INI_CONV_DURATION   0x10
+
+/* Numbers longer than this don't convert. */
+#define INI_CONVERT_MAX 64
+
+typedef struct ini_conv_s
+{
+    unsigned valid;             /* INI_CONV_* that converted */
+    unsigned overflow;          /* INI_CONV_* out of the range of the type */
+    int bool_value;
+    int64_t int_value;
+    double double_value;
+    uint64_t size_value;        /* bytes */
+    uint64_t duration_value;    /* milliseconds */
+} ini_conv_t;
+
+typedef struct ini_unit_s
+{
+    const char *suffix;
+    double scale;
+} ini_unit_t;
+
+/* Longest suffixes first where one is a prefix of another. */
+static const ini_unit_t size_units[] = {
+    { "", 1.0 }, { "b", 1.0 },
+    { "k", 1024.0 }, { "kb", 1024.0 }, { "kib", 1024.0 },
+    { "m", 1048576.0 }, { "mb", 1048576.0 }, { "mib", 1048576.0 },
+    { "g", 1073741824.0 }, { "gb", 1073741824.0 }, { "gib", 1073741824.0 },
+    { "t", 1099511627776.0 }, { "tb", 1099511627776.0 }, { "tib", 1099511627776.0 },
+};
+
+/* A bare number is in seconds. */
+static const ini_unit_t duration_units[] = {
+    { "", 1000.0 }, { "ms", 1.0 }, { "s", 1000.0 }, { "sec", 1000.0 },
+    { "m", 60000.0 }, { "min", 60000.0 }, { "h", 3600000.0 }, { "d", 86400000.0 },
+};
+
+static const char* skip_space(const char *s)
+{
+    while (ini_isspace(*s))
+        s++;
+    return s;
+}
+
+/* Return 0 if s, trailing spaces stripped, is suffix ignoring case. */
+static int suffix_equals(const char *s, const char *suffix)
+{
+    size_t len = strlen(s);
+    while (len > 0 && ini_isspace(s[len - 1]))
+        len--;
+    return len == strlen(suffix) && strncasecmp(s, suffix, len) == 0 ? 0 : -1;
+}
+
+/* Convert a non-negative number followed by one of units. Return 0,
+   ERANGE if the result overflows uint64_t or EINVAL. */
+static int convert_unit(const char *s, const ini_unit_t *units, size_t units_number,
+                        uint64_t *value)
+{
+    s = skip_space(s);
+    if (*s == '-')
+        return EINVAL;
+
+    char *end;
+    errno = 0;
+    double number = strtod(s, &end);
+    if (end == s || errno == ERANGE || !isfinite(number))
+        return EINVAL;
+
+    for (size_t i = 0; i < units_number; i++) {
+        if (suffix_equals(skip_space(end), units[i].suffix) != 0)
+            continue;
+        double scaled = number * units[i].scale;
+        if (scaled >= 18446744073709551616.0)
+            return ERANGE;
+        *value = (uint64_t)(scaled + 0.5);
+        return 0;
+    }
+
+    return EINVAL;
+}
+
+/* NUL terminated copy of s for strto*(), NULL if too long. */
+static const char* convert_copy(ini_str_t s, char *buf)
+{
+    if (s.len >= INI_CONVERT_MAX)
+        return NULL;
+    memcpy(buf, s.ptr, s.len);
+    buf[s.len] = '\0';
+    return buf;
+}
+
+int ini_convert_int(ini_str_t s, int64_t *value)
+{
+    char buf[INI_CONVERT_MAX];
+    const char *str = convert_copy(s, buf);
+    if (str == NULL)
+        return EINVAL;
+
+    char *end;
+    errno = 0;
+    long long i = strtoll(str, &end, 0);
+    if (end == str || suffix_equals(end, "") != 0)
+        return EINVAL;
+    if (errno == ERANGE)
+        return ERANGE;
+    *value = (int64_t)i;
+    return 0;
+}
+
+int ini_convert_bool(ini_str_t s, int *value)
+{
+    static const char *truths[] = { "1", "true", "yes", "on" };
+    static const char *lies[] = { "0", "false", "no", "off" };
+    while (s.len > 0 && ini_isspace(s.ptr[s.len - 1]))
+        s.len--;
+
+    for (size_t n = 0; n < sizeof(truths) / sizeof(truths[0]); n++) {
+        if (s.len == strlen(truths[n]) && strncasecmp(s.ptr, truths[n], s.len) == 0) {
+            *value = 1;
+            return 0;
+        }
+        if (s.len == strlen(lies[n]) && strncasecmp(s.ptr, lies[n], s.len) == 0) {
+            *value = 0;
+            return 0;
+        }
+    }
+    return EINVAL;
+}
+
+int ini_convert_double(ini_str_t s, double *value)
+{
+    char buf[INI_CONVERT_MAX];
+    const char *str = convert_copy(s, buf);
+    if (str == NULL)
+        return EINVAL;
+
+    char *end;
+    errno = 0;
+    double d = strtod(str, &end);
+    if (end == str || suffix_equals(end, "") != 0)
+        return EINVAL;
+    if (errno == ERANGE && fabs(d) > 1.0)
+        return ERANGE;
+    *value = d;
+    return 0;
+}
+
+int ini_convert_size(ini_str_t s, uint64_t *value)
+{
+    char buf[INI_CONVERT_MAX];
+    const char *str = convert_copy(s, buf);
+    if (str == NULL)
+        return EINVAL;
+    return convert_unit(str, size_units, sizeof(size_units) / sizeof(size_units[0]),
+                        value);
+}
+
+int ini_convert_duration(ini_str_t s, uint64_t *value)
+{
+    char buf[INI_CONVERT_MAX];
+    const char *str = convert_copy(s, buf);
+    if (str == NULL)
+        return EINVAL;
+    return convert_unit(str, duration_units,
+                        sizeof(duration_units) / sizeof(duration_units[0]), value);
+}
+
+/* Record the outcome of a conversion to type. */
+static void conv_set(ini_conv_t *conv, unsigned type, int ret)
+{
+    if (ret != EINVAL)
+        conv->valid |= type;
+    if (ret == ERANGE)
+        conv->overflow |= type;
+}
+
+static void* conv_build(const ini_arg_data_t *arg)
+{
+    ini_conv_t *conv = (ini_conv_t*)calloc(1, sizeof(ini_conv_t));
+    if (conv == NULL || arg->values_number == 0)
+        return conv;
+
+    ini_str_t s = { arg->values[0], strlen(arg->values[0]) };
+    conv_set(conv, INI_CONV_INT, ini_convert_int(s, &conv->int_value));
+    conv_set(conv, INI_CONV_BOOL, ini_convert_bool(s, &conv->bool_value));
+    conv_set(conv, INI_CONV_DOUBLE, ini_convert_double(s, &conv->double_value));
+    conv_set(conv, INI_CONV_SIZE, ini_convert_size(s, &conv->size_value));
+    conv_set(conv, INI_CONV_DURATION, ini_convert_duration(s, &conv->duration_value));
+    return conv;
+}
+
+/* Return 0 with *conv holding a conversion to type, or the error. */
+static int conv_lookup(const ini_t *ini, const char *section_name, const char *arg_name,
+                       unsigned type, const ini_conv_t **conv)
+{
+    int ret = ini_arg_cache(ini, section_name, arg_name, conv_build,
+                            (const void**)conv);
+    if (ret != 0)
+        return ret;
+    if (!((*conv)->valid & type)) {
+        ERROR("Invalid value for arg:%s in section:%s", arg_name, section_name);
+        return EINVAL;
+    }
+    if ((*conv)->overflow & type) {
+        ERROR("Value out of range for arg:%s in section:%s", arg_name, section_name);
+        return ERANGE;
+    }
+    return 0;
+}
+
+int ini_get_int(const ini_t *ini, const char *section_name, const char *arg_name,
+                int64_t def, int64_t min, int64_t max, int64_t *value)
+{
+    const ini_conv_t *conv;
+    int ret = conv_lookup(ini, section_name, arg_name, INI_CONV_INT, &conv);
+    if (ret == 0 && (conv->int_value < min || conv->int_value > max))
+        ret = ERANGE;
+    *value = ret == 0 ? conv->int_value : def;
+    return ret;
+}
+
+int ini_get_bool(const ini_t *ini, const char *section_name, const char *arg_name,
+                 int def, int *value)
+{
+    const ini_conv_t *conv;
+    int ret = conv_lookup(ini, section_name, arg_name, INI_CONV_BOOL, &conv);
+    *value = ret == 0 ? conv->bool_value : def;
+    return ret;
+}
+
+int ini_get_double(const ini_t *ini, const char *section_name, const char *arg_name,
+                   double def, double min, double max, double *value)
+{
+    const ini_conv_t *conv;
+    int ret = conv_lookup(ini, section_name, arg_name, INI_CONV_DOUBLE, &conv);
+    if (ret == 0 && !(conv->double_value >= min && conv->double_value <= max))
+        ret = ERANGE;
+    *value = ret == 0 ? conv->double_value : def;
+    return ret;
+}
+
+int ini_get_size(const ini_t *ini, const char *section_name, const char *arg_name,
+                 uint64_t def, uint64_t min, uint64_t max, uint64_t *value)
+{
+    const ini_conv_t *conv;
+    int ret = conv_lookup(ini, section_name, arg_name, INI_CONV_SIZE, &conv);
+    if (ret == 0 && (conv->size_value < min || conv->size_value > max))
+        ret = ERANGE;
+    *value = ret == 0 ? conv->size_value : def;
+    return ret;
+}
+
+int ini_get_duration(const ini_t *ini, const char *section_name, const char *arg_name,
+                     uint64_t def, uint64_t min, uint64_t max, uint64_t *value)
+{
+    const ini_conv_t *conv;
+    int ret = conv_lookup(ini, section_name, arg_name, INI_CONV_DURATION, &conv);
+    if (ret == 0 && (conv->duration_value < min || conv->duration_value > max))
+        ret = ERANGE;
+    *value = ret == 0 ? conv->duration_value : def;
+    return ret;
+}
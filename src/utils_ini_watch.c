@@ -0,0 +1,267 @@
+/**
+ * inih -- hot reload with inotify and snapshot swap
+ *
+ * The watcher thread owns one reference to the current handle. Readers
+ * take their own reference inside a short read-side section counted in one
+ * of two slots; before the watcher drops the reference of a replaced
+ * handle it flips the slot new readers use and waits for the other one to
+ * drain, twice, so no reader can still be between loading the old pointer
+ * and retaining it.
+ */
+
+#include "utils_ini.h"
+#include "utils_ini_priv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+
+/* Editors write a file in several steps, reload once it has been quiet for
+   this long. */
+#define INI_WATCH_SETTLE_MS 20
+
+#define INI_WATCH_FILE_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+#define INI_WATCH_DIR_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO)
+
+struct ini_watch_s
+{
+    char *filename;
+    char *dirname;
+    const char *basename;       /* points into filename */
+    ini_watch_handler handler;
+    void *user;
+
+    ini_t *current;
+    unsigned int epoch;
+    int readers[2];
+
+    int inotify_fd;
+    int file_wd;
+    int dir_wd;
+    int stop_pipe[2];
+    pthread_t thread;
+};
+
+ini_t* ini_watch_acquire(ini_watch_t *watch)
+{
+    unsigned int epoch = __atomic_load_n(&watch->epoch, __ATOMIC_SEQ_CST);
+    int *readers = &watch->readers[epoch & 1];
+
+    __atomic_add_fetch(readers, 1, __ATOMIC_SEQ_CST);
+    ini_t *ini = ini_retain(__atomic_load_n(&watch->current, __ATOMIC_SEQ_CST));
+    __atomic_sub_fetch(readers, 1, __ATOMIC_RELEASE);
+
+    return ini;
+}
+
+/* Every reader that could have loaded the replaced pointer incremented a
+   slot before the swap and is still counted there, waiting for both slots
+   to drain after the swap covers them all. Flipping first sends new
+   readers to the other slot so the wait always ends. */
+static void watch_synchronize(ini_watch_t *watch)
+{
+    for (int i = 0; i < 2; i++) {
+        unsigned int epoch = __atomic_fetch_add(&watch->epoch, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&watch->readers[epoch & 1], __ATOMIC_SEQ_CST) != 0)
+            sched_yield();
+    }
+}
+
+static void watch_add_file(ini_watch_t *watch)
+{
+    /* Same inode gives the same wd back, a file renamed into place gets a
+       new one and the old inode's watch goes away with it. */
+    int wd = inotify_add_watch(watch->inotify_fd, watch->filename, INI_WATCH_FILE_MASK);
+    if (wd == -1)
+        DEBUG("Failed to watch file:%s. errno:%d", watch->filename, errno);
+    watch->file_wd = wd;
+}
+
+static int watch_drain(ini_watch_t *watch);
+
+/* Return 1 if the file changed again while it was parsed, the result is
+   dropped then and the reload retried once the file is quiet. An in place
+   writer that pauses for longer than that can still be seen half written,
+   and its next write triggers another reload. Writers that rename a new
+   file into place are never seen half written. */
+static int watch_reload(ini_watch_t *watch)
+{
+    watch_add_file(watch);
+
+    ini_t *ini = ini_open(watch->filename);
+    if (watch_drain(watch)) {
+        ini_close(ini);
+        return 1;
+    }
+
+    if (ini != NULL) {
+        ini_t *old = __atomic_exchange_n(&watch->current, ini, __ATOMIC_SEQ_CST);
+        watch_synchronize(watch);
+        ini_close(old);
+    } else {
+        ERROR("Failed to reload file:%s, keep previous config", watch->filename);
+    }
+
+    if (watch->handler != NULL)
+        watch->handler(watch->user, ini);
+    return 0;
+}
+
+/* Return 1 if any queued event concerns the watched file. */
+static int watch_drain(ini_watch_t *watch)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+
+    for (;;) {
+        ssize_t len = read(watch->inotify_fd, buf, sizeof(buf));
+        if (len <= 0)
+            break;
+
+        for (char *p = buf; p < buf + len; ) {
+            const struct inotify_event *event = (const struct inotify_event*)p;
+            if (event->wd == watch->file_wd && (event->mask & INI_WATCH_FILE_MASK))
+                changed = 1;
+            else if (event->wd == watch->dir_wd && event->len
+                     && strcmp(event->name, watch->basename) == 0)
+                changed = 1;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return changed;
+}
+
+static void* watch_thread(void *arg)
+{
+    ini_watch_t *watch = (ini_watch_t*)arg;
+    int pending = 0;
+
+    for (;;) {
+        struct pollfd fds[2] = {
+            { watch->inotify_fd, POLLIN, 0 },
+            { watch->stop_pipe[0], POLLIN, 0 },
+        };
+        int ret = poll(fds, 2, pending ? INI_WATCH_SETTLE_MS : -1);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            ERROR("Failed to poll inotify. errno:%d", errno);
+            break;
+        }
+
+        if (fds[1].revents)
+            break;
+
+        if (ret == 0) {
+            pending = watch_reload(watch);
+        } else if (fds[0].revents & POLLIN) {
+            pending |= watch_drain(watch);
+        }
+    }
+
+    return NULL;
+}
+
+static int watch_split_path(ini_watch_t *watch, const char *filename)
+{
+    watch->filename = strdup(filename);
+    if (watch->filename == NULL)
+        return ENOMEM;
+
+    char *slash = strrchr(watch->filename, '/');
+    if (slash == NULL) {
+        watch->dirname = strdup(".");
+        watch->basename = watch->filename;
+    } else {
+        size_t len = slash == watch->filename ? 1 : (size_t)(slash - watch->filename);
+        watch->dirname = strndup(watch->filename, len);
+        watch->basename = slash + 1;
+    }
+
+    return watch->dirname != NULL ? 0 : ENOMEM;
+}
+
+static void watch_free(ini_watch_t *watch)
+{
+    if (watch->inotify_fd != -1)
+        close(watch->inotify_fd);
+    if (watch->stop_pipe[0] != -1) {
+        close(watch->stop_pipe[0]);
+        close(watch->stop_pipe[1]);
+    }
+    ini_close(watch->current);
+    sfree(watch->filename);
+    sfree(watch->dirname);
+    free(watch);
+}
+
+ini_watch_t* ini_watch_start(const char *filename, ini_watch_handler handler,
+                             void *user)
+{
+    ini_watch_t *watch = (ini_watch_t*)calloc(1, sizeof(ini_watch_t));
+    if (watch == NULL)
+        return NULL;
+
+    watch->handler = handler;
+    watch->user = user;
+    watch->inotify_fd = -1;
+    watch->stop_pipe[0] = watch->stop_pipe[1] = -1;
+
+    if (watch_split_path(watch, filename) != 0)
+        goto error;
+
+    watch->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->inotify_fd == -1) {
+        ERROR("Failed to init inotify. errno:%d", errno);
+        goto error;
+    }
+
+    /* Watch before the first parse, so a change in between is not lost. */
+    watch->dir_wd = inotify_add_watch(watch->inotify_fd, watch->dirname,
+                                      INI_WATCH_DIR_MASK);
+    if (watch->dir_wd == -1) {
+        ERROR("Failed to watch dir:%s. errno:%d", watch->dirname, errno);
+        goto error;
+    }
+    watch_add_file(watch);
+
+    watch->current = ini_open(filename);
+    if (watch->current == NULL)
+        goto error;
+
+    if (pipe(watch->stop_pipe) != 0) {
+        watch->stop_pipe[0] = watch->stop_pipe[1] = -1;
+        ERROR("Failed to create pipe. errno:%d", errno);
+        goto error;
+    }
+
+    if (pthread_create(&watch->thread, NULL, watch_thread, watch) != 0) {
+        ERROR("Failed to create watch thread. file:%s", filename);
+        goto error;
+    }
+
+    return watch;
+
+error:
+    watch_free(watch);
+    return NULL;
+}
+
+void ini_watch_stop(ini_watch_t *watch)
+{
+    if (watch == NULL)
+        return;
+
+    char c = 0;
+    while (write(watch->stop_pipe[1], &c, 1) == -1 && errno == EINTR)
+        ;
+    pthread_join(watch->thread, NULL);
+    watch_free(watch);
+}
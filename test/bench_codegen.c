@@ -0,0 +1,220 @@
+/*
+ * bench_codegen.c
+ * Loader generated by ini_codegen from bench_codegen.ini against
+ * ini_parse() with a tree walk and ini_open() with typed lookups.
+ *
+ * usage: bench_codegen [plugin_sections] [rounds]
+ */
+
+#include "utils_ini.h"
+#include "bench_config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The service config, with sections the schema doesn't know. */
+static int write_config(const char *filename, int plugins)
+{
+    FILE *file = fopen(filename, "w");
+    if (!file)
+        return -1;
+
+    fprintf(file, "[Global]\nHostname = collector-01\nInterval = 30s\nReadThreads = 8\n"
+            "WriteThreads = 4\nWriteQueueLimitHigh = 500000\nTimeout = 1.5\n"
+            "CacheSize = 256MB\nDebug = yes\n");
+    for (int p = 0; p < plugins; p++)
+        fprintf(file, "[Plugin%d]\nModule = cpu\n    memory\nEnabled = true\n", p);
+    fprintf(file, "[Network]\nListen = 10.0.0.1\nPort = 25827\nBufferSize = 64k\n"
+            "Forward = on\nTimeToLive = 64\n");
+
+    fclose(file);
+    return 0;
+}
+
+/* First occurrence of a key, ini_parse() lists the last one first. */
+static const char* tree_value(const ini_section_t *sections, const char *section_name,
+                              const char *arg_name)
+{
+    const char *value = NULL;
+    for (; sections != NULL; sections = sections->next) {
+        if (strcmp(sections->data.name, section_name) != 0)
+            continue;
+        for (const ini_arg_t *arg = sections->data.args; arg != NULL; arg = arg->next) {
+            if (strcmp(arg->data.name, arg_name) == 0 && arg->data.values_number > 0)
+                value = arg->data.values[0];
+        }
+    }
+    return value;
+}
+
+/* tree_int() and so on, each converter called through its own type. */
+#define TREE_CONVERT(kind, type) \
+    static void tree_##kind(const ini_section_t *sections, const char *section_name, \
+                            const char *arg_name, type *field) \
+    { \
+        const char *value = tree_value(sections, section_name, arg_name); \
+        if (value != NULL) \
+            ini_convert_##kind((ini_str_t){ value, strlen(value) }, field); \
+    }
+
+TREE_CONVERT(int, int64_t)
+TREE_CONVERT(bool, int)
+TREE_CONVERT(double, double)
+TREE_CONVERT(size, uint64_t)
+TREE_CONVERT(duration, uint64_t)
+
+static void tree_string(const ini_section_t *sections, const char *section_name,
+                        const char *arg_name, char **field)
+{
+    const char *value = tree_value(sections, section_name, arg_name);
+    if (value != NULL) {
+        free(*field);
+        *field = strdup(value);
+    }
+}
+
+static int load_tree(const char *filename, bench_config_t *config)
+{
+    ini_section_t *sections = ini_parse(filename);
+    if (sections == NULL)
+        return -1;
+
+    tree_string(sections, "Global", "Hostname", &config->global.hostname);
+    tree_duration(sections, "Global", "Interval", &config->global.interval);
+    tree_int(sections, "Global", "ReadThreads", &config->global.readthreads);
+    tree_int(sections, "Global", "WriteThreads", &config->global.writethreads);
+    tree_int(sections, "Global", "WriteQueueLimitHigh", &config->global.writequeuelimithigh);
+    tree_double(sections, "Global", "Timeout", &config->global.timeout);
+    tree_size(sections, "Global", "CacheSize", &config->global.cachesize);
+    tree_bool(sections, "Global", "Debug", &config->global.debug);
+    tree_string(sections, "Network", "Listen", &config->network.listen);
+    tree_int(sections, "Network", "Port", &config->network.port);
+    tree_size(sections, "Network", "BufferSize", &config->network.buffersize);
+    tree_bool(sections, "Network", "Forward", &config->network.forward);
+    tree_int(sections, "Network", "TimeToLive", &config->network.timetolive);
+
+    free_section(sections);
+    return 0;
+}
+
+static void handle_string(const ini_t *ini, const char *section_name,
+                          const char *arg_name, char **field)
+{
+    const ini_arg_data_t *arg = ini_get_arg(ini, section_name, arg_name);
+    if (arg != NULL && arg->values_number > 0) {
+        free(*field);
+        *field = strdup(arg->values[0]);
+    }
+}
+
+static int load_handle(const char *filename, bench_config_t *config)
+{
+    ini_t *ini = ini_open(filename);
+    if (ini == NULL)
+        return -1;
+
+    bench_config_t *c = config;
+    handle_string(ini, "Global", "Hostname", &c->global.hostname);
+    ini_get_duration(ini, "Global", "Interval", c->global.interval, 0, UINT64_MAX,
+                     &c->global.interval);
+    ini_get_int(ini, "Global", "ReadThreads", c->global.readthreads, INT64_MIN, INT64_MAX,
+                &c->global.readthreads);
+    ini_get_int(ini, "Global", "WriteThreads", c->global.writethreads, INT64_MIN, INT64_MAX,
+                &c->global.writethreads);
+    ini_get_int(ini, "Global", "WriteQueueLimitHigh", c->global.writequeuelimithigh,
+                INT64_MIN, INT64_MAX, &c->global.writequeuelimithigh);
+    ini_get_double(ini, "Global", "Timeout", c->global.timeout, -1e308, 1e308,
+                   &c->global.timeout);
+    ini_get_size(ini, "Global", "CacheSize", c->global.cachesize, 0, UINT64_MAX,
+                 &c->global.cachesize);
+    ini_get_bool(ini, "Global", "Debug", c->global.debug, &c->global.debug);
+    handle_string(ini, "Network", "Listen", &c->network.listen);
+    ini_get_int(ini, "Network", "Port", c->network.port, INT64_MIN, INT64_MAX,
+                &c->network.port);
+    ini_get_size(ini, "Network", "BufferSize", c->network.buffersize, 0, UINT64_MAX,
+                 &c->network.buffersize);
+    ini_get_bool(ini, "Network", "Forward", c->network.forward, &c->network.forward);
+    ini_get_int(ini, "Network", "TimeToLive", c->network.timetolive, INT64_MIN, INT64_MAX,
+                &c->network.timetolive);
+
+    ini_close(ini);
+    return 0;
+}
+
+static int same_config(const bench_config_t *a, const bench_config_t *b)
+{
+    return strcmp(a->global.hostname, b->global.hostname) == 0
+        && a->global.interval == b->global.interval
+        && a->global.readthreads == b->global.readthreads
+        && a->global.writethreads == b->global.writethreads
+        && a->global.writequeuelimithigh == b->global.writequeuelimithigh
+        && a->global.timeout == b->global.timeout
+        && a->global.cachesize == b->global.cachesize
+        && a->global.debug == b->global.debug
+        && strcmp(a->network.listen, b->network.listen) == 0
+        && a->network.port == b->network.port
+        && a->network.buffersize == b->network.buffersize
+        && a->network.forward == b->network.forward
+        && a->network.timetolive == b->network.timetolive;
+}
+
+static double load_time(const char *filename, int rounds,
+                        int (*load)(const char*, bench_config_t*), bench_config_t *result)
+{
+    double best = 0;
+    for (int round = 0; round < 5; round++) {
+        double start = now();
+        for (int i = 0; i < rounds; i++) {
+            bench_config_t config;
+            bench_config_init(&config);
+            load(filename, &config);
+            if (i == 0 && round == 0)
+                *result = config;
+            else
+                bench_config_free(&config);
+        }
+        double elapsed = (now() - start) / rounds;
+        if (best == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    int plugins = argc > 1 ? atoi(argv[1]) : 0;
+    int rounds = argc > 2 ? atoi(argv[2]) : 2000;
+    const char *filename = "bench_codegen.conf";
+
+    if (write_config(filename, plugins) != 0) {
+        printf("Can't write '%s'\n", filename);
+        return -1;
+    }
+
+    bench_config_t generated, tree, handle;
+    double generated_time = load_time(filename, rounds, bench_config_load, &generated);
+    double tree_time = load_time(filename, rounds, load_tree, &tree);
+    double handle_time = load_time(filename, rounds, load_handle, &handle);
+
+    printf("plugin_sections=%d same_values=%d\n", plugins,
+           same_config(&generated, &tree) && same_config(&generated, &handle));
+    printf("generated         %8.2f us\n", generated_time * 1e6);
+    printf("ini_parse + walk  %8.2f us  %.2fx\n", tree_time * 1e6, tree_time / generated_time);
+    printf("ini_open + get    %8.2f us  %.2fx\n", handle_time * 1e6,
+           handle_time / generated_time);
+
+    bench_config_free(&generated);
+    bench_config_free(&tree);
+    bench_config_free(&handle);
+    unlink(filename);
+    return 0;
+}
+// vim: set ts=4 sw=4 sts=4 et:
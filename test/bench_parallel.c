@@ -0,0 +1,87 @@
+/*
+ * bench_parallel.c
+ * ini_parse_parallel() scalability from 1 to N threads.
+ *
+ * usage: bench_parallel [size_mb] [max_threads]
+ */
+
+#include "utils_ini.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_config(const char *filename, size_t size)
+{
+    FILE *file = fopen(filename, "w");
+    if (!file)
+        return -1;
+
+    size_t written = 0;
+    for (int s = 0; written < size; s++) {
+        written += fprintf(file, "[Host%d]\n", s);
+        for (int k = 0; k < 24 && written < size; k++) {
+            written += fprintf(file, "Key%d = value-%d-%d ; comment\n", k, s, k);
+            if (k % 6 == 0)
+                written += fprintf(file, "    continued-%d\n", k);
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+static double parse_time(const char *filename, int threads)
+{
+    double best = 0;
+    for (int round = 0; round < 5; round++) {
+        ini_arena_t *arena = ini_arena_create(0);
+        double start = now();
+        if (threads == 0)
+            ini_parse_arena(filename, arena);
+        else
+            ini_parse_parallel(filename, arena, threads);
+        double elapsed = now() - start;
+        ini_arena_destroy(arena);
+        if (best == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    size_t size = (argc > 1 ? atol(argv[1]) : 64) << 20;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = argc > 2 ? atoi(argv[2]) : (int)cpus;
+    const char *filename = "bench_parallel.ini";
+
+    if (write_config(filename, size) != 0) {
+        printf("Can't write '%s'\n", filename);
+        return -1;
+    }
+
+    double base = parse_time(filename, 0);
+    printf("size=%zuMB cpus=%ld\n", size >> 20, cpus);
+    printf("sequential %8.1f ms\n", base * 1e3);
+    /* 1, 2, 4, ... and max_threads last. */
+    for (int threads = 1, next; threads <= max_threads; threads = next) {
+        double elapsed = parse_time(filename, threads);
+        printf("threads=%-3d %8.1f ms  speedup %.2fx\n", threads, elapsed * 1e3,
+               base / elapsed);
+        next = threads * 2;
+        if (threads < max_threads && next > max_threads)
+            next = max_threads;
+    }
+
+    unlink(filename);
+    return 0;
+}
+// vim: set ts=4 sw=4 sts=4 et:
@@ -0,0 +1,94 @@
+/*
+ * bench_scan.c
+ * Tokenizer throughput for every scanning kernel the CPU supports.
+ *
+ * usage: bench_scan [size_mb] [value_len]
+ */
+
+#include "utils_ini.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *kernels[] = { "scalar", "sse2", "avx2" };
+
+static int count_handler(void *user, ini_str_t section, ini_str_t name,
+                         ini_str_t value, long pos)
+{
+    (*(size_t*)user) += value.len;
+    return 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_config(const char *filename, size_t size, int value_len)
+{
+    FILE *file = fopen(filename, "w");
+    if (!file)
+        return -1;
+
+    char *value = malloc(value_len + 1);
+    for (int i = 0; i < value_len; i++)
+        value[i] = 'a' + i % 26;
+    value[value_len] = '\0';
+
+    size_t written = 0;
+    for (int s = 0; written < size; s++) {
+        written += fprintf(file, "[Section%d]\n", s);
+        for (int k = 0; k < 16 && written < size; k++) {
+            written += fprintf(file, "Key%d = %s ; comment\n", k, value);
+            if (k % 4 == 0)
+                written += fprintf(file, "    %s\n", value);
+            if (k % 8 == 0)
+                written += fprintf(file, "# %s\n", value);
+        }
+    }
+
+    free(value);
+    fclose(file);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t size = (argc > 1 ? atol(argv[1]) : 64) << 20;
+    int value_len = argc > 2 ? atoi(argv[2]) : 48;
+    const char *filename = "bench_scan.ini";
+
+    if (write_config(filename, size, value_len) != 0) {
+        printf("Can't write '%s'\n", filename);
+        return -1;
+    }
+
+    printf("size=%zuMB value_len=%d default=%s\n", size >> 20, value_len,
+           ini_scan_impl());
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (ini_scan_select(kernels[i]) != 0) {
+            printf("%-8s unsupported\n", kernels[i]);
+            continue;
+        }
+
+        double best = 0;
+        size_t bytes = 0;
+        for (int round = 0; round < 5; round++) {
+            bytes = 0;
+            double start = now();
+            ini_parse_mmap(filename, count_handler, &bytes);
+            double elapsed = now() - start;
+            if (best == 0 || elapsed < best)
+                best = elapsed;
+        }
+        printf("%-8s %8.1f MB/s (%zu value bytes)\n", kernels[i],
+               size / best / (1 << 20), bytes);
+    }
+
+    unlink(filename);
+    return 0;
+}
+// vim: set ts=4 sw=4 sts=4 et:
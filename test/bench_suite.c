@@ -0,0 +1,307 @@
+/*
+ * bench_suite.c
+ * Latency and throughput of ini_parse(), get_section(), get_arg() and
+ * add_arg() on generated configs, one JSON object per line and case.
+ *
+ * Configs are generated from a fixed seed, so a size and profile always
+ * give the same file. Each case runs in its own process, which makes
+ * peak_rss_kb the peak of that case alone. Throughput is the file size
+ * over the mean latency, what a full scan would cover.
+ *
+ * usage: bench_suite [-t seconds] [-o output] [size[K|M|G] ...]
+ */
+
+#include "utils_ini.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define BENCH_MAX_ITERATIONS 10000
+#define BENCH_MIN_ITERATIONS 3
+
+typedef struct profile_s
+{
+    const char *name;
+    int keys;               /* per section, at most */
+    int key_min;            /* key length */
+    int key_max;
+    int value_max;
+    int multiline;          /* percent of keys with continuation lines */
+    int comments;           /* percent of lines followed by a comment */
+} profile_t;
+
+/* Few wide sections to many narrow ones. */
+static const profile_t profiles[] = {
+    { "flat",  256, 4,  8,  16, 0,  0  },
+    { "mixed", 24,  4,  24, 48, 10, 10 },
+    { "dense", 4,   16, 40, 96, 30, 40 },
+};
+
+typedef struct bench_case_s
+{
+    const char *op;
+    const char *name;
+} bench_case_t;
+
+static const bench_case_t cases[] = {
+    { "ini_parse", "full" },
+    { "get_section", "first" }, { "get_section", "middle" },
+    { "get_section", "last" }, { "get_section", "miss" },
+    { "get_arg", "early" }, { "get_arg", "middle" },
+    { "get_arg", "last" }, { "get_arg", "miss" },
+    { "add_arg", "start" }, { "add_arg", "middle" }, { "add_arg", "end" },
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* splitmix64, also used to derive names from their position. */
+static uint64_t mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t next(uint64_t *state)
+{
+    *state = mix(*state);
+    return *state;
+}
+
+static int between(uint64_t *state, int min, int max)
+{
+    return min + (int)(next(state) % (uint64_t)(max - min + 1));
+}
+
+static void section_name(char *buf, int s)
+{
+    sprintf(buf, "Section%07d", s);
+}
+
+/* Key k of section s, the same for every run. */
+static void key_name(char *buf, const profile_t *profile, int s, int k)
+{
+    uint64_t state = ((uint64_t)s << 32) | (uint32_t)k;
+    int len = between(&state, profile->key_min, profile->key_max);
+    int n = sprintf(buf, "k%d_", k);
+    for (; n < len; n++)
+        buf[n] = 'a' + next(&state) % 26;
+    buf[n] = '\0';
+}
+
+static void random_text(char *buf, uint64_t *state, int max)
+{
+    int len = between(state, 1, max);
+    for (int i = 0; i < len; i++)
+        buf[i] = 'a' + next(state) % 26;
+    buf[len] = '\0';
+}
+
+/* Write about size bytes, return the number of sections or -1. */
+static int write_config(const char *filename, const profile_t *profile, size_t size)
+{
+    FILE *file = fopen(filename, "w");
+    if (!file)
+        return -1;
+
+    uint64_t state = size ^ (uint64_t)profile->keys;
+    char name[INI_MAX_NAME];
+    char text[128];
+    size_t written = 0;
+    int s = 0;
+    do {
+        section_name(name, s);
+        written += fprintf(file, "[%s]\n", name);
+        int keys = between(&state, 1, profile->keys);
+        for (int k = 0; k < keys && written < size; k++) {
+            key_name(name, profile, s, k);
+            random_text(text, &state, profile->value_max);
+            written += fprintf(file, "%s = %s\n", name, text);
+            if (between(&state, 1, 100) <= profile->multiline) {
+                for (int l = between(&state, 1, 3); l > 0; l--) {
+                    random_text(text, &state, profile->value_max);
+                    written += fprintf(file, "    %s\n", text);
+                }
+            }
+            if (between(&state, 1, 100) <= profile->comments) {
+                random_text(text, &state, profile->value_max);
+                written += fprintf(file, "%c %s\n", k % 2 ? '#' : ';', text);
+            }
+        }
+        s++;
+    } while (written < size);
+
+    if (fclose(file) != 0)
+        return -1;
+    return s;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest rank. */
+static double percentile(const double *sorted, int n, int p)
+{
+    int rank = (n * p + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void run_once(const char *filename, const bench_case_t *c, const char *section,
+                     const char *arg)
+{
+    if (strcmp(c->op, "ini_parse") == 0) {
+        free_section(ini_parse(filename));
+    } else if (strcmp(c->op, "get_section") == 0) {
+        ini_section_data_t *section_data = get_section(filename, section);
+        free_section_data(section_data);
+        free(section_data);
+    } else if (strcmp(c->op, "get_arg") == 0) {
+        free_arg_data(get_arg(filename, section, arg));
+    } else {
+        char *values[] = { "bench" };
+        ini_arg_data_t arg_data;
+        memset(&arg_data, 0, sizeof(arg_data));
+        strncpy(arg_data.name, arg, sizeof(arg_data.name) - 1);
+        arg_data.values = values;
+        arg_data.values_number = 1;
+        add_arg(filename, section, &arg_data);
+    }
+}
+
+/* Run a case until the time budget is spent and print its line. */
+static void run_case(FILE *out, const char *filename, const profile_t *profile,
+                     size_t size, int sections, const bench_case_t *c, double budget)
+{
+    int target = strcmp(c->name, "first") == 0 || strcmp(c->name, "early") == 0
+                 || strcmp(c->name, "start") == 0 ? 0
+               : strcmp(c->name, "middle") == 0 ? sections / 2
+               : sections - 1;
+    char section[INI_MAX_SECTION];
+    char arg[INI_MAX_NAME];
+    section_name(section, target);
+    key_name(arg, profile, target, 0);
+    if (strcmp(c->name, "miss") == 0) {
+        if (strcmp(c->op, "get_section") == 0)
+            strcpy(section, "Missing");
+        else
+            strcpy(arg, "missing");
+    }
+
+    /* add_arg settles the file on its first call. */
+    run_once(filename, c, section, arg);
+
+    double *latencies = malloc(BENCH_MAX_ITERATIONS * sizeof(double));
+    double total = 0;
+    int n = 0;
+    while (n < BENCH_MAX_ITERATIONS && (n < BENCH_MIN_ITERATIONS || total < budget)) {
+        double start = now();
+        run_once(filename, c, section, arg);
+        latencies[n] = now() - start;
+        total += latencies[n++];
+    }
+    qsort(latencies, n, sizeof(double), compare_double);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(out, "{\"profile\":\"%s\",\"size\":%zu,\"sections\":%d,\"op\":\"%s\","
+            "\"case\":\"%s\",\"iterations\":%d,\"mb_per_s\":%.1f,\"ops_per_s\":%.1f,"
+            "\"p50_us\":%.1f,\"p99_us\":%.1f,\"peak_rss_kb\":%ld}\n",
+            profile->name, size, sections, c->op, c->name, n,
+            size * n / total / (1 << 20), n / total,
+            percentile(latencies, n, 50) * 1e6, percentile(latencies, n, 99) * 1e6,
+            usage.ru_maxrss);
+    fflush(out);
+    free(latencies);
+}
+
+static size_t parse_size(const char *s)
+{
+    char *end;
+    size_t size = strtoul(s, &end, 10);
+    switch (*end) {
+    case 'G': case 'g': size <<= 10; /* fall through */
+    case 'M': case 'm': size <<= 10; /* fall through */
+    case 'K': case 'k': size <<= 10;
+    }
+    return size;
+}
+
+/* Keep the library's messages out of the results. */
+static void stderr_sink(void *user, int level, const char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *default_sizes[] = { "1K", "64K", "1M", "16M" };
+    double budget = 0.5;
+    FILE *out = stdout;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:o:")) != -1) {
+        if (opt == 't') {
+            budget = atof(optarg);
+        } else if (opt == 'o' && (out = fopen(optarg, "w")) == NULL) {
+            fprintf(stderr, "Can't write '%s'\n", optarg);
+            return -1;
+        } else if (opt != 'o') {
+            fprintf(stderr, "usage: %s [-t seconds] [-o output] [size ...]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    const char **sizes = optind < argc ? (const char**)argv + optind : default_sizes;
+    int sizes_number = optind < argc ? argc - optind
+                                     : (int)(sizeof(default_sizes) / sizeof(default_sizes[0]));
+    ini_log_set_sink(stderr_sink, NULL);
+
+    const char *filename = "bench_suite.ini";
+    for (int i = 0; i < sizes_number; i++) {
+        size_t size = parse_size(sizes[i]);
+        for (size_t p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+            int sections = write_config(filename, &profiles[p], size);
+            if (sections < 0) {
+                fprintf(stderr, "Can't write '%s'\n", filename);
+                return -1;
+            }
+
+            /* The real size, the generator overshoots by up to a section. */
+            FILE *file = fopen(filename, "r");
+            fseek(file, 0, SEEK_END);
+            size_t real_size = ftell(file);
+            fclose(file);
+
+            for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+                fflush(out);
+                pid_t pid = fork();
+                if (pid == 0) {
+                    run_case(out, filename, &profiles[p], real_size, sections,
+                             &cases[c], budget);
+                    _exit(0);
+                }
+                int status;
+                if (pid < 0 || waitpid(pid, &status, 0) != pid || status != 0)
+                    fprintf(stderr, "%s/%s failed on %s %s\n", cases[c].op, cases[c].name,
+                            profiles[p].name, sizes[i]);
+            }
+        }
+    }
+
+    unlink(filename);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
+// vim: set ts=4 sw=4 sts=4 et:
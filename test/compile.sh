@@ -7,4 +7,10 @@
 #
 
 
-gcc main.c -g -o main -L../src -I../src -lini
+gcc main.c -g -o main -L../src -I../src -lini -pthread
+gcc bench_scan.c -O2 -o bench_scan -L../src -I../src -lini
+gcc bench_parallel.c -O2 -o bench_parallel -L../src -I../src -lini
+g++ -std=c++17 main_hpp.cpp -g -o main_hpp -L../src -I../src -lini
+../src/ini_codegen bench_codegen.ini bench_config && \
+    gcc bench_codegen.c bench_config.c -O2 -o bench_codegen -L../src -I../src -I. -lini
+gcc bench_suite.c -O2 -o bench_suite -L../src -I../src -lini
@@ -8,3 +8,4 @@
 
 
 LD_LIBRARY_PATH=$LD_LIBRARY_PATH:../src ./main
+LD_LIBRARY_PATH=$LD_LIBRARY_PATH:../src ./main_hpp
@@ -1,6 +1,48 @@
 #include "utils_ini.h"
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+static int print_str_handler(void *user, ini_str_t section, ini_str_t name,
+                             ini_str_t value, long pos)
+{
+    (*(int*)user)++;
+    if (name.ptr != NULL)
+        printf("%ld: [%.*s] %.*s = %.*s\n", pos, (int)section.len, section.ptr,
+               (int)name.len, name.ptr, (int)value.len, value.ptr);
+    return 0;
+}
+
+static int print_visitor(void *user, const ini_event_t *event)
+{
+    static const char *types[] = { "section", "key", "continuation", "error" };
+    (*(int*)user)++;
+    printf("%d:%ld %s [%.*s]", event->lineno, event->offset, types[event->type],
+           (int)event->section.len, event->section.ptr);
+    if (event->name.ptr != NULL)
+        printf(" %.*s = %.*s", (int)event->name.len, event->name.ptr,
+               (int)event->value.len, event->value.ptr);
+    printf("\n");
+    return 0;
+}
+
+static void count_sink(void *user, int level, const char *msg)
+{
+    (*(int*)user)++;
+}
+
+static void watch_handler(void *user, const ini_t *ini)
+{
+    if (ini != NULL)
+        __atomic_add_fetch((int*)user, 1, __ATOMIC_SEQ_CST);
+}
+
+static void* coalesce_writer(void *arg)
+{
+    add_arg_ex("coalesce.ini", "Tuner", (ini_arg_data_t*)arg, INI_ADD_COALESCE);
+    return NULL;
+}
 
 int main()
 {
@@ -44,6 +86,150 @@ int main()
         free_arg_data(arg_data);
     }
 
+    printf("test get_args\n");
+    ini_query_t queries[] = {
+        { "System4", "Module", NULL },
+        { "FileInput", "Files", NULL },
+        { "Global", "WriteThreads11", NULL },
+        { "System", "Module", NULL },
+    };
+    size_t queries_number = sizeof(queries) / sizeof(queries[0]);
+    printf("found: %d\n", get_args(filename, queries, queries_number));
+    for (size_t i = 0; i < queries_number; i++) {
+        if (queries[i].arg_data != NULL) {
+            print_arg_data(queries[i].arg_data);
+            free_arg_data(queries[i].arg_data);
+        }
+    }
+
+    printf("test ini_open\n");
+    ini_t *ini = ini_open(filename);
+    if (ini == NULL) {
+        printf("Can't open '%s'", filename);
+        return -1;
+    }
+    print_section_data(ini_get_section(ini, "FileInput"));
+    print_arg_data(ini_get_arg(ini, "System4", "Module"));
+    printf("missing section: %p\n", (void*)ini_get_section(ini, "FileInput11"));
+    printf("missing arg: %p\n", (void*)ini_get_arg(ini, "Global", "WriteThreads11"));
+    ini_close(ini);
+
+    printf("test ini_open_ex lazy\n");
+    ini = ini_open_ex(filename, INI_OPEN_LAZY);
+    print_arg_data(ini_get_arg(ini, "System4", "Interval"));
+    print_section_data(ini_get_section(ini, "SystemInput"));
+    print_section(ini_sections(ini));
+    ini_close(ini);
+
+    printf("test ini_get_int\n");
+    ini = ini_open(filename);
+    int64_t threads;
+    uint64_t interval, queue;
+    int ret = ini_get_int(ini, "System4", "ReadThreads", 1, 1, 64, &threads);
+    printf("ReadThreads: %lld ret: %d\n", (long long)threads, ret);
+    ret = ini_get_int(ini, "System4", "WriteThreads", 1, 1, 4, &threads);
+    printf("WriteThreads in [1, 4]: %lld ret: %d\n", (long long)threads, ret);
+    ret = ini_get_int(ini, "System4", "Module", 1, 1, 64, &threads);
+    printf("Module: %lld ret: %d\n", (long long)threads, ret);
+    ret = ini_get_duration(ini, "System4", "Interval", 1000, 0, UINT64_MAX, &interval);
+    printf("Interval: %llums ret: %d\n", (unsigned long long)interval, ret);
+    ret = ini_get_size(ini, "System4", "WriteQueueLimitHigh", 0, 0, UINT64_MAX, &queue);
+    printf("WriteQueueLimitHigh: %llu ret: %d\n", (unsigned long long)queue, ret);
+    ret = ini_get_size(ini, "System4", "WriteQueueLimitMax", 64 << 20, 0, UINT64_MAX, &queue);
+    printf("missing WriteQueueLimitMax: %llu ret: %d\n", (unsigned long long)queue, ret);
+    ini_close(ini);
+
+    printf("test ini_image\n");
+    if (ini_compile(filename, "test.img") == 0) {
+        ini_image_t *image = ini_image_open("test.img", filename, INI_IMAGE_VERIFY);
+        if (image != NULL) {
+            print_image(image);
+            const ini_image_arg_t *interval = ini_image_get_arg(image, "System4", "Interval");
+            ini_str_t value = interval ? ini_image_value(image, interval, 0) : (ini_str_t){ "", 0 };
+            printf("from file: %d, Interval: %.*s\n", ini_image_from_file(image),
+                   (int)value.len, value.ptr);
+        }
+        ini_image_close(image);
+        unlink("test.img");
+    }
+
+    printf("test ini_shm\n");
+    if (ini_shm_publish("/inih_test", filename) == 0) {
+        ini_shm_t *shm = ini_shm_attach("/inih_test");
+        if (shm != NULL) {
+            uint64_t generation = ini_shm_generation(shm);
+            ini_shm_publish("/inih_test", filename);
+            int refreshed = ini_shm_refresh(shm);
+            const ini_image_t *image = ini_shm_image(shm);
+            printf("refreshed: %d, generation: +%llu, System4 found: %d\n", refreshed,
+                   (unsigned long long)(ini_shm_generation(shm) - generation),
+                   ini_image_get_section(image, "System4") != NULL);
+        }
+        ini_shm_detach(shm);
+        ini_shm_unlink("/inih_test");
+    }
+
+    printf("test ini_parse_arena\n");
+    ini_arena_t *arena = ini_arena_create(0);
+    print_section(ini_parse_arena(filename, arena));
+    ini_arena_destroy(arena);
+
+    printf("test ini_parse_parallel\n");
+    arena = ini_arena_create(0);
+    print_section(ini_parse_parallel(filename, arena, 4));
+    ini_arena_destroy(arena);
+
+    printf("test ini_parse_merged\n");
+    arena = ini_arena_create(0);
+    print_section(ini_parse_merged(filename, arena, INI_MERGE_LAST_WINS));
+    ini_arena_destroy(arena);
+
+    printf("test ini_compact_parse\n");
+    ini_intern_t *pool = ini_intern_create();
+    ini_compact_t *compact1 = ini_compact_parse(filename, pool);
+    ini_compact_t *compact2 = ini_compact_parse(filename, pool);
+    ini_intern_release(pool);
+    if (compact1 != NULL && compact2 != NULL) {
+        print_compact(compact1);
+        const ini_compact_arg_t *module1 = ini_compact_get_arg(compact1, "System4", "Module");
+        const ini_compact_arg_t *module2 = ini_compact_get_arg(compact2, "SystemInput", "Module");
+        printf("Module name shared: %d\n", module1 && module2 && module1->name == module2->name);
+    }
+    ini_compact_free(compact1);
+    ini_compact_free(compact2);
+
+    printf("test ini_parse_mmap\n");
+    int events = 0;
+    ret = ini_parse_mmap(filename, print_str_handler, &events);
+    printf("ini_parse_mmap, ret=%d, events=%d\n", ret, events);
+
+    printf("test ini_visit_file\n");
+    FILE *file = fopen(filename, "r");
+    if (file != NULL) {
+        events = 0;
+        ret = ini_visit_file(file, print_visitor, &events);
+        printf("ini_visit_file, ret=%d, events=%d\n", ret, events);
+        fclose(file);
+    }
+
+    printf("test ini_push\n");
+    file = fopen(filename, "r");
+    ini_push_t *push = ini_push_new(print_visitor, &events);
+    if (file != NULL && push != NULL) {
+        char chunk[7];
+        size_t len;
+        events = 0;
+        ret = 0;
+        while (ret == 0 && (len = fread(chunk, 1, sizeof(chunk), file)) > 0)
+            ret = ini_push_feed(push, chunk, len);
+        if (ret == 0)
+            ret = ini_push_finish(push);
+        printf("ini_push, ret=%d, events=%d\n", ret, events);
+    }
+    ini_push_free(push);
+    if (file != NULL)
+        fclose(file);
+
     printf("test add_args\n");
     arg_data = malloc(sizeof(ini_arg_data_t));
     memset(arg_data, 0, sizeof(ini_arg_data_t));
@@ -55,10 +241,210 @@ int main()
     values[2] = strdup("process");
     arg_data->values = values;
     print_arg_data(arg_data);
-    int ret = add_arg(filename, "System", arg_data);
+    ret = add_arg(filename, "System", arg_data);
     printf("add_args, ret=%d\n", ret);
     free_arg_data(arg_data);
 
+    printf("test ini_txn\n");
+    const char *txn_filename = "txn.ini";
+    unlink(txn_filename);
+    ini_txn_t *txn = ini_txn_begin(txn_filename);
+    char *txn_values[] = { "10", "20" };
+    ini_arg_data_t txn_arg;
+    memset(&txn_arg, 0, sizeof(ini_arg_data_t));
+    txn_arg.values = txn_values;
+    txn_arg.values_number = 1;
+    strcpy(txn_arg.name, "Interval");
+    ini_txn_add_arg(txn, "Global", &txn_arg);
+    strcpy(txn_arg.name, "ReadThreads");
+    ini_txn_add_arg(txn, "Global", &txn_arg);
+    strcpy(txn_arg.name, "Module");
+    txn_arg.values_number = 2;
+    ini_txn_add_arg(txn, "System", &txn_arg);
+    strcpy(txn_arg.name, "Interval");
+    ini_txn_add_arg(txn, "Global", &txn_arg);
+    ret = ini_txn_commit(txn);
+    printf("ini_txn_commit, ret=%d\n", ret);
+    section = ini_parse(txn_filename);
+    print_section(section);
+    free_section(section);
+    unlink(txn_filename);
+
+    printf("test ini_doc\n");
+    const char *doc_text =
+        "; global settings\n"
+        "[System]\n"
+        "Interval = 10   ; seconds\n"
+        "Module = cpu\n"
+        "    memory\n"
+        "\n"
+        "[Old]\n"
+        "Key = 1\n";
+    ini_doc_t *doc = ini_doc_parse(doc_text, strlen(doc_text));
+    strcpy(txn_arg.name, "Interval");
+    txn_arg.values_number = 1;
+    ini_doc_set(doc, "System", &txn_arg);
+    strcpy(txn_arg.name, "Module");
+    txn_arg.values_number = 2;
+    ini_doc_set(doc, "System", &txn_arg);
+    ret = ini_doc_remove_arg(doc, "System", "Missing");
+    printf("ini_doc_remove_arg missing, ret=%d\n", ret);
+    ini_doc_rename_arg(doc, "Old", "Key", "NewKey");
+    ini_doc_rename_section(doc, "Old", "New");
+    strcpy(txn_arg.name, "Files");
+    txn_arg.values_number = 1;
+    ini_doc_set(doc, "FileInput", &txn_arg);
+    ini_doc_write(doc, stdout);
+    ini_doc_remove_section(doc, "New");
+    ini_doc_remove_arg(doc, "System", "Module");
+    ini_doc_write(doc, stdout);
+    ini_doc_free(doc);
+
+    printf("test ini_watch\n");
+    const char *watch_filename = "watch.ini";
+    FILE *watch_file = fopen(watch_filename, "w");
+    fprintf(watch_file, "[System]\nInterval = 10\n");
+    fclose(watch_file);
+    int reloads = 0;
+    ini_watch_t *watch = ini_watch_start(watch_filename, watch_handler, &reloads);
+    ini_t *snapshot = ini_watch_acquire(watch);
+    printf("Interval = %s\n", ini_get_arg(snapshot, "System", "Interval")->values[0]);
+    doc = ini_doc_load(watch_filename);
+    strcpy(txn_arg.name, "Interval");
+    txn_arg.values_number = 1;
+    txn_values[0] = "20";
+    ini_doc_set(doc, "System", &txn_arg);
+    ini_doc_save(doc, watch_filename);
+    ini_doc_free(doc);
+    for (int i = 0; i < 200 && __atomic_load_n(&reloads, __ATOMIC_SEQ_CST) == 0; i++)
+        usleep(10 * 1000);
+    printf("old snapshot Interval = %s\n", ini_get_arg(snapshot, "System", "Interval")->values[0]);
+    ini_close(snapshot);
+    snapshot = ini_watch_acquire(watch);
+    printf("new snapshot Interval = %s\n", ini_get_arg(snapshot, "System", "Interval")->values[0]);
+    ini_close(snapshot);
+    ini_watch_stop(watch);
+    unlink(watch_filename);
+
+    printf("test ini_diff\n");
+    const char *diff_filename = "diff.ini";
+    doc = ini_doc_load(filename);
+    ini_doc_set(doc, "System4", &txn_arg);
+    strcpy(txn_arg.name, "Threads");
+    ini_doc_set(doc, "System4", &txn_arg);
+    ini_doc_remove_arg(doc, "System4", "ReadThreads");
+    ini_doc_remove_section(doc, "FileInput");
+    ini_doc_set(doc, "Global", &txn_arg);
+    ini_doc_save(doc, diff_filename);
+    ini_doc_free(doc);
+    ini_t *old_ini = ini_open(filename);
+    ini_t *new_ini = ini_open(diff_filename);
+    ini_diff_t *diff = ini_diff(old_ini, new_ini);
+    ini_close(old_ini);
+    ini_close(new_ini);
+    print_diff(diff);
+    ini_diff_free(diff);
+    unlink(diff_filename);
+
+    printf("test ini_log\n");
+    int logged = 0;
+    ini_log_set_sink(count_sink, &logged);
+    ini_log_async_start(64);
+    for (int i = 0; i < 10; i++)
+        get_section("missing.ini", "System4");
+    ini_log_async_stop();
+    printf("logged async: %d\n", logged);
+    ini_log_set_level(INI_LOG_ERROR + 1);
+    get_section("missing.ini", "System4");
+    ini_log_set_level(INI_LOG_DEBUG);
+    printf("logged above level: %d\n", logged);
+    ini_log_set_sink(NULL, NULL);
+
+    printf("test ini_stats\n");
+    ini_stats_t stats;
+    ini_stats_enable(1);
+    ini_stats_snapshot(&stats, 1);
+    free_arg_data(get_arg(filename, "System4", "Interval"));
+    free_section(ini_parse(filename));
+    ini_stats_snapshot(&stats, 1);
+    ini_stats_enable(0);
+    printf("sections: %llu, early stops: %llu, lookups: %llu, parses: %llu\n",
+           (unsigned long long)stats.counters[INI_STAT_SECTIONS],
+           (unsigned long long)stats.counters[INI_STAT_EARLY_STOPS],
+           (unsigned long long)stats.timers[INI_TIMER_LOOKUP].count,
+           (unsigned long long)stats.timers[INI_TIMER_PARSE].count);
+    free_arg_data(get_arg(filename, "System4", "Interval"));
+    ini_stats_snapshot(&stats, 0);
+    printf("counted while disabled: %llu\n",
+           (unsigned long long)stats.counters[INI_STAT_BYTES_SCANNED]);
+    FILE *dump = tmpfile();
+    ini_stats_dump(dump);
+    printf("dump bytes: %ld\n", ftell(dump));
+    fclose(dump);
+
+    printf("test ini_journal\n");
+    const char *journal_filename = "journal.ini";
+    doc = ini_doc_load(filename);
+    ini_doc_save(doc, journal_filename);
+    ini_doc_free(doc);
+    ini_journal_t *journal = ini_journal_open(journal_filename, 0);
+    char limit[16];
+    char *limit_values[] = { limit };
+    ini_arg_data_t limit_arg;
+    memset(&limit_arg, 0, sizeof(ini_arg_data_t));
+    strcpy(limit_arg.name, "WriteQueueLimitHigh");
+    limit_arg.values = limit_values;
+    limit_arg.values_number = 1;
+    for (int i = 1; i <= 3; i++) {
+        sprintf(limit, "%d", i * 1000);
+        ini_journal_add_arg(journal, "System4", &limit_arg);
+    }
+    ini_journal_add_arg(journal, "Tuner", &limit_arg);
+    FILE *torn = fopen("journal.ini.journal", "a");
+    fputs("INIJ torn", torn);
+    fclose(torn);
+    ini_t *journal_ini = ini_journal_load(journal_filename);
+    printf("journal: %s, new section: %d\n",
+           ini_get_arg(journal_ini, "System4", "WriteQueueLimitHigh")->values[0],
+           ini_get_section(journal_ini, "Tuner") != NULL);
+    ini_close(journal_ini);
+    ini_journal_close(journal);
+    journal = ini_journal_open(journal_filename, 0);
+    ret = ini_journal_compact(journal);
+    ini_journal_close(journal);
+    journal_ini = ini_open(journal_filename);
+    printf("compact, ret=%d, base: %s\n", ret,
+           ini_get_arg(journal_ini, "System4", "WriteQueueLimitHigh")->values[0]);
+    ini_close(journal_ini);
+    journal_ini = ini_journal_load(journal_filename);
+    printf("after compact: %s\n",
+           ini_get_arg(journal_ini, "System4", "WriteQueueLimitHigh")->values[0]);
+    ini_close(journal_ini);
+    unlink(journal_filename);
+    unlink("journal.ini.journal");
+
+    printf("test add_arg_ex\n");
+    unlink("coalesce.ini");
+    pthread_t writers[4];
+    ini_arg_data_t writer_args[4];
+    char *writer_values[] = { "on" };
+    for (int i = 0; i < 4; i++) {
+        memset(&writer_args[i], 0, sizeof(ini_arg_data_t));
+        sprintf(writer_args[i].name, "Writer%d", i);
+        writer_args[i].values = writer_values;
+        writer_args[i].values_number = 1;
+        pthread_create(&writers[i], NULL, coalesce_writer, &writer_args[i]);
+    }
+    for (int i = 0; i < 4; i++)
+        pthread_join(writers[i], NULL);
+    ini_t *coalesce_ini = ini_open("coalesce.ini");
+    int written = 0;
+    for (ini_arg_t *arg = ini_get_section(coalesce_ini, "Tuner")->args; arg; arg = arg->next)
+        written++;
+    printf("coalesced args: %d\n", written);
+    ini_close(coalesce_ini);
+    unlink("coalesce.ini");
+
     return 0;
 }
 // vim: set ts=4 sw=4 sts=4 et:
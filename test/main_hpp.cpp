@@ -0,0 +1,48 @@
+#include "utils_ini.hpp"
+#include <cstdio>
+
+int main()
+{
+    const char *filename = "test.ini";
+
+    printf("test ini::Config\n");
+    ini::Config config(filename);
+    if (!config) {
+        printf("Can't open '%s'", filename);
+        return -1;
+    }
+    static constexpr ini::Key interval("System4", "Interval");
+    static_assert(interval.hash == ini::Key("System4", "Interval").hash, "constexpr hash");
+    printf("hash matches: %d\n", interval.hash == ini_key_hash("System4", "Interval"));
+    printf("Interval: %d\n", config.get<int>(interval, 0));
+    printf("ReadThreads: %u\n", config.get<unsigned>({ "System4", "ReadThreads" }, 0));
+    printf("missing: %d\n", config.get<int>({ "System4", "Missing" }).has_value());
+    printf("Module as int: %d\n", config.get<int>({ "System4", "Module" }).has_value());
+    printf("WriteQueueLimitHigh as int16_t: %d, as double: %g\n",
+           config.get<int16_t>({ "System4", "WriteQueueLimitHigh" }).has_value(),
+           config.get<double>({ "System4", "WriteQueueLimitHigh" }, 0));
+    for (std::string_view value : config.arg({ "System4", "Module" }).values())
+        printf("Module: %.*s\n", (int)value.size(), value.data());
+
+    printf("test ini::Config sections\n");
+    for (ini::SectionView section : config.sections()) {
+        printf("[%.*s]\n", (int)section.name().size(), section.name().data());
+        for (ini::ArgView arg : section.args())
+            printf("  %.*s: %zu values\n", (int)arg.name().size(), arg.name().data(),
+                   arg.values().size());
+    }
+
+    printf("test ini::Section\n");
+    ini::Section section(filename, "FileInput");
+    ini::Section moved = std::move(section);
+    printf("moved from: %d, Files: %zu values\n", (bool)section,
+           moved.arg("Files").values().size());
+
+    printf("test ini::Tree\n");
+    ini::Tree tree(filename);
+    size_t sections = 0;
+    for (ini::SectionView s : tree.sections())
+        sections += s.get<std::string_view>("Module").has_value();
+    printf("sections with Module: %zu\n", sections);
+    return 0;
+}